@@ -0,0 +1,523 @@
+module;
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+export module asset_io;
+
+import std;
+import logger;
+
+using std::atomic;
+using std::atomic_ref;
+using std::byte;
+using std::condition_variable_any;
+using std::function;
+using std::int64_t;
+using std::jthread;
+using std::lock_guard;
+using std::max;
+using std::min;
+using std::mutex;
+using std::optional;
+using std::runtime_error;
+using std::size_t;
+using std::span;
+using std::string;
+using std::string_view;
+using std::unique_lock;
+using std::unique_ptr;
+using std::vector;
+using std::chrono::steady_clock;
+using std::filesystem::path;
+
+/*
+ * asset i/o: files are read whole into memory, decoders work on the bytes
+ * (stbi_load_from_memory, scene_file::loaded_scene)
+ * - a batch of files is read through one io_uring: large files are split
+ *   into chunks and up to queue_depth reads are in flight across all files
+ *   of the batch, so a level load keeps an nvme drive busy instead of
+ *   reading one file at a time
+ * - files of at least direct_threshold bytes (cooked blobs) are read with
+ *   O_DIRECT, they are read once and would only evict the page cache
+ * - the completion callback runs on the thread that called read_all as
+ *   soon as a file is complete, from a jobs worker it can hand the bytes
+ *   to a decode job (task_group) while the remaining reads are in flight
+ * - without io_uring (kernel < 5.6, seccomp in containers) the batch is
+ *   read with pread on fallback_threads threads, same callbacks
+ * - a reader is used by one thread at a time
+ */
+
+export namespace asset_io {
+    struct error: runtime_error {
+        error(string_view message)
+            : runtime_error(string(message)) {}
+    };
+
+    /* O_DIRECT wants buffer, file offset and length aligned to the logical block size */
+    constexpr size_t direct_alignment = 4096;
+
+    /* file contents, aligned for O_DIRECT, which is also enough for
+     * whatever a cooked blob holds */
+    struct buffer {
+        struct deleter {
+            void operator()(byte *p) const {
+                ::operator delete[](p, std::align_val_t(direct_alignment));
+            }
+        };
+
+        unique_ptr<byte[], deleter> storage;
+        size_t size = 0;
+
+        buffer() = default;
+
+        /* capacity is rounded up to direct_alignment, O_DIRECT reads whole blocks */
+        explicit buffer(size_t size)
+            : storage(new (std::align_val_t(direct_alignment)) byte[max(round_up(size), direct_alignment)])
+            , size(size) {}
+
+        static size_t round_up(size_t n) {
+            return (n + direct_alignment - 1) & ~(direct_alignment - 1);
+        }
+
+        byte *data() {
+            return storage.get();
+        }
+
+        const byte *data() const {
+            return storage.get();
+        }
+
+        span<const byte> bytes() const {
+            return {storage.get(), size};
+        }
+    };
+
+    struct config {
+        /* reads in flight */
+        unsigned queue_depth = 64;
+        /* files of at least this size bypass the page cache */
+        size_t direct_threshold = 4 << 20;
+        /* one file keeps several reads in flight, multiple of direct_alignment */
+        size_t chunk_size = 1 << 20;
+        /* pread threads without io_uring */
+        unsigned fallback_threads = 4;
+    };
+
+    /* open file, closed by the destructor */
+    struct file {
+        int fd = -1;
+        size_t size = 0;
+        bool direct = false;
+
+        file() = default;
+
+        /* throws asset_io::error */
+        file(const path &filename, size_t direct_threshold) {
+            fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0)
+                throw asset_io::error(std::format("could not open {}: {}", filename.string(), std::strerror(errno)));
+            struct stat st;
+            if (::fstat(fd, &st) != 0) {
+                ::close(fd);
+                throw asset_io::error(std::format("could not stat {}: {}", filename.string(), std::strerror(errno)));
+            }
+            size = st.st_size;
+            /* tmpfs and some others refuse O_DIRECT, they are read buffered */
+            if (size >= direct_threshold)
+                direct = ::fcntl(fd, F_SETFL, O_DIRECT) == 0;
+        }
+
+        ~file() {
+            if (fd >= 0)
+                ::close(fd);
+        }
+
+        file(file &&other) noexcept
+            : fd(std::exchange(other.fd, -1)), size(other.size), direct(other.direct) {}
+
+        file & operator=(file &&other) noexcept {
+            std::swap(fd, other.fd);
+            size = other.size;
+            direct = other.direct;
+            return *this;
+        }
+    };
+
+    /* whole file with pread, on the calling thread, throws asset_io::error */
+    buffer read_file(const path &filename, size_t direct_threshold = std::numeric_limits<size_t>::max()) {
+        file f(filename, direct_threshold);
+        buffer data(f.size);
+        size_t done = 0;
+        while (done < f.size) {
+            size_t length = f.direct ? buffer::round_up(f.size) - done : f.size - done;
+            ssize_t n = ::pread(f.fd, data.data() + done, length, done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                throw asset_io::error(std::format("could not read {}", filename.string()));
+            done += n;
+        }
+        return data;
+    }
+
+    /* io_uring without liburing: the rings are mapped and driven directly */
+    struct ring {
+        int fd = -1;
+        unsigned entries = 0;
+
+        void *sq_map = MAP_FAILED;
+        size_t sq_map_size = 0;
+        void *cq_map = MAP_FAILED;
+        size_t cq_map_size = 0;
+        io_uring_sqe *sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+        size_t sqes_size = 0;
+
+        unsigned *sq_head;
+        unsigned *sq_tail;
+        unsigned sq_mask;
+        unsigned *sq_array;
+        unsigned *cq_head;
+        unsigned *cq_tail;
+        unsigned cq_mask;
+        io_uring_cqe *cqes;
+        /* next sqe to write, *sq_tail only moves to it in submit() */
+        unsigned local_tail = 0;
+
+        /* throws asset_io::error if the kernel has no (usable) io_uring */
+        explicit ring(unsigned depth) {
+            io_uring_params params = {};
+            fd = int(::syscall(__NR_io_uring_setup, depth, &params));
+            if (fd < 0)
+                throw asset_io::error(std::format("io_uring_setup: {}", std::strerror(errno)));
+            /* IORING_OP_READ came with 5.6, as did this feature bit */
+            if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+                ::close(fd);
+                throw asset_io::error("io_uring lacks IORING_OP_READ (kernel < 5.6)");
+            }
+            entries = params.sq_entries;
+
+            sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+            if (single_mmap)
+                sq_map_size = cq_map_size = max(sq_map_size, cq_map_size);
+            sq_map = ::mmap(nullptr, sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+            if (sq_map != MAP_FAILED)
+                cq_map = single_mmap ? sq_map
+                    : ::mmap(nullptr, cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+            if (cq_map != MAP_FAILED)
+                sqes = static_cast<io_uring_sqe *>(
+                    ::mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+            if (sqes == MAP_FAILED) {
+                release();
+                throw asset_io::error("could not map the io_uring rings");
+            }
+
+            byte *sq = static_cast<byte *>(sq_map);
+            sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+            sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+            local_tail = *sq_tail;
+            sq_mask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+            sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+            byte *cq = static_cast<byte *>(cq_map);
+            cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+            cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+            cq_mask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+            cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+        }
+
+        ~ring() {
+            release();
+        }
+
+        ring(const ring &) = delete;
+        ring & operator=(const ring &) = delete;
+
+        void release() {
+            if (sqes != MAP_FAILED)
+                ::munmap(sqes, sqes_size);
+            if (cq_map != MAP_FAILED && cq_map != sq_map)
+                ::munmap(cq_map, cq_map_size);
+            if (sq_map != MAP_FAILED)
+                ::munmap(sq_map, sq_map_size);
+            if (fd >= 0)
+                ::close(fd);
+        }
+
+        /* queues a read, the caller keeps at most entries in flight */
+        void read(int file_fd, byte *target, unsigned length, size_t offset, std::uint64_t user_data) {
+            unsigned index = local_tail & sq_mask;
+            io_uring_sqe &sqe = sqes[index];
+            std::memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = IORING_OP_READ;
+            sqe.fd = file_fd;
+            sqe.addr = reinterpret_cast<std::uint64_t>(target);
+            sqe.len = length;
+            sqe.off = offset;
+            sqe.user_data = user_data;
+            sq_array[index] = index;
+            local_tail++;
+        }
+
+        /* hands the queued reads to the kernel, waits for one completion if
+         * asked. the kernel's head tells what is left of an earlier call that
+         * stopped on EBUSY, the tail is only published once per sqe */
+        void submit(bool wait) {
+            atomic_ref(*sq_tail).store(local_tail, std::memory_order_release);
+            unsigned unsubmitted = local_tail - atomic_ref(*sq_head).load(std::memory_order_acquire);
+            unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+            while (unsubmitted > 0 || wait) {
+                int n = int(::syscall(__NR_io_uring_enter, fd, unsubmitted, wait ? 1 : 0, flags, nullptr, 0));
+                if (n < 0) {
+                    /* EBUSY: the completion ring is full, the caller reaps and comes back */
+                    if (errno == EINTR)
+                        continue;
+                    if (errno == EBUSY || errno == EAGAIN)
+                        return;
+                    throw asset_io::error(std::format("io_uring_enter: {}", std::strerror(errno)));
+                }
+                unsubmitted -= n;
+                wait = false;
+                flags = 0;
+            }
+        }
+
+        /* calls f(user_data, result) for every completion */
+        template<typename F>
+        void reap(F &&f) {
+            unsigned head = *cq_head;
+            unsigned tail = atomic_ref(*cq_tail).load(std::memory_order_acquire);
+            for (; head != tail; ++head) {
+                const io_uring_cqe &cqe = cqes[head & cq_mask];
+                f(cqe.user_data, cqe.res);
+            }
+            atomic_ref(*cq_head).store(head, std::memory_order_release);
+        }
+    };
+
+    struct reader {
+        /* index into the batch, nullopt if the file could not be read (logged) */
+        using completion = function<void(size_t index, optional<buffer> data)>;
+
+        config settings;
+        optional<ring> uring;
+        /* totals for throughput, nanoseconds while a batch is being read */
+        atomic<size_t> bytes = 0;
+        atomic<size_t> files = 0;
+        atomic<int64_t> nanoseconds = 0;
+
+        explicit reader(config settings = {})
+            : settings(settings) {
+            this->settings.chunk_size = max(buffer::round_up(settings.chunk_size), direct_alignment);
+            try {
+                uring.emplace(max(settings.queue_depth, 1u));
+            } catch (const asset_io::error &e) {
+                logger::info("asset i/o falls back to pread: {}", e.what());
+            }
+        }
+
+        reader(const reader &) = delete;
+        reader & operator=(const reader &) = delete;
+
+        bool uses_uring() const {
+            return uring.has_value();
+        }
+
+        /* reads every file, on_read runs on this thread in completion order
+         * and must not throw: other reads of the batch are in flight */
+        void read_all(span<const path> filenames, const completion &on_read) {
+            if (filenames.empty())
+                return;
+            auto start = steady_clock::now();
+            if (uring)
+                read_uring(filenames, on_read);
+            else
+                read_threads(filenames, on_read);
+            nanoseconds += std::chrono::nanoseconds(steady_clock::now() - start).count();
+        }
+
+        /* in batch order */
+        vector<optional<buffer>> read_all(span<const path> filenames) {
+            vector<optional<buffer>> result(filenames.size());
+            read_all(filenames, [&] (size_t i, optional<buffer> data) {
+                result[i] = std::move(data);
+            });
+            return result;
+        }
+
+        /* throws asset_io::error */
+        buffer read(const path &filename) {
+            optional<buffer> data = std::move(read_all(span(&filename, 1))[0]);
+            if (!data)
+                throw asset_io::error(std::format("could not read {}", filename.string()));
+            return std::move(*data);
+        }
+
+    private:
+        void finished(size_t index, optional<buffer> data, const completion &on_read) {
+            if (data) {
+                bytes += data->size;
+                files++;
+            }
+            on_read(index, std::move(data));
+        }
+
+        void read_uring(span<const path> filenames, const completion &on_read) {
+            struct pending {
+                file f;
+                buffer data;
+                /* next offset to queue, end of the reads */
+                size_t next = 0;
+                size_t end = 0;
+                unsigned in_flight = 0;
+                bool failed = false;
+                bool complete = false;
+            };
+            /* one read in flight, user_data is its index */
+            struct operation {
+                size_t file;
+                size_t offset;
+                unsigned length;
+            };
+
+            const unsigned depth = uring->entries;
+            vector<pending> files(filenames.size());
+            vector<operation> operations(depth);
+            vector<unsigned> idle(depth);
+            std::iota(idle.rbegin(), idle.rend(), 0u);
+            /* short reads, queued again before new ones */
+            vector<unsigned> retry;
+            size_t next_file = 0;
+            size_t remaining = filenames.size();
+            unsigned in_flight = 0;
+
+            auto finish = [&] (size_t i) {
+                pending &p = files[i];
+                if (p.complete)
+                    return;
+                p.complete = true;
+                p.f = {};
+                optional<buffer> data;
+                if (!p.failed)
+                    data = std::move(p.data);
+                p.data = {};
+                remaining--;
+                finished(i, std::move(data), on_read);
+            };
+
+            while (remaining > 0) {
+                /* fill the submission queue: retries, then the next chunks in file order */
+                while (!retry.empty()) {
+                    operation &op = operations[retry.back()];
+                    uring->read(files[op.file].f.fd, files[op.file].data.data() + op.offset, op.length, op.offset, retry.back());
+                    retry.pop_back();
+                }
+                while (!idle.empty() && next_file < files.size()) {
+                    pending &p = files[next_file];
+                    if (p.f.fd < 0 && !p.failed && !p.complete) {
+                        try {
+                            p.f = file(filenames[next_file], settings.direct_threshold);
+                            p.data = buffer(p.f.size);
+                            p.end = p.f.direct ? buffer::round_up(p.f.size) : p.f.size;
+                        } catch (const asset_io::error &e) {
+                            logger::error("{}", e.what());
+                            p.failed = true;
+                        }
+                    }
+                    if (p.failed || p.next >= p.end) {
+                        /* empty, unopenable or failed with nothing in flight */
+                        if (p.in_flight == 0)
+                            finish(next_file);
+                        next_file++;
+                        continue;
+                    }
+                    unsigned slot = idle.back();
+                    idle.pop_back();
+                    unsigned length = unsigned(min(settings.chunk_size, p.end - p.next));
+                    operations[slot] = {next_file, p.next, length};
+                    uring->read(p.f.fd, p.data.data() + p.next, length, p.next, slot);
+                    p.next += length;
+                    p.in_flight++;
+                    in_flight++;
+                    if (p.next >= p.end)
+                        next_file++;
+                }
+                if (in_flight == 0)
+                    continue;
+
+                uring->submit(true);
+                uring->reap([&] (std::uint64_t slot, int result) {
+                    operation &op = operations[slot];
+                    pending &p = files[op.file];
+                    if (result == -EINTR || result == -EAGAIN) {
+                        retry.push_back(unsigned(slot));
+                        return;
+                    }
+                    if (result > 0 && unsigned(result) < op.length && op.offset + result < p.f.size && !p.failed) {
+                        op.offset += result;
+                        op.length -= result;
+                        retry.push_back(unsigned(slot));
+                        return;
+                    }
+                    /* a direct read ends short at the end of the file */
+                    if (result < 0 || (result == 0 && op.offset < p.f.size)) {
+                        if (!p.failed)
+                            logger::error("read of {} failed: {}", filenames[op.file].c_str(), std::strerror(-result));
+                        p.failed = true;
+                    }
+                    idle.push_back(unsigned(slot));
+                    in_flight--;
+                    if (--p.in_flight == 0 && (p.failed || p.next >= p.end)) {
+                        /* no more chunks of a failed file */
+                        p.next = p.end;
+                        finish(op.file);
+                    }
+                });
+            }
+        }
+
+        void read_threads(span<const path> filenames, const completion &on_read) {
+            mutex done_mutex;
+            condition_variable_any done_changed;
+            vector<std::pair<size_t, optional<buffer>>> done;
+            atomic<size_t> next = 0;
+
+            auto work = [&] {
+                for (size_t i = next++; i < filenames.size(); i = next++) {
+                    optional<buffer> data;
+                    try {
+                        data = read_file(filenames[i], settings.direct_threshold);
+                    } catch (const asset_io::error &e) {
+                        logger::error("{}", e.what());
+                    }
+                    lock_guard lock(done_mutex);
+                    done.emplace_back(i, std::move(data));
+                    done_changed.notify_one();
+                }
+            };
+            vector<jthread> threads;
+            size_t thread_count = min<size_t>(max(settings.fallback_threads, 1u), filenames.size());
+            for (size_t t = 0; t < thread_count; ++t)
+                threads.emplace_back(work);
+
+            for (size_t delivered = 0; delivered < filenames.size();) {
+                vector<std::pair<size_t, optional<buffer>>> batch;
+                {
+                    unique_lock lock(done_mutex);
+                    done_changed.wait(lock, [&] { return !done.empty(); });
+                    batch = std::exchange(done, {});
+                }
+                for (auto &[i, data] : batch)
+                    finished(i, std::move(data), on_read);
+                delivered += batch.size();
+            }
+        }
+    };
+}
@@ -0,0 +1,64 @@
+#version 460 core
+
+/* one bloom level down: 13 bilinear taps of the larger level (jimenez,
+ * next generation post processing in call of duty aw). the first pass also
+ * drops everything below threshold and weights the taps by 1 / (1 + luma)
+ * (karis average) so that single very bright pixels do not flicker */
+layout (local_size_x = 8, local_size_y = 8) in;
+
+layout (binding = 0) uniform sampler2D source;
+layout (binding = 0, rgba16f) uniform writeonly image2D destination;
+
+layout (location = 0) uniform bool prefilter;
+layout (location = 1) uniform float threshold;
+
+float luma(vec3 c) {
+    return dot(c, vec3(0.2126, 0.7152, 0.0722));
+}
+
+vec3 bright(vec3 c) {
+    return c * max(luma(c) - threshold, 0.0) / max(luma(c), 1e-4);
+}
+
+/* average of four taps, karis weighted when prefiltering */
+vec3 group(vec3 a, vec3 b, vec3 c, vec3 d) {
+    if (!prefilter)
+        return (a + b + c + d) * 0.25;
+    a = bright(a); b = bright(b); c = bright(c); d = bright(d);
+    float wa = 1.0 / (1.0 + luma(a));
+    float wb = 1.0 / (1.0 + luma(b));
+    float wc = 1.0 / (1.0 + luma(c));
+    float wd = 1.0 / (1.0 + luma(d));
+    return (a * wa + b * wb + c * wc + d * wd) / (wa + wb + wc + wd);
+}
+
+void main() {
+    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 size = imageSize(destination);
+    if (any(greaterThanEqual(texel, size)))
+        return;
+
+    vec2 uv = (vec2(texel) + 0.5) / vec2(size);
+    vec2 s = 1.0 / vec2(textureSize(source, 0));
+
+    vec3 a = textureLod(source, uv + s * vec2(-2, -2), 0).rgb;
+    vec3 b = textureLod(source, uv + s * vec2( 0, -2), 0).rgb;
+    vec3 c = textureLod(source, uv + s * vec2( 2, -2), 0).rgb;
+    vec3 d = textureLod(source, uv + s * vec2(-1, -1), 0).rgb;
+    vec3 e = textureLod(source, uv + s * vec2( 1, -1), 0).rgb;
+    vec3 f = textureLod(source, uv + s * vec2(-2,  0), 0).rgb;
+    vec3 g = textureLod(source, uv,                    0).rgb;
+    vec3 h = textureLod(source, uv + s * vec2( 2,  0), 0).rgb;
+    vec3 i = textureLod(source, uv + s * vec2(-1,  1), 0).rgb;
+    vec3 j = textureLod(source, uv + s * vec2( 1,  1), 0).rgb;
+    vec3 k = textureLod(source, uv + s * vec2(-2,  2), 0).rgb;
+    vec3 l = textureLod(source, uv + s * vec2( 0,  2), 0).rgb;
+    vec3 m = textureLod(source, uv + s * vec2( 2,  2), 0).rgb;
+
+    vec3 color = group(d, e, i, j) * 0.5
+               + group(a, b, f, g) * 0.125
+               + group(b, c, g, h) * 0.125
+               + group(f, g, k, l) * 0.125
+               + group(g, h, l, m) * 0.125;
+    imageStore(destination, texel, vec4(color, 1.0));
+}
@@ -0,0 +1,37 @@
+#version 460 core
+
+/* one bloom level up: 3x3 tent filter of the smaller level, added to what
+ * the destination holds (its own downsample) when accumulating */
+layout (local_size_x = 8, local_size_y = 8) in;
+
+layout (binding = 0) uniform sampler2D source;
+layout (binding = 0, rgba16f) uniform image2D destination;
+
+layout (location = 0) uniform bool accumulate;
+/* in texels of the source */
+layout (location = 1) uniform float radius;
+
+void main() {
+    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 size = imageSize(destination);
+    if (any(greaterThanEqual(texel, size)))
+        return;
+
+    vec2 uv = (vec2(texel) + 0.5) / vec2(size);
+    vec2 s = radius / vec2(textureSize(source, 0));
+
+    vec3 color = textureLod(source, uv, 0).rgb * 4.0;
+    color += (textureLod(source, uv + s * vec2(-1,  0), 0).rgb
+           +  textureLod(source, uv + s * vec2( 1,  0), 0).rgb
+           +  textureLod(source, uv + s * vec2( 0, -1), 0).rgb
+           +  textureLod(source, uv + s * vec2( 0,  1), 0).rgb) * 2.0;
+    color += textureLod(source, uv + s * vec2(-1, -1), 0).rgb
+           + textureLod(source, uv + s * vec2( 1, -1), 0).rgb
+           + textureLod(source, uv + s * vec2(-1,  1), 0).rgb
+           + textureLod(source, uv + s * vec2( 1,  1), 0).rgb;
+    color /= 16.0;
+
+    if (accumulate)
+        color += imageLoad(destination, texel).rgb;
+    imageStore(destination, texel, vec4(color, 1.0));
+}
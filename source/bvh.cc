@@ -0,0 +1,528 @@
+module;
+#include "multiversion.h"
+
+export module bvh;
+
+import std;
+import glm;
+
+using std::array;
+using std::int32_t;
+using std::numeric_limits;
+using std::optional;
+using std::size_t;
+using std::span;
+using std::uint32_t;
+using std::vector;
+using namespace glm;
+
+/*
+ * bounding volume hierarchy over axis aligned boxes, for what would walk
+ * every entity otherwise: view culling, light ranges, picking
+ * - built top down, splits placed by a binned surface area heuristic, the
+ *   binary tree is then collapsed to four children per node
+ * - a node holds its children's boxes as structure of arrays, so a node is
+ *   tested against a frustum, sphere or ray in one 4-wide pass (the lane
+ *   loops vectorize, MULTIVERSION adds avx2 / avx512 clones)
+ * - nodes are flattened depth first, parents before children: refit is
+ *   one reverse pass over the array and every subtree covers a contiguous
+ *   range of items, a box fully inside the frustum emits its range untested
+ * - refit keeps the topology while the boxes move. that is cheap but the
+ *   tree degrades, degradation() tells by how much and the owner rebuilds
+ */
+
+export struct aabb {
+    vec3 min = vec3(numeric_limits<float>::max());
+    vec3 max = vec3(numeric_limits<float>::lowest());
+
+    bool empty() const {
+        return min.x > max.x;
+    }
+
+    void grow(vec3 p) {
+        min = glm::min(min, p);
+        max = glm::max(max, p);
+    }
+
+    void grow(const aabb &b) {
+        min = glm::min(min, b.min);
+        max = glm::max(max, b.max);
+    }
+
+    vec3 center() const {
+        return (min + max) * 0.5f;
+    }
+
+    float surface_area() const {
+        if (empty())
+            return 0;
+        vec3 d = max - min;
+        return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+};
+
+/* box around the transformed box (Arvo) */
+export aabb transform(const aabb &b, const mat4 &M) {
+    if (b.empty())
+        return b;
+    vec3 center = vec3(M * vec4(b.center(), 1));
+    vec3 half = (b.max - b.min) * 0.5f;
+    vec3 extent = abs(vec3(M[0])) * half.x + abs(vec3(M[1])) * half.y + abs(vec3(M[2])) * half.z;
+    return {center - extent, center + extent};
+}
+
+/* planes point inwards: dot(plane, vec4(p, 1)) >= 0 inside */
+export struct frustum {
+    array<vec4, 6> planes;
+};
+
+/* planes of a (gl clip space) view projection matrix, Gribb & Hartmann */
+export frustum make_frustum(const mat4 &view_projection) {
+    auto row = [&] (int i) {
+        return vec4(view_projection[0][i], view_projection[1][i], view_projection[2][i], view_projection[3][i]);
+    };
+    frustum f = {{
+        row(3) + row(0), row(3) - row(0),
+        row(3) + row(1), row(3) - row(1),
+        row(3) + row(2), row(3) - row(2)
+    }};
+    for (vec4 &p : f.planes)
+        p /= length(vec3(p));
+    return f;
+}
+
+/* points origin + t * direction for t in [0, max_t] */
+export struct ray {
+    vec3 origin;
+    vec3 direction;
+    float max_t = numeric_limits<float>::infinity();
+};
+
+/* one box at a time, for the brute force paths and items outside a tree */
+export bool intersects(const frustum &f, const aabb &b) {
+    for (const vec4 &p : f.planes) {
+        vec3 positive = mix(b.min, b.max, greaterThan(vec3(p), vec3(0)));
+        if (dot(vec3(p), positive) + p.w < 0)
+            return false;
+    }
+    return true;
+}
+
+export bool intersects(vec3 center, float radius, const aabb &b) {
+    vec3 d = clamp(center, b.min, b.max) - center;
+    return dot(d, d) <= radius * radius;
+}
+
+/* t where the ray enters the box (0 if it starts inside) */
+export optional<float> intersect(const ray &r, const aabb &b) {
+    vec3 inv = 1.f / r.direction;
+    vec3 t0 = (b.min - r.origin) * inv;
+    vec3 t1 = (b.max - r.origin) * inv;
+    vec3 near = glm::min(t0, t1);
+    vec3 far = glm::max(t0, t1);
+    float enter = std::max({near.x, near.y, near.z, 0.f});
+    float leave = std::min({far.x, far.y, far.z, r.max_t});
+    if (b.empty() || enter > leave)
+        return std::nullopt;
+    return enter;
+}
+
+export struct bvh {
+    static constexpr uint32_t max_leaf_size = 4;
+    static constexpr int bin_count = 16;
+    /* deeper splits take halves (at most 32 more levels), which bounds
+     * the traversal stacks: three siblings wait per level */
+    static constexpr int max_depth = 48;
+    static constexpr int stack_size = 3 * (max_depth + 32) + 1;
+
+    /* four children, 144 bytes. child >= 0 is an inner node, child < 0 a
+     * leaf. either way the lane covers items [first, first + count), an
+     * unused lane has count 0 and an inverted box no test passes */
+    struct alignas(16) node {
+        array<float, 4> min_x, min_y, min_z;
+        array<float, 4> max_x, max_y, max_z;
+        array<int32_t, 4> child;
+        array<uint32_t, 4> first;
+        array<uint32_t, 4> count;
+
+        aabb lane(int k) const {
+            return {vec3(min_x[k], min_y[k], min_z[k]), vec3(max_x[k], max_y[k], max_z[k])};
+        }
+
+        void set_lane(int k, const aabb &b) {
+            min_x[k] = b.min.x; min_y[k] = b.min.y; min_z[k] = b.min.z;
+            max_x[k] = b.max.x; max_y[k] = b.max.y; max_z[k] = b.max.z;
+        }
+
+        aabb bounds() const {
+            aabb b;
+            for (int k = 0; k < 4; ++k)
+                b.grow(lane(k));
+            return b;
+        }
+    };
+
+    vector<node> nodes;
+    /* item ids in leaf order, and their boxes in the same order */
+    vector<uint32_t> items;
+    vector<aabb> item_boxes;
+    aabb bounds;
+    /* cost() right after the build */
+    float build_cost = 0;
+
+    /* item i is boxes[i] */
+    void build(span<const aabb> boxes);
+    /* same items, new boxes */
+    void refit(span<const aabb> boxes);
+
+    /* surface area heuristic of the tree relative to its root: expected
+     * node visits plus item tests of a random query */
+    float cost() const;
+
+    /* cost() over build_cost, 1 right after a build */
+    float degradation() const {
+        return build_cost > 0 ? cost() / build_cost : 1;
+    }
+
+    /* appends the items whose box intersects */
+    void query(const frustum &f, vector<uint32_t> &result) const;
+    void query(vec3 center, float radius, vector<uint32_t> &result) const;
+    /* nearest hit first, the caller decides what counts as a hit */
+    void query(const ray &r, vector<std::pair<uint32_t, float>> &result) const;
+
+private:
+    struct build_node {
+        aabb box;
+        uint32_t first;
+        uint32_t count;
+        /* build_nodes, leaf if left == right */
+        uint32_t left = 0;
+        uint32_t right = 0;
+    };
+
+    uint32_t split(vector<build_node> &tree, span<vec3> centers, uint32_t first, uint32_t count, int depth);
+    int32_t collapse(const vector<build_node> &tree, uint32_t root);
+};
+
+void bvh::build(span<const aabb> boxes) {
+    nodes.clear();
+    items.resize(boxes.size());
+    std::iota(items.begin(), items.end(), 0u);
+    item_boxes.assign(boxes.begin(), boxes.end());
+    bounds = {};
+    build_cost = 0;
+    if (boxes.empty())
+        return;
+
+    /* permuted along with items, so splits read them in order */
+    vector<vec3> centers(boxes.size());
+    for (size_t i = 0; i < boxes.size(); ++i)
+        centers[i] = boxes[i].empty() ? vec3(0) : boxes[i].center();
+
+    vector<build_node> tree;
+    tree.reserve(2 * boxes.size() / max_leaf_size + 1);
+    split(tree, centers, 0, uint32_t(boxes.size()), 0);
+
+    nodes.reserve(tree.size() / 2 + 1);
+    collapse(tree, 0);
+    bounds = tree[0].box;
+    build_cost = cost();
+}
+
+/* items [first, first + count) into a subtree, returns its build_node */
+uint32_t bvh::split(vector<build_node> &tree, span<vec3> centers, uint32_t first, uint32_t count, int depth) {
+    const uint32_t last = first + count;
+    uint32_t index = uint32_t(tree.size());
+    tree.push_back({.first = first, .count = count});
+    aabb box;
+    aabb centroid_box;
+    for (uint32_t i = first; i < last; ++i) {
+        box.grow(item_boxes[i]);
+        centroid_box.grow(centers[i]);
+    }
+    tree[index].box = box;
+    if (count <= max_leaf_size)
+        return index;
+
+    /* cheapest bin border over all three axes, cost = area * items per side */
+    struct bin {
+        aabb box;
+        uint32_t count = 0;
+    };
+    const vec3 extent = centroid_box.max - centroid_box.min;
+    vec3 scale = vec3(0);
+    for (int axis = 0; axis < 3; ++axis)
+        if (extent[axis] > 0)
+            scale[axis] = bin_count / extent[axis];
+    auto bin_of = [&] (vec3 center, int axis) {
+        return std::min(bin_count - 1, int((center[axis] - centroid_box.min[axis]) * scale[axis]));
+    };
+    array<array<bin, bin_count>, 3> bins = {};
+    if (depth < max_depth) {
+        for (uint32_t i = first; i < last; ++i) {
+            for (int axis = 0; axis < 3; ++axis) {
+                bin &b = bins[axis][bin_of(centers[i], axis)];
+                b.box.grow(item_boxes[i]);
+                b.count++;
+            }
+        }
+    }
+    float best_cost = numeric_limits<float>::infinity();
+    int best_axis = -1;
+    int best_border = 0;
+    for (int axis = 0; axis < 3 && depth < max_depth; ++axis) {
+        if (extent[axis] <= 0)
+            continue;
+        array<float, bin_count> left_cost;
+        aabb left;
+        uint32_t left_count = 0;
+        for (int b = 0; b < bin_count - 1; ++b) {
+            left.grow(bins[axis][b].box);
+            left_count += bins[axis][b].count;
+            left_cost[b] = left.surface_area() * left_count;
+        }
+        aabb right;
+        uint32_t right_count = 0;
+        for (int b = bin_count - 1; b > 0; --b) {
+            right.grow(bins[axis][b].box);
+            right_count += bins[axis][b].count;
+            float c = left_cost[b - 1] + right.surface_area() * right_count;
+            if (right_count > 0 && right_count < count && c < best_cost) {
+                best_cost = c;
+                best_axis = axis;
+                best_border = b;
+            }
+        }
+    }
+
+    /* all centers in one point, or too deep: halves in any order */
+    uint32_t middle = first + count / 2;
+    if (best_axis >= 0) {
+        middle = first;
+        for (uint32_t i = first; i < last; ++i) {
+            if (bin_of(centers[i], best_axis) >= best_border)
+                continue;
+            std::swap(items[i], items[middle]);
+            std::swap(item_boxes[i], item_boxes[middle]);
+            std::swap(centers[i], centers[middle]);
+            middle++;
+        }
+    }
+
+    uint32_t left = split(tree, centers, first, middle - first, depth + 1);
+    uint32_t right = split(tree, centers, middle, last - middle, depth + 1);
+    tree[index].left = left;
+    tree[index].right = right;
+    return index;
+}
+
+/* pulls the up to four largest descendants of root into one node */
+int32_t bvh::collapse(const vector<build_node> &tree, uint32_t root) {
+    auto is_leaf = [&] (uint32_t b) {
+        return tree[b].left == tree[b].right;
+    };
+    std::array<uint32_t, 4> children;
+    int n = 0;
+    if (is_leaf(root)) {
+        children[n++] = root;
+    } else {
+        children[n++] = tree[root].left;
+        children[n++] = tree[root].right;
+        while (n < 4) {
+            int widest = -1;
+            for (int k = 0; k < n; ++k)
+                if (!is_leaf(children[k]) && (widest < 0 || tree[children[k]].box.surface_area() > tree[children[widest]].box.surface_area()))
+                    widest = k;
+            if (widest < 0)
+                break;
+            uint32_t opened = children[widest];
+            children[widest] = tree[opened].left;
+            children[n++] = tree[opened].right;
+        }
+    }
+
+    int32_t index = int32_t(nodes.size());
+    nodes.emplace_back();
+    for (int k = 0; k < 4; ++k) {
+        nodes[index].set_lane(k, {});
+        nodes[index].child[k] = -1;
+        nodes[index].first[k] = 0;
+        nodes[index].count[k] = 0;
+    }
+    for (int k = 0; k < n; ++k) {
+        const build_node &b = tree[children[k]];
+        /* appends below index, nodes may move */
+        int32_t child = is_leaf(children[k]) ? -1 : collapse(tree, children[k]);
+        node &self = nodes[index];
+        self.set_lane(k, b.box);
+        self.child[k] = child;
+        self.first[k] = b.first;
+        self.count[k] = b.count;
+    }
+    return index;
+}
+
+void bvh::refit(span<const aabb> boxes) {
+    for (size_t i = 0; i < items.size(); ++i)
+        item_boxes[i] = boxes[items[i]];
+    for (size_t i = nodes.size(); i-- > 0;) {
+        node &n = nodes[i];
+        for (int k = 0; k < 4; ++k) {
+            if (n.count[k] == 0)
+                continue;
+            aabb b;
+            if (n.child[k] >= 0) {
+                b = nodes[n.child[k]].bounds();
+            } else {
+                for (uint32_t j = n.first[k]; j < n.first[k] + n.count[k]; ++j)
+                    b.grow(item_boxes[j]);
+            }
+            n.set_lane(k, b);
+        }
+    }
+    bounds = nodes.empty() ? aabb{} : nodes[0].bounds();
+}
+
+float bvh::cost() const {
+    float root = bounds.surface_area();
+    if (nodes.empty() || root <= 0)
+        return 0;
+    float area = 0;
+    for (const node &n : nodes)
+        for (int k = 0; k < 4; ++k)
+            if (n.count[k] > 0)
+                area += n.lane(k).surface_area() * (n.child[k] >= 0 ? 1.f : float(n.count[k]));
+    return area / root;
+}
+
+/* lanes whose box is at least partly inside, and those fully inside */
+struct frustum_lanes {
+    unsigned touching;
+    unsigned inside;
+};
+
+frustum_lanes test_lanes(const bvh::node &n, const frustum &f) {
+    array<float, 4> nearest;
+    array<float, 4> farthest;
+    nearest.fill(numeric_limits<float>::max());
+    farthest.fill(numeric_limits<float>::max());
+    for (const vec4 &p : f.planes) {
+        /* the corner farthest along the plane normal, and its opposite */
+        const auto &px = p.x > 0 ? n.max_x : n.min_x;
+        const auto &py = p.y > 0 ? n.max_y : n.min_y;
+        const auto &pz = p.z > 0 ? n.max_z : n.min_z;
+        const auto &qx = p.x > 0 ? n.min_x : n.max_x;
+        const auto &qy = p.y > 0 ? n.min_y : n.max_y;
+        const auto &qz = p.z > 0 ? n.min_z : n.max_z;
+        for (int k = 0; k < 4; ++k) {
+            nearest[k] = std::min(nearest[k], p.x * px[k] + p.y * py[k] + p.z * pz[k] + p.w);
+            farthest[k] = std::min(farthest[k], p.x * qx[k] + p.y * qy[k] + p.z * qz[k] + p.w);
+        }
+    }
+    frustum_lanes lanes = {0, 0};
+    for (int k = 0; k < 4; ++k) {
+        lanes.touching |= unsigned(nearest[k] >= 0) << k;
+        lanes.inside |= unsigned(farthest[k] >= 0 && n.count[k] > 0) << k;
+    }
+    return lanes;
+}
+
+MULTIVERSION void bvh::query(const frustum &f, vector<uint32_t> &result) const {
+    if (nodes.empty())
+        return;
+    array<int32_t, stack_size> stack;
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const node &n = nodes[stack[--top]];
+        frustum_lanes lanes = test_lanes(n, f);
+        for (int k = 0; k < 4; ++k) {
+            if (!(lanes.touching >> k & 1))
+                continue;
+            uint32_t first = n.first[k];
+            uint32_t last = first + n.count[k];
+            if (lanes.inside >> k & 1) {
+                result.insert(result.end(), items.begin() + first, items.begin() + last);
+            } else if (n.child[k] >= 0) {
+                stack[top++] = n.child[k];
+            } else {
+                for (uint32_t j = first; j < last; ++j)
+                    if (intersects(f, item_boxes[j]))
+                        result.push_back(items[j]);
+            }
+        }
+    }
+}
+
+MULTIVERSION void bvh::query(vec3 center, float radius, vector<uint32_t> &result) const {
+    if (nodes.empty())
+        return;
+    const float r2 = radius * radius;
+    array<int32_t, stack_size> stack;
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const node &n = nodes[stack[--top]];
+        array<float, 4> d2;
+        for (int k = 0; k < 4; ++k) {
+            float dx = std::max({n.min_x[k] - center.x, 0.f, center.x - n.max_x[k]});
+            float dy = std::max({n.min_y[k] - center.y, 0.f, center.y - n.max_y[k]});
+            float dz = std::max({n.min_z[k] - center.z, 0.f, center.z - n.max_z[k]});
+            d2[k] = dx * dx + dy * dy + dz * dz;
+        }
+        for (int k = 0; k < 4; ++k) {
+            if (d2[k] > r2 || n.count[k] == 0)
+                continue;
+            if (n.child[k] >= 0) {
+                stack[top++] = n.child[k];
+                continue;
+            }
+            for (uint32_t j = n.first[k]; j < n.first[k] + n.count[k]; ++j)
+                if (intersects(center, radius, item_boxes[j]))
+                    result.push_back(items[j]);
+        }
+    }
+}
+
+MULTIVERSION void bvh::query(const ray &r, vector<std::pair<uint32_t, float>> &result) const {
+    size_t begin = result.size();
+    if (!nodes.empty()) {
+        const vec3 inv = 1.f / r.direction;
+        /* slab planes the ray meets first and last, per axis */
+        const bool forward_x = r.direction.x >= 0;
+        const bool forward_y = r.direction.y >= 0;
+        const bool forward_z = r.direction.z >= 0;
+        array<int32_t, stack_size> stack;
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const node &n = nodes[stack[--top]];
+            const auto &near_x = forward_x ? n.min_x : n.max_x;
+            const auto &near_y = forward_y ? n.min_y : n.max_y;
+            const auto &near_z = forward_z ? n.min_z : n.max_z;
+            const auto &far_x = forward_x ? n.max_x : n.min_x;
+            const auto &far_y = forward_y ? n.max_y : n.min_y;
+            const auto &far_z = forward_z ? n.max_z : n.min_z;
+            array<float, 4> enter;
+            array<float, 4> leave;
+            for (int k = 0; k < 4; ++k) {
+                enter[k] = std::max({(near_x[k] - r.origin.x) * inv.x, (near_y[k] - r.origin.y) * inv.y, (near_z[k] - r.origin.z) * inv.z, 0.f});
+                leave[k] = std::min({(far_x[k] - r.origin.x) * inv.x, (far_y[k] - r.origin.y) * inv.y, (far_z[k] - r.origin.z) * inv.z, r.max_t});
+            }
+            for (int k = 0; k < 4; ++k) {
+                if (enter[k] > leave[k] || n.count[k] == 0)
+                    continue;
+                if (n.child[k] >= 0) {
+                    stack[top++] = n.child[k];
+                    continue;
+                }
+                for (uint32_t j = n.first[k]; j < n.first[k] + n.count[k]; ++j)
+                    if (optional<float> t = intersect(r, item_boxes[j]))
+                        result.emplace_back(items[j], *t);
+            }
+        }
+    }
+    std::sort(result.begin() + begin, result.end(), [] (const auto &a, const auto &b) {
+        return a.second < b.second;
+    });
+}
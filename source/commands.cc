@@ -0,0 +1,321 @@
+module;
+#include "gl_api.h"
+
+export module commands;
+
+import std;
+import gl;
+
+using std::array;
+using std::flat_map;
+using std::size_t;
+using std::span;
+using std::to_underlying;
+using std::uint16_t;
+using std::uint64_t;
+using std::vector;
+
+/*
+ * draws as packets instead of direct gl calls:
+ * - a packet carries everything its draw needs (program, vertex array,
+ *   texture, storage buffer range, indirect buffers), so packets can be
+ *   reordered freely
+ * - command_list gives every packet a sort key, most expensive switch in
+ *   the highest bits: program | vertex array | texture | storage buffer |
+ *   recording order
+ * - submit() goes through a state_cache, a shadow copy of the bindings it
+ *   touches: calls setting what is already set are counted and dropped
+ * - the cache is templated on the api, mock_api records the calls instead
+ *   of issuing them, so a recorded list can be replayed without a context
+ */
+
+export namespace commands {
+    enum class call {
+        use_program,
+        bind_vertex_array,
+        bind_texture_unit,
+        bind_storage_range,
+        bind_indirect_buffer,
+        bind_parameter_buffer,
+        draw,
+        count
+    };
+
+    constexpr array<const char *, to_underlying(call::count)> call_names = {
+        "use program",
+        "bind vertex array",
+        "bind texture unit",
+        "bind storage range",
+        "bind indirect buffer",
+        "bind parameter buffer",
+        "draw"
+    };
+
+    struct draw_packet {
+        uint64_t key = 0;
+        GLuint program;
+        GLuint vertex_array;
+        /* texture 0: the packet does not bind one */
+        GLuint texture_unit = 0;
+        GLuint texture = 0;
+        /* storage_buffer 0: the packet does not bind one */
+        GLuint storage_binding = 0;
+        GLuint storage_buffer = 0;
+        GLintptr storage_offset = 0;
+        GLsizeiptr storage_size = 0;
+        GLenum mode;
+        GLenum element_type;
+        GLsizei count;
+        GLsizei instance_count;
+        /* indirect_buffer != 0: commands from indirect_buffer, their number
+         * from parameter_buffer (at 0), at most max_draw_count */
+        GLuint indirect_buffer = 0;
+        GLuint parameter_buffer = 0;
+        GLsizei max_draw_count = 0;
+    };
+
+    /* instanced draw of a whole mesh */
+    draw_packet make_draw(gl::program &p, gl::mesh &m, gl::DrawMode mode, GLsizei instance_count) {
+        return {
+            .program = p.name,
+            .vertex_array = m.va.name,
+            .mode = to_underlying(mode),
+            .element_type = m.type,
+            .count = m.count,
+            .instance_count = instance_count
+        };
+    }
+
+    /* commands and their count written by the gpu (meshlet culling) */
+    draw_packet make_draw_indirect_count(gl::program &p, gl::mesh &m, gl::DrawMode mode, gl::buffer &commands, gl::buffer &count, GLsizei max_draw_count) {
+        draw_packet packet = make_draw(p, m, mode, 0);
+        packet.indirect_buffer = commands.name;
+        packet.parameter_buffer = count.name;
+        packet.max_draw_count = max_draw_count;
+        return packet;
+    }
+
+    struct call_stats {
+        array<size_t, to_underlying(call::count)> issued = {};
+        array<size_t, to_underlying(call::count)> elided = {};
+
+        size_t total_issued() const {
+            return std::ranges::fold_left(issued, size_t(0), std::plus<>());
+        }
+
+        size_t total_elided() const {
+            return std::ranges::fold_left(elided, size_t(0), std::plus<>());
+        }
+    };
+
+    struct gl_api {
+        void use_program(GLuint program) {
+            glUseProgram(program);
+        }
+
+        void bind_vertex_array(GLuint vertex_array) {
+            glBindVertexArray(vertex_array);
+        }
+
+        void bind_texture_unit(GLuint unit, GLuint texture) {
+            glBindTextureUnit(unit, texture);
+        }
+
+        void bind_storage_range(GLuint binding, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, buffer, offset, size);
+        }
+
+        void bind_indirect_buffer(GLuint buffer) {
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer);
+        }
+
+        void bind_parameter_buffer(GLuint buffer) {
+            glBindBuffer(GL_PARAMETER_BUFFER, buffer);
+        }
+
+        void draw(const draw_packet &p) {
+            if (p.indirect_buffer != 0)
+                glMultiDrawElementsIndirectCount(p.mode, p.element_type, nullptr, 0, p.max_draw_count, 0);
+            else
+                glDrawElementsInstanced(p.mode, p.count, p.element_type, nullptr, p.instance_count);
+        }
+    };
+
+    /* records instead of calling gl */
+    struct mock_api {
+        struct recorded_call {
+            call kind;
+            array<uint64_t, 4> arguments;
+
+            bool operator==(const recorded_call &) const = default;
+        };
+
+        vector<recorded_call> calls;
+
+        void use_program(GLuint program) {
+            calls.push_back({call::use_program, {program}});
+        }
+
+        void bind_vertex_array(GLuint vertex_array) {
+            calls.push_back({call::bind_vertex_array, {vertex_array}});
+        }
+
+        void bind_texture_unit(GLuint unit, GLuint texture) {
+            calls.push_back({call::bind_texture_unit, {unit, texture}});
+        }
+
+        void bind_storage_range(GLuint binding, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+            calls.push_back({call::bind_storage_range, {binding, buffer, uint64_t(offset), uint64_t(size)}});
+        }
+
+        void bind_indirect_buffer(GLuint buffer) {
+            calls.push_back({call::bind_indirect_buffer, {buffer}});
+        }
+
+        void bind_parameter_buffer(GLuint buffer) {
+            calls.push_back({call::bind_parameter_buffer, {buffer}});
+        }
+
+        void draw(const draw_packet &p) {
+            calls.push_back({call::draw, {p.vertex_array, uint64_t(p.count), uint64_t(p.instance_count), p.indirect_buffer}});
+        }
+    };
+
+    template<typename Api>
+    struct state_cache {
+        /* nothing is ever bound to this, forces the first call through */
+        static constexpr GLuint unknown = ~GLuint(0);
+
+        struct storage_range {
+            GLuint buffer = unknown;
+            GLintptr offset = 0;
+            GLsizeiptr size = 0;
+
+            bool operator==(const storage_range &) const = default;
+        };
+
+        Api api;
+        call_stats stats;
+        GLuint program = unknown;
+        GLuint vertex_array = unknown;
+        GLuint indirect_buffer = unknown;
+        GLuint parameter_buffer = unknown;
+        flat_map<GLuint, GLuint> textures;
+        flat_map<GLuint, storage_range> storage;
+
+        /* gl state was changed behind the cache's back (other passes, imgui) */
+        void invalidate() {
+            program = unknown;
+            vertex_array = unknown;
+            indirect_buffer = unknown;
+            parameter_buffer = unknown;
+            textures.clear();
+            storage.clear();
+        }
+
+        void use_program(GLuint p) {
+            if (set(call::use_program, program, p))
+                api.use_program(p);
+        }
+
+        void bind_vertex_array(GLuint va) {
+            if (set(call::bind_vertex_array, vertex_array, va))
+                api.bind_vertex_array(va);
+        }
+
+        void bind_texture_unit(GLuint unit, GLuint texture) {
+            auto [bound, _] = textures.try_emplace(unit, unknown);
+            if (set(call::bind_texture_unit, bound->second, texture))
+                api.bind_texture_unit(unit, texture);
+        }
+
+        void bind_storage_range(GLuint binding, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+            auto [bound, _] = storage.try_emplace(binding);
+            if (set(call::bind_storage_range, bound->second, {buffer, offset, size}))
+                api.bind_storage_range(binding, buffer, offset, size);
+        }
+
+        void bind_indirect_buffer(GLuint buffer) {
+            if (set(call::bind_indirect_buffer, indirect_buffer, buffer))
+                api.bind_indirect_buffer(buffer);
+        }
+
+        void bind_parameter_buffer(GLuint buffer) {
+            if (set(call::bind_parameter_buffer, parameter_buffer, buffer))
+                api.bind_parameter_buffer(buffer);
+        }
+
+        void draw(const draw_packet &p) {
+            stats.issued[to_underlying(call::draw)]++;
+            api.draw(p);
+        }
+
+    private:
+        /* true if the call has to be issued */
+        template<typename T>
+        bool set(call kind, T &current, const T &value) {
+            if (current == value) {
+                stats.elided[to_underlying(kind)]++;
+                return false;
+            }
+            current = value;
+            stats.issued[to_underlying(kind)]++;
+            return true;
+        }
+    };
+
+    struct command_list {
+        vector<draw_packet> packets;
+        /* dense ids keep the key fields small, assigned in order of appearance
+         * within one recording (streamed meshes come and go between them) */
+        flat_map<GLuint, uint16_t> programs;
+        flat_map<GLuint, uint16_t> vertex_arrays;
+        flat_map<GLuint, uint16_t> textures;
+        flat_map<GLuint, uint16_t> buffers;
+
+        void clear() {
+            packets.clear();
+            programs.clear();
+            vertex_arrays.clear();
+            textures.clear();
+            buffers.clear();
+        }
+
+        void add(draw_packet p) {
+            /* 12 bits per field, 16 for the recording order. names past the
+             * 4096th of a recording share the last id instead of wrapping
+             * onto the first ones: they only lose their grouping */
+            auto id = [] (flat_map<GLuint, uint16_t> &ids, GLuint name) -> uint64_t {
+                uint16_t next = uint16_t(std::min<size_t>(ids.size(), 0xfff));
+                return ids.try_emplace(name, next).first->second;
+            };
+            p.key = id(programs, p.program) << 52
+                  | id(vertex_arrays, p.vertex_array) << 40
+                  | id(textures, p.texture) << 28
+                  | id(buffers, p.storage_buffer) << 16
+                  | (packets.size() & 0xffff);
+            packets.push_back(p);
+        }
+
+        void sort() {
+            std::ranges::sort(packets, {}, &draw_packet::key);
+        }
+    };
+
+    template<typename Api>
+    void submit(span<const draw_packet> packets, state_cache<Api> &cache) {
+        for (const draw_packet &p : packets) {
+            cache.use_program(p.program);
+            cache.bind_vertex_array(p.vertex_array);
+            if (p.texture != 0)
+                cache.bind_texture_unit(p.texture_unit, p.texture);
+            if (p.storage_buffer != 0)
+                cache.bind_storage_range(p.storage_binding, p.storage_buffer, p.storage_offset, p.storage_size);
+            if (p.indirect_buffer != 0) {
+                cache.bind_indirect_buffer(p.indirect_buffer);
+                cache.bind_parameter_buffer(p.parameter_buffer);
+            }
+            cache.draw(p);
+        }
+    }
+}
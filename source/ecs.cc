@@ -0,0 +1,378 @@
+module;
+#include <entt/entity/registry.hpp>
+#include "multiversion.h"
+
+export module ecs;
+
+import std;
+import glm;
+import bvh;
+import jobs;
+import memory;
+
+using std::array;
+using std::int32_t;
+using std::optional;
+using std::pair;
+using std::size_t;
+using std::span;
+using std::uint32_t;
+using std::uint64_t;
+using std::vector;
+using namespace glm;
+
+/* scene components and the per frame extraction of what the renderer draws,
+ * no gpu involved so the benchmarks can run it headless */
+
+export struct model_component {
+    mat4 model_matrix;
+    mat4 normal_matrix;
+};
+
+/* color only when texture_index is -1 */
+export struct material_component {
+    vec4 color;
+    int32_t texture_index;
+};
+
+export struct mesh_component {
+    uint32_t index;
+};
+
+/* meshes cast into shadow maps, static casters are cached */
+export struct shadow_caster_component {
+    bool dynamic;
+};
+
+export struct light_source_component {
+    vec3 position;
+};
+
+/* mesh_component.index is picked from the chain every frame */
+export struct lod_component {
+    uint32_t chain;
+    uint32_t level;
+};
+
+/* local space box of what the entity draws, whatever its lod level */
+export struct bounds_component {
+    aabb local;
+};
+
+/* std430 layout of binding_instance_data, one per drawn instance */
+export struct alignas(vec4) instance_data {
+    mat4 normal_matrix;
+    mat4 model_matrix;
+    vec4 color;
+    int  texture_index;
+    uint32_t _[27];
+};
+
+/* what one slice of the group adds up, per sort pass */
+export struct extraction_slice {
+    array<size_t, 256> histogram;
+    vector<size_t> counts; /* per mesh */
+    uint32_t max_texture;
+};
+
+/* instances sorted by mesh and material, mesh i draws
+ * instances [offsets[i], offsets[i] + counts[i]) */
+export struct render_snapshot {
+    vector<instance_data> instances;
+    vector<size_t> counts;
+    vector<size_t> offsets; /* bytes */
+
+    /* scratch of the extraction, kept so frames do not allocate */
+    vector<uint64_t> keys;
+    vector<uint64_t> sorted;
+    vector<extraction_slice> slices;
+};
+
+/* the group owns all three components, so they are packed together and
+ * read without going through other storages. the group is cut into one
+ * slice per job and extracted in parallel (serially without a scheduler):
+ * - every slice writes a sort key (mesh, then texture, both below 65536)
+ *   and the entity's position in the group into its own range of keys, and
+ *   counts its meshes
+ * - a stable lsd radix sort on the key bytes that are in use, each pass
+ *   histograms the slices in parallel and scatters them to their offsets
+ * - the instances are gathered in sorted order, slice by slice
+ * the result is the same for any number of threads */
+export MULTIVERSION void extract_render_snapshot(entt::registry &reg, render_snapshot &snapshot, size_t mesh_count) {
+    constexpr size_t min_slice = 4096;
+    auto group = reg.group<model_component, mesh_component, material_component>();
+    const size_t n = group.size();
+    jobs::scheduler *scheduler = jobs::current();
+    size_t slice_count = scheduler != nullptr ? scheduler->size() * 4 : 1;
+    slice_count = std::clamp<size_t>(n / min_slice, 1, slice_count);
+    auto &slices = snapshot.slices;
+    slices.resize(slice_count);
+    auto slice_begin = [&] (size_t s) { return n * s / slice_count; };
+    auto each_slice = [&] (auto &&f) {
+        jobs::parallel_for(0, slice_count, [&] (size_t s) { f(slices[s], slice_begin(s), slice_begin(s + 1)); }, 1);
+    };
+    auto entities = group.begin();
+
+    /* mesh index in bits 48-63, texture index + 1 in bits 32-47, the
+     * position in the group below */
+    auto &keys = snapshot.keys;
+    keys.resize(n);
+    each_slice([&] (extraction_slice &slice, size_t begin, size_t end) {
+        slice.counts.assign(mesh_count, 0);
+        slice.max_texture = 0;
+        for (size_t i = begin; i < end; ++i) {
+            auto [mesh, material] = group.get<mesh_component, material_component>(entities[i]);
+            uint32_t texture = uint32_t(material.texture_index + 1);
+            slice.max_texture = std::max(slice.max_texture, texture);
+            slice.counts[mesh.index]++;
+            keys[i] = uint64_t(mesh.index) << 48 | uint64_t(texture) << 32 | i;
+        }
+    });
+
+    snapshot.counts.assign(mesh_count, 0);
+    uint32_t max_texture = 0;
+    for (const extraction_slice &slice : slices) {
+        max_texture = std::max(max_texture, slice.max_texture);
+        for (size_t m = 0; m < mesh_count; ++m)
+            snapshot.counts[m] += slice.counts[m];
+    }
+
+    /* only the bytes the scene uses, usually one of each */
+    array<int, 4> shifts;
+    size_t passes = 0;
+    for (int bit = 0; bit < std::bit_width(max_texture); bit += 8)
+        shifts[passes++] = 32 + bit;
+    for (int bit = 0; bit < std::bit_width(std::max<size_t>(mesh_count, 1) - 1); bit += 8)
+        shifts[passes++] = 48 + bit;
+    auto &sorted = snapshot.sorted;
+    sorted.resize(n);
+    for (int shift : span(shifts).first(passes)) {
+        each_slice([&] (extraction_slice &slice, size_t begin, size_t end) {
+            slice.histogram.fill(0);
+            for (size_t i = begin; i < end; ++i)
+                slice.histogram[keys[i] >> shift & 0xff]++;
+        });
+        /* digit major, slice minor: equal digits keep their order */
+        size_t offset = 0;
+        for (size_t digit = 0; digit < 256; ++digit) {
+            for (extraction_slice &slice : slices) {
+                size_t count = slice.histogram[digit];
+                slice.histogram[digit] = offset;
+                offset += count;
+            }
+        }
+        each_slice([&] (extraction_slice &slice, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+                sorted[slice.histogram[keys[i] >> shift & 0xff]++] = keys[i];
+        });
+        keys.swap(sorted);
+    }
+
+    snapshot.instances.resize(n);
+    each_slice([&] (extraction_slice &, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            auto [model, material] = group.get<model_component, material_component>(entities[keys[i] & 0xffffffff]);
+            snapshot.instances[i] = {
+                .normal_matrix = model.normal_matrix,
+                .model_matrix = model.model_matrix,
+                .color = material.color,
+                .texture_index = material.texture_index
+            };
+        }
+    });
+
+    snapshot.offsets.resize(mesh_count);
+    size_t offset = 0;
+    for (size_t m = 0; m < mesh_count; ++m) {
+        snapshot.offsets[m] = offset * sizeof(instance_data);
+        offset += snapshot.counts[m];
+    }
+}
+
+export struct spatial_stats {
+    size_t entities = 0;
+    size_t nodes = 0;
+    /* added since the last rebuild, tested one by one */
+    size_t pending = 0;
+    size_t rebuilds = 0;
+    size_t refits = 0;
+    float degradation = 1;
+    float update_ms = 0;
+};
+
+/* world boxes of the entities with a model and bounds, in a bvh. the
+ * registry's signals report changes: models have to be changed through
+ * patch / replace (or emplace) to be seen. update() once a frame applies
+ * them:
+ * - moved entities refit the tree, it is rebuilt once refitting made it
+ *   max_degradation times as expensive to query
+ * - new entities are appended and tested one by one until there are enough
+ *   of them (or of destroyed ones) to rebuild */
+export struct spatial_index {
+    float max_degradation = 1.5f;
+
+    entt::registry &reg;
+    bvh tree;
+    /* per slot, slots [0, tree_slots) are the tree's items */
+    vector<aabb> boxes;
+    /* entt::null once destroyed */
+    vector<entt::entity> entities;
+    /* nodes come and go with streamed entities, the pool recycles them */
+    std::pmr::unordered_map<entt::entity, uint32_t> slots{&memory::local_pool<32>()};
+    size_t tree_slots = 0;
+    size_t dead = 0;
+    vector<entt::entity> changed;
+    spatial_stats stats;
+    vector<uint32_t> found;
+    vector<pair<uint32_t, float>> hits;
+
+    explicit spatial_index(entt::registry &reg)
+        : reg(reg) {
+        reg.on_construct<model_component>().connect<&spatial_index::touch>(*this);
+        reg.on_update<model_component>().connect<&spatial_index::touch>(*this);
+        reg.on_construct<bounds_component>().connect<&spatial_index::touch>(*this);
+        reg.on_update<bounds_component>().connect<&spatial_index::touch>(*this);
+        reg.on_destroy<model_component>().connect<&spatial_index::forget>(*this);
+        reg.on_destroy<bounds_component>().connect<&spatial_index::forget>(*this);
+        for (entt::entity e : reg.view<model_component, bounds_component>())
+            changed.push_back(e);
+        apply_changes();
+        rebuild();
+    }
+
+    ~spatial_index() {
+        reg.on_construct<model_component>().disconnect(*this);
+        reg.on_update<model_component>().disconnect(*this);
+        reg.on_construct<bounds_component>().disconnect(*this);
+        reg.on_update<bounds_component>().disconnect(*this);
+        reg.on_destroy<model_component>().disconnect(*this);
+        reg.on_destroy<bounds_component>().disconnect(*this);
+    }
+
+    spatial_index(const spatial_index &) = delete;
+    spatial_index & operator=(const spatial_index &) = delete;
+
+    void touch(entt::registry &, entt::entity e) {
+        changed.push_back(e);
+    }
+
+    void forget(entt::registry &, entt::entity e) {
+        auto it = slots.find(e);
+        if (it == slots.end())
+            return;
+        entities[it->second] = entt::null;
+        slots.erase(it);
+        dead++;
+    }
+
+    void update() {
+        auto start = std::chrono::steady_clock::now();
+        bool moved = apply_changes();
+        size_t pending = boxes.size() - tree_slots;
+        if (pending > std::max<size_t>(256, tree_slots / 4) || dead > std::max<size_t>(256, tree_slots / 4)) {
+            rebuild();
+        } else if (moved) {
+            tree.refit(span(boxes).first(tree_slots));
+            stats.refits++;
+            if (tree.degradation() > max_degradation)
+                rebuild();
+        }
+
+        stats.entities = slots.size();
+        stats.nodes = tree.nodes.size();
+        stats.pending = boxes.size() - tree_slots;
+        stats.degradation = tree.degradation();
+        stats.update_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    /* compacts away destroyed entities and builds a new tree over all */
+    void rebuild() {
+        size_t live = 0;
+        for (size_t slot = 0; slot < boxes.size(); ++slot) {
+            if (entities[slot] == entt::null)
+                continue;
+            boxes[live] = boxes[slot];
+            entities[live] = entities[slot];
+            slots[entities[live]] = uint32_t(live);
+            live++;
+        }
+        boxes.resize(live);
+        entities.resize(live);
+        dead = 0;
+        tree.build(boxes);
+        tree_slots = live;
+        stats.rebuilds++;
+    }
+
+    /* appends the entities whose box is in the frustum */
+    void query(const frustum &f, vector<entt::entity> &result) {
+        found.clear();
+        tree.query(f, found);
+        collect(result);
+        for (size_t slot = tree_slots; slot < boxes.size(); ++slot)
+            if (entities[slot] != entt::null && intersects(f, boxes[slot]))
+                result.push_back(entities[slot]);
+    }
+
+    /* appends the entities whose box is within radius of center */
+    void query(vec3 center, float radius, vector<entt::entity> &result) {
+        found.clear();
+        tree.query(center, radius, found);
+        collect(result);
+        for (size_t slot = tree_slots; slot < boxes.size(); ++slot)
+            if (entities[slot] != entt::null && intersects(center, radius, boxes[slot]))
+                result.push_back(entities[slot]);
+    }
+
+    /* the entity whose box the ray enters first, and where */
+    optional<pair<entt::entity, float>> pick(const ray &r) {
+        optional<pair<entt::entity, float>> nearest;
+        hits.clear();
+        tree.query(r, hits);
+        for (auto [slot, t] : hits) {
+            if (entities[slot] != entt::null) {
+                nearest = {entities[slot], t};
+                break;
+            }
+        }
+        for (size_t slot = tree_slots; slot < boxes.size(); ++slot) {
+            if (entities[slot] == entt::null)
+                continue;
+            optional<float> t = intersect(r, boxes[slot]);
+            if (t && (!nearest || *t < nearest->second))
+                nearest = {entities[slot], *t};
+        }
+        return nearest;
+    }
+
+private:
+    /* true if an entity of the tree moved */
+    bool apply_changes() {
+        bool moved = false;
+        for (entt::entity e : changed) {
+            if (!reg.valid(e))
+                continue;
+            const auto *model = reg.try_get<model_component>(e);
+            const auto *bounds = reg.try_get<bounds_component>(e);
+            if (model == nullptr || bounds == nullptr)
+                continue;
+            aabb box = transform(bounds->local, model->model_matrix);
+            auto [it, added] = slots.try_emplace(e, uint32_t(boxes.size()));
+            if (added) {
+                boxes.push_back(box);
+                entities.push_back(e);
+            } else {
+                boxes[it->second] = box;
+                moved |= it->second < tree_slots;
+            }
+        }
+        changed.clear();
+        return moved;
+    }
+
+    void collect(vector<entt::entity> &result) const {
+        for (uint32_t slot : found)
+            if (entities[slot] != entt::null)
+                result.push_back(entities[slot]);
+    }
+};
@@ -0,0 +1,37 @@
+#version 460 core
+
+/* one level 0 texel of one face per invocation, z = face in gl's order
+ * (+x, -x, +y, -y, +z, -z). the equirectangular source is mapped like the
+ * sphere's texcoords: u = 1 - longitude / 2pi, v = polar angle / pi */
+layout (local_size_x = 8, local_size_y = 8) in;
+
+layout (binding = 0) uniform sampler2D equirectangular;
+layout (binding = 0, rgba8) uniform writeonly imageCube cube;
+
+const float PI = 3.14159265358979;
+
+/* st in [-1, 1], the inverse of gl's cube map face selection */
+vec3 direction(int face, vec2 st) {
+    switch (face) {
+        case 0: return vec3( 1.0, -st.y, -st.x);
+        case 1: return vec3(-1.0, -st.y,  st.x);
+        case 2: return vec3( st.x,  1.0,  st.y);
+        case 3: return vec3( st.x, -1.0, -st.y);
+        case 4: return vec3( st.x, -st.y,  1.0);
+        default: return vec3(-st.x, -st.y, -1.0);
+    }
+}
+
+void main() {
+    ivec3 id = ivec3(gl_GlobalInvocationID);
+    ivec2 size = imageSize(cube);
+    if (any(greaterThanEqual(id.xy, size)))
+        return;
+    vec2 st = (vec2(id.xy) + 0.5) / vec2(size) * 2.0 - 1.0;
+    vec3 d = normalize(direction(id.z, st));
+    float longitude = atan(d.z, d.x);
+    if (longitude < 0.0)
+        longitude += 2.0 * PI;
+    vec2 uv = vec2(1.0 - longitude / (2.0 * PI), acos(clamp(d.y, -1.0, 1.0)) / PI);
+    imageStore(cube, id, textureLod(equirectangular, uv, 0.0));
+}
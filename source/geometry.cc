@@ -1,12 +1,17 @@
+module;
+#include "multiversion.h"
+
 export module geometry;
 
 import std;
 import glm;
+import jobs;
 
 using std::array;
 using std::vector;
 using std::convertible_to;
 using std::numeric_limits;
+using std::size_t;
 using namespace glm;
 
 export struct cube {
@@ -16,7 +21,7 @@ export struct cube {
     vector<vec2> texcoords;
 };
 
-cube create_cube(array<unsigned int, 6> index_order, float normal_sign) {
+MULTIVERSION cube create_cube(array<unsigned int, 6> index_order, float normal_sign) {
     cube c = {};
     c.positions.reserve(24);
     c.normals.reserve(24);
@@ -53,26 +58,28 @@ export cube create_cube_cw() {
     return create_cube({0, 3, 2, 0, 2, 1}, -1.f);
 }
 
-template<typename F>
+export template<typename F>
 concept can_make_surface = requires(F f, float u, float v) {
     { f(u, v) } -> convertible_to<vec3>;
 };
 
+/* rows of the grid are generated in parallel when a job scheduler is active */
+
 export vector<vec3> generate_surface(int W, int H, can_make_surface auto f) {
-    vector<vec3> vertices;
-    for (int i = 0; i < W; ++i) {
+    vector<vec3> vertices(W * H);
+    jobs::parallel_for(0, W, [&] (size_t i) {
         float u = float(i) / (W - 1);
         for (int j = 0; j < H; ++j) {
             float v = float(j) / (H - 1);
-            vertices.push_back(f(u, v));
+            vertices[i * H + j] = f(u, v);
         }
-    }
+    });
     return vertices;
 }
 
 export vector<vec3> generate_normals(int W, int H, can_make_surface auto f) {
-    vector<vec3> normals;
-    for (int i = 0; i < W; ++i) {
+    vector<vec3> normals(W * H);
+    jobs::parallel_for(0, W, [&] (size_t i) {
         float u = float(i) / (W - 1);
         for (int j = 0; j < H; ++j) {
             float v = float(j) / (H - 1);
@@ -91,43 +98,65 @@ export vector<vec3> generate_normals(int W, int H, can_make_surface auto f) {
                 n = normalize(n);
             }
 
-            normals.push_back(n);
+            normals[i * H + j] = n;
         }
-    }
+    });
     return normals;
 }
 
+/* two triangles per cell of grid row i */
+MULTIVERSION void grid_indices_row(unsigned int *out, size_t i, int W) {
+    for (int j = 0; j < W - 1; ++j) {
+        int LT = i * W + j;
+        int RT = LT + 1;
+        int LB = LT + W;
+        int RB = LB + 1;
+
+        *out++ = LT;
+        *out++ = LB;
+        *out++ = RT;
+
+        *out++ = RT;
+        *out++ = LB;
+        *out++ = RB;
+    }
+}
+
 export vector<unsigned int> generate_grid_indices(int W, int H) {
+    vector<unsigned int> indices(size_t(max(H - 1, 0)) * max(W - 1, 0) * 6);
+    jobs::parallel_for(0, max(H - 1, 0), [&] (size_t i) {
+        grid_indices_row(indices.data() + i * (W - 1) * 6, i, W);
+    });
+    return indices;
+}
+
+/* one quad patch per grid cell, control points ordered
+ * (u0, v0), (u1, v0), (u1, v1), (u0, v1) to match generate_surface's layout */
+export vector<unsigned int> generate_patch_indices(int W, int H) {
     vector<unsigned int> indices;
-    for (int i = 0; i < H - 1; ++i) {
-        for (int j = 0; j < W - 1; ++j) {
-            int LT = i * W + j;
-            int RT = LT + 1;
-            int LB = LT + W;
-            int RB = LB + 1;
-
-            indices.push_back(LT);
-            indices.push_back(LB);
-            indices.push_back(RT);
-
-            indices.push_back(RT);
-            indices.push_back(LB);
-            indices.push_back(RB);
+    indices.reserve(size_t(max(W - 1, 0)) * max(H - 1, 0) * 4);
+    for (int i = 0; i < W - 1; ++i) {
+        for (int j = 0; j < H - 1; ++j) {
+            unsigned int p00 = i * H + j;
+            unsigned int p10 = p00 + H;
+            indices.push_back(p00);
+            indices.push_back(p10);
+            indices.push_back(p10 + 1);
+            indices.push_back(p00 + 1);
         }
     }
     return indices;
 }
 
 export vector<vec2> generate_texcoords(int W, int H) {
-    vector<vec2> texcoords;
-    texcoords.reserve(W * H);
-    for (int i = 0; i < W; ++i) {
+    vector<vec2> texcoords(W * H);
+    jobs::parallel_for(0, W, [&] (size_t i) {
         float u = float(W - i - 1) / (W - 1);
         for (int j = 0; j < H; ++j) {
             float v = float(j) / (H - 1);
-            texcoords.push_back(vec2(u, v));
+            texcoords[i * H + j] = vec2(u, v);
         }
-    }
+    });
     return texcoords;
 }
 
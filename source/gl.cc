@@ -1,7 +1,7 @@
 module;
 #include <cassert>
-#define GL_GLEXT_PROTOTYPES
-#include <GL/glcorearb.h>
+#define GL_API_IMPLEMENTATION
+#include "gl_api.h"
 
 export module gl;
 
@@ -30,18 +30,9 @@ using std::flat_map;
 using namespace glm;
 
 /* === opengl function loader === */
-/* TODO load all functions */
-#define FOR_EACH_FUNCTION(X) \
-    X(PFNGLGETTEXTUREHANDLEARBPROC, glGetTextureHandleARB); \
-    X(PFNGLMAKETEXTUREHANDLERESIDENTARBPROC, glMakeTextureHandleResidentARB); \
-    X(PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC, glMakeTextureHandleNonResidentARB); \
-    X(PFNGLSPECIALIZESHADERPROC, glSpecializeShader);
-
+/* every entry point of glcorearb.h (core 4.6 + arb / ext / khr), see gl_api.h.
+ * extensions the driver lacks stay nullptr */
 export namespace gl {
-    #define X(T, name) T name;
-    FOR_EACH_FUNCTION(X);
-    #undef X
-
     template<typename F>
     concept GLFunctionLoader = requires(F f, const char * name) {
         { f(name) } -> convertible_to<void (*) ()>;
@@ -49,14 +40,24 @@ export namespace gl {
 
     template<typename T> requires GLFunctionLoader<T>
     void load(T get_proc_address) {
+        size_t loaded = 0, missing = 0;
         #define X(T, name) \
-            name = reinterpret_cast<T>(get_proc_address(#name));
-        FOR_EACH_FUNCTION(X);
+            gl_fn_##name = reinterpret_cast<T>(get_proc_address(#name)); \
+            (gl_fn_##name != nullptr ? loaded : missing)++;
+        FOR_EACH_GL_FUNCTION(X);
         #undef X
+        logger::info("gl: {} entry points loaded, {} not available", loaded, missing);
     }
-};
 
-#undef FOR_EACH_FUNCTION
+    /* build profile: GEOMETRY_GL_DEBUG (xmake option gl-debug) keeps the
+     * debug context, debug output and object logging, without it none of
+     * them is compiled in */
+#ifdef GEOMETRY_GL_DEBUG
+    constexpr bool debug_output = true;
+#else
+    constexpr bool debug_output = false;
+#endif
+};
 /* === */
 
 #define FOR_EACH_CREATE(X) \
@@ -114,6 +115,7 @@ export namespace gl
             : runtime_error(string(message)) {}
     };
 
+#ifdef GEOMETRY_GL_DEBUG
     void debug_message_handler(
         GLenum source,
         GLenum type,
@@ -144,6 +146,9 @@ export namespace gl
     void set_default_debug_message_handler() {
         glDebugMessageCallback(debug_message_handler, nullptr);
     }
+#else
+    void set_default_debug_message_handler() {}
+#endif
 
     template<auto constructor, auto destructor>
     struct object
@@ -178,21 +183,31 @@ export namespace gl
         }
     };
 
+    /* glCreateShader & co. are function pointers, template arguments need functions */
+    GLuint create_shader(GLenum type) { return glCreateShader(type); }
+    void delete_shader(GLuint name) { glDeleteShader(name); }
+    GLuint create_program() { return glCreateProgram(); }
+    void delete_program(GLuint name) { glDeleteProgram(name); }
+
     #define object_t(T) object<glCreate##T, glDelete##T>
     using buffer_t = object_t(Buffer);
     using vertex_array_t = object_t(VertexArray);
     using texture_t = object_t(Texture);
     using framebuffer_t = object_t(Framebuffer);
-    using shader_t = object_t(Shader);
-    using program_t = object_t(Program);
+    using shader_t = object<create_shader, delete_shader>;
+    using program_t = object<create_program, delete_program>;
     #undef object_t
 
+#ifdef GEOMETRY_GL_DEBUG
     #define DEBUG_CAPABILITIES(T) using T##_t::object; \
         T() : T##_t() { logger::debug(#T "({}) new", name);}\
         T(GLuint name) : T##_t(name) {logger::debug(#T "({})", name);}\
         ~T() {logger::debug(#T "({}) delete", name);}\
         T(T&&) noexcept = default;\
         T& operator=(T&&) noexcept = default;
+#else
+    #define DEBUG_CAPABILITIES(T) using T##_t::object;
+#endif
 
     constexpr GLbitfield DEFAULT_BUFFER_ALLOC_FLAGS = \
         GL_MAP_PERSISTENT_BIT                    \
@@ -226,6 +241,12 @@ export namespace gl
         void store(T * data, size_t size, GLbitfield flags = DEFAULT_BUFFER_STORAGE_FLAGS) {
             glNamedBufferStorage(name, size, data, flags);
         }
+
+        /* requires GL_DYNAMIC_STORAGE_BIT */
+        template<typename T, size_t Extent>
+        void update(span<T, Extent> data, GLintptr offset = 0) {
+            glNamedBufferSubData(name, offset, data.size_bytes(), data.data());
+        }
     };
 
     /* these functions always create new buffer */
@@ -304,6 +325,12 @@ export namespace gl
         void bind_attribute(GLuint attribute_index, GLuint binding_index) {
             glVertexArrayAttribBinding(name, attribute_index, binding_index);
         }
+
+        /* vertex arrays without attributes draw generated vertices (gl_VertexID) */
+        void draw_arrays(DrawMode mode, GLint first, GLsizei count) {
+            glBindVertexArray(name);
+            glDrawArrays(to_underlying(mode), first, count);
+        }
     };
     /* --- */
 
@@ -359,10 +386,203 @@ export namespace gl
         glGenerateTextureMipmap(t.name);
         return t;
     }
+
+    /* render target sampled with linear filtering, also usable as image */
+    texture make_render_texture(GLenum internalformat, ivec2 size, GLsizei levels = 1) {
+        texture t(GL_TEXTURE_2D);
+        glTextureStorage2D(t.name, levels, internalformat, size.x, size.y);
+        glTextureParameteri(t.name, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTextureParameteri(t.name, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTextureParameteri(t.name, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTextureParameteri(t.name, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        return t;
+    }
+
+    /* color cubemap of levels mips, seamless filtering needs
+     * GL_TEXTURE_CUBE_MAP_SEAMLESS */
+    texture make_cube_texture(GLenum internalformat, GLsizei size, GLsizei levels = 1) {
+        texture t(GL_TEXTURE_CUBE_MAP);
+        glTextureStorage2D(t.name, levels, internalformat, size, size);
+        glTextureParameteri(t.name, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTextureParameteri(t.name, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTextureParameteri(t.name, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTextureParameteri(t.name, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        return t;
+    }
+
+    ivec2 texture_size(texture &t, GLint level = 0) {
+        ivec2 size;
+        glGetTextureLevelParameteriv(t.name, level, GL_TEXTURE_WIDTH, &size.x);
+        glGetTextureLevelParameteriv(t.name, level, GL_TEXTURE_HEIGHT, &size.y);
+        return size;
+    }
+
+    /* fills every level below 0 from the one above it */
+    void generate_mipmap(texture &t) {
+        glGenerateTextureMipmap(t.name);
+    }
+
+    /* layers of a GL_TEXTURE_CUBE_MAP_ARRAY are faces (6 per cube),
+     * sampled with depth comparison (sampler*Shadow) */
+    texture make_depth_texture(GLenum target, GLsizei size, GLsizei layers) {
+        texture t(target);
+        glTextureStorage3D(t.name, 1, GL_DEPTH_COMPONENT32F, size, size, layers);
+        glTextureParameteri(t.name, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTextureParameteri(t.name, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTextureParameteri(t.name, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTextureParameteri(t.name, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTextureParameteri(t.name, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTextureParameteri(t.name, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        return t;
+    }
+
+    /* copies one layer (or cube face) of level 0 between textures of the same format */
+    void copy_texture_layer(texture &src, texture &dst, GLenum target, GLsizei size, GLint layer) {
+        glCopyImageSubData(
+            src.name, target, 0, 0, 0, layer,
+            dst.name, target, 0, 0, 0, layer,
+            size, size, 1
+        );
+    }
     /* --- */
 
     /* --- framebuffer --- */
-    struct framebuffer: framebuffer_t {};
+    struct framebuffer: framebuffer_t {
+        /* depth only rendering into one layer of an array / cube array texture */
+        void attach_depth_layer(texture &t, GLint layer, GLint level = 0) {
+            glNamedFramebufferTextureLayer(name, GL_DEPTH_ATTACHMENT, t.name, level, layer);
+            glNamedFramebufferDrawBuffer(name, GL_NONE);
+            glNamedFramebufferReadBuffer(name, GL_NONE);
+        }
+
+        void attach_color(texture &t, GLint level = 0) {
+            glNamedFramebufferTexture(name, GL_COLOR_ATTACHMENT0, t.name, level);
+            glNamedFramebufferDrawBuffer(name, GL_COLOR_ATTACHMENT0);
+        }
+
+        void attach_depth(texture &t, GLint level = 0) {
+            glNamedFramebufferTexture(name, GL_DEPTH_ATTACHMENT, t.name, level);
+        }
+
+        void clear_color(vec4 color) {
+            glClearNamedFramebufferfv(name, GL_COLOR, 0, value_ptr(color));
+        }
+
+        void clear_depth(float depth = 1.f) {
+            glClearNamedFramebufferfv(name, GL_DEPTH, 0, &depth);
+        }
+
+        void bind() {
+            glBindFramebuffer(GL_FRAMEBUFFER, name);
+        }
+    };
+
+    void bind_default_framebuffer() {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+    /* --- */
+
+    /* --- fence --- */
+    struct fence {
+        GLsync sync = nullptr;
+
+        fence() = default;
+
+        fence(const fence &) = delete;
+        fence(fence &&other) : sync(other.sync) {
+            other.sync = nullptr;
+        }
+
+        fence & operator=(const fence &) = delete;
+        fence & operator=(fence &&other) {
+            if (sync != other.sync) {
+                if (sync != nullptr)
+                    glDeleteSync(sync);
+                sync = other.sync;
+                other.sync = nullptr;
+            }
+            return * this;
+        }
+
+        ~fence() {
+            if (sync != nullptr)
+                glDeleteSync(sync);
+        }
+
+        /* signaled once every command issued before it has completed */
+        void insert() {
+            if (sync != nullptr)
+                glDeleteSync(sync);
+            sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+
+        /* glClientWaitSync's result: GL_ALREADY_SIGNALED (also when never
+         * inserted), GL_CONDITION_SATISFIED, GL_TIMEOUT_EXPIRED or
+         * GL_WAIT_FAILED (lost context, invalid sync) */
+        GLenum wait(GLuint64 timeout_ns) {
+            if (sync == nullptr)
+                return GL_ALREADY_SIGNALED;
+            return glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, timeout_ns);
+        }
+
+        bool is_signaled() {
+            if (sync == nullptr)
+                return true;
+            GLint status;
+            glGetSynciv(sync, GL_SYNC_STATUS, 1, nullptr, &status);
+            return status == GL_SIGNALED;
+        }
+    };
+    /* --- */
+
+    /* --- timestamp query --- */
+    /* gpu time at the point the command stream reaches record(), read back
+     * a few frames later so that the cpu never waits for it */
+    struct timestamp_query {
+        GLuint name = 0;
+        bool recorded = false;
+
+        timestamp_query() {
+            glCreateQueries(GL_TIMESTAMP, 1, &name);
+        }
+
+        timestamp_query(const timestamp_query &) = delete;
+        timestamp_query(timestamp_query &&other)
+            : name(std::exchange(other.name, 0))
+            , recorded(std::exchange(other.recorded, false)) {}
+
+        timestamp_query & operator=(const timestamp_query &) = delete;
+        timestamp_query & operator=(timestamp_query &&other) {
+            std::swap(name, other.name);
+            std::swap(recorded, other.recorded);
+            return *this;
+        }
+
+        ~timestamp_query() {
+            if (name != 0)
+                glDeleteQueries(1, &name);
+        }
+
+        void record() {
+            glQueryCounter(name, GL_TIMESTAMP);
+            recorded = true;
+        }
+
+        bool available() const {
+            if (!recorded)
+                return false;
+            GLint result;
+            glGetQueryObjectiv(name, GL_QUERY_RESULT_AVAILABLE, &result);
+            return result == GL_TRUE;
+        }
+
+        /* nanoseconds, only valid when available() */
+        GLuint64 value() const {
+            GLuint64 result;
+            glGetQueryObjectui64v(name, GL_QUERY_RESULT, &result);
+            return result;
+        }
+    };
     /* --- */
 
     /* --- shader --- */
@@ -392,6 +612,13 @@ export namespace gl
                 glSpecializeShader(name, entry_point.data(), 0, nullptr, nullptr);
             }
         }
+
+        /* also false when specialization of a spir-v binary failed */
+        bool compiled() const {
+            GLint status;
+            glGetShaderiv(name, GL_COMPILE_STATUS, &status);
+            return status == GL_TRUE;
+        }
     };
     /* --- */
 
@@ -402,6 +629,12 @@ export namespace gl
         }
 
         void link() {
+            [[maybe_unused]] bool linked = try_link();
+            assert(linked);
+        }
+
+        /* logs and returns false instead of asserting, for programs rebuilt at runtime */
+        bool try_link() {
             glLinkProgram(name);
             GLint status;
             glGetProgramiv(name, GL_LINK_STATUS, &status);
@@ -411,8 +644,8 @@ export namespace gl
                 string log = string(length, '\0');
                 glGetProgramInfoLog(name, length, nullptr, log.data());
                 logger::error("program(3) link {}", log);
-                assert(status == GL_TRUE);
             }
+            return status == GL_TRUE;
         }
 
         void use() {
@@ -493,22 +726,61 @@ export namespace gl
                 instance_count
             );
         }
+
+        /* instances start at base_instance (gl_BaseInstance) */
+        void draw(DrawMode mode, GLsizei instance_count, GLuint base_instance) {
+            glBindVertexArray(va.name);
+            glDrawElementsInstancedBaseInstance(
+                to_underlying(mode),
+                count,
+                type,
+                reinterpret_cast<const void *>(offset),
+                instance_count,
+                base_instance
+            );
+        }
+
+        /* commands come from the bound draw indirect buffer, their count from
+         * the bound parameter buffer at drawcount_offset */
+        void draw_indirect_count(DrawMode mode, GLintptr indirect_offset, GLintptr drawcount_offset, GLsizei max_draw_count) {
+            glBindVertexArray(va.name);
+            glMultiDrawElementsIndirectCount(
+                to_underlying(mode),
+                type,
+                reinterpret_cast<const void *>(indirect_offset),
+                drawcount_offset,
+                max_draw_count,
+                0
+            );
+        }
+
+        /* a float attribute past make_mesh's, in its own buffer at binding
+         * index = attribute index. values are only read */
+        template<typename Vertex>
+        void add_attribute(GLuint index, span<const Vertex> values) {
+            buffer &b = buffers.emplace_back();
+            b.store(values);
+            va.enable_attribute(index);
+            va.format_attribute(index, sizeof(Vertex) / sizeof(float), GL_FLOAT, GL_FALSE, 0);
+            va.bind_vertex_buffer<Vertex>(index, b);
+            va.bind_attribute(index, index);
+        }
     };
 
-    // TODO accept any type of vectors for attributes
+    /* the arrays are only read into the new buffers, callers keep them */
     template<is_element_type_v ElementType>
     mesh make_mesh(
-        vector<ElementType> elements,
-        vector<vector<vec3>> vertices
+        span<const ElementType> elements,
+        span<const span<const vec3>> vertices
     ) {
         mesh m;
-        m.element_buffer.store(span(elements));
+        m.element_buffer.store(elements);
         m.va.bind_element_buffer(m.element_buffer);
 
         m.buffers.reserve(vertices.size());
         for (size_t i = 0; i < vertices.size(); ++i) {
             buffer& vb = m.buffers.emplace_back();
-            vb.store(span(vertices[i]));
+            vb.store(vertices[i]);
             m.va.enable_attribute(i);
             m.va.format_attribute(i, 3, GL_FLOAT, GL_FALSE, 0);
             m.va.bind_vertex_buffer<vec3>(i, vb);
@@ -523,22 +795,22 @@ export namespace gl
 
     template<is_element_type_v ElementType>
     mesh make_mesh(
-        vector<ElementType> elements,
-        vector<vec3> positions,
-        vector<vec3> normals,
-        vector<vec2> texcoords
+        span<const ElementType> elements,
+        span<const vec3> positions,
+        span<const vec3> normals,
+        span<const vec2> texcoords
     ) {
         mesh m;
-        m.element_buffer.store(span(elements));
+        m.element_buffer.store(elements);
         m.va.bind_element_buffer(m.element_buffer);
 
         m.buffers.reserve(3);
         buffer &pb = m.buffers.emplace_back();
-        pb.store(span(positions));
+        pb.store(positions);
         buffer &nb = m.buffers.emplace_back();
-        nb.store(span(normals));
+        nb.store(normals);
         buffer &tb = m.buffers.emplace_back();
-        tb.store(span(texcoords));
+        tb.store(texcoords);
 
         m.va.enable_attribute(0);
         m.va.format_attribute(0, 3, GL_FLOAT, GL_FALSE, 0);
@@ -567,6 +839,30 @@ export namespace gl
         glEnable(capability);
     }
 
+    void disable(GLenum capability) {
+        glDisable(capability);
+    }
+
+    void viewport(ivec2 size) {
+        glViewport(0, 0, size.x, size.y);
+    }
+
+    void cull_face(GLenum face) {
+        glCullFace(face);
+    }
+
+    void depth_func(GLenum func) {
+        glDepthFunc(func);
+    }
+
+    void polygon_offset(float factor, float units) {
+        glPolygonOffset(factor, units);
+    }
+
+    void patch_vertices(GLint count) {
+        glPatchParameteri(GL_PATCH_VERTICES, count);
+    }
+
     void clear(GLenum mode) {
         glClear(mode);
     }
@@ -587,6 +883,40 @@ export namespace gl
         glBindBufferRange(GL_SHADER_STORAGE_BUFFER, index, b.name, offset, size);
     }
 
+    void bind_draw_indirect_buffer(buffer &b) {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, b.name);
+    }
+
+    void bind_parameter_buffer(buffer &b) {
+        glBindBuffer(GL_PARAMETER_BUFFER, b.name);
+    }
+
+    /* fills the buffer with zero uints */
+    void clear_buffer(buffer &b) {
+        glClearNamedBufferData(b.name, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    }
+
+    void bind_image_texture(GLuint unit, texture &t, GLint level, GLenum access, GLenum format) {
+        glBindImageTexture(unit, t.name, level, GL_FALSE, 0, access, format);
+    }
+
+    /* every layer (cube face) of the level, image2DArray / imageCube */
+    void bind_image_texture_layered(GLuint unit, texture &t, GLint level, GLenum access, GLenum format) {
+        glBindImageTexture(unit, t.name, level, GL_TRUE, 0, access, format);
+    }
+
+    void dispatch_compute(GLuint x, GLuint y = 1, GLuint z = 1) {
+        glDispatchCompute(x, y, z);
+    }
+
+    void memory_barrier(GLbitfield barriers) {
+        glMemoryBarrier(barriers);
+    }
+
+    void bind_texture_unit(GLuint unit, texture &t) {
+        glBindTextureUnit(unit, t.name);
+    }
+
     void bind_texture_units(GLuint index, span<texture> textures) {
         static_assert(sizeof(texture) == sizeof(GLuint));
         glBindTextures(index, textures.size(), reinterpret_cast<GLuint *>(textures.data()));
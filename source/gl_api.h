@@ -0,0 +1,22 @@
+#pragma once
+/*
+ * gl entry points as direct function pointers, filled by gl::load.
+ * include this instead of <GL/glcorearb.h> + GL_GLEXT_PROTOTYPES: calls go
+ * straight to the driver instead of through libGL's dispatch, and nothing
+ * links against libGL.
+ *
+ * gl_functions.h is generated from glcorearb.h by the gl-loader rule in
+ * xmake.lua: the FOR_EACH_GL_FUNCTION(X) list of (pointer type, name) and
+ * a #define glName gl_fn_glName for every entry point.
+ * the pointers are defined where GL_API_IMPLEMENTATION is set (gl.cc).
+ */
+#include <GL/glcorearb.h>
+#include "gl_functions.h"
+
+#ifdef GL_API_IMPLEMENTATION
+#define X(T, name) T gl_fn_##name = nullptr;
+#else
+#define X(T, name) extern T gl_fn_##name;
+#endif
+FOR_EACH_GL_FUNCTION(X)
+#undef X
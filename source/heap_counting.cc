@@ -0,0 +1,43 @@
+/*
+ * every heap allocation of the program goes through these and is counted
+ * in memory::heap (the viewer's allocation overlay, the bench's
+ * self-checks), new[] and the nothrow forms call them. linked into main and
+ * bench, not core: a replacement in a static library may not be picked up
+ */
+import std;
+import memory;
+
+using std::size_t;
+
+void *operator new(size_t size) {
+    memory::count_allocation(size);
+    if (void *p = std::malloc(size != 0 ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new(size_t size, std::align_val_t alignment) {
+    memory::count_allocation(size);
+    size_t a = size_t(alignment);
+    if (void *p = std::aligned_alloc(a, (std::max<size_t>(size, 1) + a - 1) / a * a))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    if (p != nullptr)
+        memory::count_free();
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    operator delete(p);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept {
+    operator delete(p);
+}
+
+void operator delete(void *p, size_t, std::align_val_t) noexcept {
+    operator delete(p);
+}
@@ -0,0 +1,28 @@
+#version 460 core
+
+/* one level of the hi-z pyramid: the farthest depth of the source texels
+ * under each destination texel. level 0 copies the depth buffer, every
+ * further level halves the one before it, where odd sizes make a texel cover
+ * up to three source texels per axis so that none is skipped */
+layout (local_size_x = 8, local_size_y = 8) in;
+
+layout (binding = 0) uniform sampler2D source;
+layout (binding = 0, r32f) uniform writeonly image2D destination;
+
+layout (location = 0) uniform int source_level;
+
+void main() {
+    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 size = imageSize(destination);
+    if (any(greaterThanEqual(texel, size)))
+        return;
+
+    ivec2 source_size = textureSize(source, source_level);
+    ivec2 first = texel * source_size / size;
+    ivec2 last = min(((texel + 1) * source_size + size - 1) / size, source_size) - 1;
+    float depth = 0.0;
+    for (int y = first.y; y <= last.y; ++y)
+        for (int x = first.x; x <= last.x; ++x)
+            depth = max(depth, texelFetch(source, ivec2(x, y), source_level).r);
+    imageStore(destination, texel, vec4(depth));
+}
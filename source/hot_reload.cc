@@ -0,0 +1,152 @@
+module;
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+export module hot_reload;
+
+import std;
+
+using std::function;
+using std::jthread;
+using std::lock_guard;
+using std::map;
+using std::mutex;
+using std::optional;
+using std::runtime_error;
+using std::set;
+using std::size_t;
+using std::span;
+using std::stop_token;
+using std::string;
+using std::string_view;
+using std::uint8_t;
+using std::vector;
+using std::filesystem::path;
+
+/*
+ * asset hot reload:
+ * - watcher: inotify on a set of directories, a burst of events is collapsed
+ *   (the handler runs once the directory was quiet for settle_time) and the
+ *   handler gets every changed file once, on the watcher thread
+ * - the handler does the slow part (compiling, decoding) and pushes the
+ *   result into a pending_queue
+ * - the gl thread takes the queue at a frame boundary and swaps the new
+ *   objects in, a failed compile or link keeps the running version
+ */
+
+export namespace hot_reload {
+    struct error: runtime_error {
+        error(string_view message)
+            : runtime_error(string(message)) {}
+    };
+
+    /* compiler used for shaders changed at runtime, same flags as the
+     * utils.glsl2spv build rule */
+    constexpr string_view glslang_validator = "glslangValidator";
+
+    template<typename T>
+    struct pending_queue {
+        mutex items_mutex;
+        vector<T> items;
+
+        void push(T item) {
+            lock_guard lock(items_mutex);
+            items.push_back(std::move(item));
+        }
+
+        vector<T> take() {
+            lock_guard lock(items_mutex);
+            return std::exchange(items, {});
+        }
+    };
+
+    struct watcher {
+        static constexpr int settle_time_ms = 50;
+        static constexpr int idle_poll_ms = 100;
+
+        int fd = -1;
+        map<int, path> directories;
+        function<void(const path &)> on_change;
+        jthread thread;
+
+        watcher(span<const path> watched, function<void(const path &)> handler)
+            : on_change(std::move(handler)) {
+            fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (fd < 0)
+                throw hot_reload::error("inotify_init1 failed");
+            for (const path &directory : watched) {
+                int wd = ::inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+                if (wd < 0) {
+                    ::close(fd);
+                    throw hot_reload::error(std::format("could not watch {}", directory.string()));
+                }
+                directories.emplace(wd, directory);
+            }
+            thread = jthread([this] (stop_token token) { run(token); });
+        }
+
+        ~watcher() {
+            if (thread.joinable()) {
+                thread.request_stop();
+                thread.join();
+            }
+            ::close(fd);
+        }
+
+        watcher(const watcher &) = delete;
+        watcher & operator=(const watcher &) = delete;
+
+        void run(stop_token token) {
+            alignas(inotify_event) char buffer[4096];
+            set<path> changed;
+            while (!token.stop_requested()) {
+                pollfd p = {fd, POLLIN, 0};
+                int ready = ::poll(&p, 1, changed.empty() ? idle_poll_ms : settle_time_ms);
+                if (ready > 0) {
+                    ssize_t n;
+                    while ((n = ::read(fd, buffer, sizeof(buffer))) > 0) {
+                        for (char *at = buffer; at < buffer + n;) {
+                            auto *event = reinterpret_cast<inotify_event *>(at);
+                            auto directory = directories.find(event->wd);
+                            if (event->len > 0 && directory != directories.end())
+                                changed.insert(directory->second / event->name);
+                            at += sizeof(inotify_event) + event->len;
+                        }
+                    }
+                    continue;
+                }
+                /* quiet for settle_time, editors are done writing */
+                for (const path &file : changed)
+                    on_change(file);
+                changed.clear();
+            }
+        }
+    };
+
+    /* compiles a glsl source named like main.vert.glsl to opengl spir-v,
+     * nothing if it does not compile (the compiler prints why) */
+    optional<vector<uint8_t>> compile_glsl(const path &source) {
+        string stage = source.stem().extension().string();
+        if (stage.size() < 2)
+            return std::nullopt;
+        stage.erase(0, 1);
+
+        path output = std::filesystem::temp_directory_path()
+            / std::format("{}.{}.spv", source.filename().string(), ::getpid());
+        string command = std::format(
+            "{} --target-env opengl --client opengl100 -S {} -o '{}' '{}'",
+            glslang_validator, stage, output.string(), source.string()
+        );
+        if (std::system(command.c_str()) != 0)
+            return std::nullopt;
+
+        std::ifstream in(output, std::ios::binary);
+        vector<uint8_t> spirv(std::istreambuf_iterator<char>(in), {});
+        in.close();
+        std::filesystem::remove(output);
+        if (spirv.empty())
+            return std::nullopt;
+        return spirv;
+    }
+}
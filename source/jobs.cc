@@ -0,0 +1,356 @@
+export module jobs;
+
+import std;
+
+using std::array;
+using std::atomic;
+using std::atomic_thread_fence;
+using std::deque;
+using std::exception_ptr;
+using std::function;
+using std::int64_t;
+using std::jthread;
+using std::max;
+using std::size_t;
+using std::stop_token;
+using std::uint32_t;
+using std::unique_ptr;
+using std::vector;
+using std::memory_order_acq_rel;
+using std::memory_order_acquire;
+using std::memory_order_relaxed;
+using std::memory_order_release;
+using std::memory_order_seq_cst;
+
+/*
+ * fork-join job system:
+ * - every thread of the scheduler (the thread that created it is worker 0)
+ *   owns a work-stealing deque, idle workers steal from the others
+ * - parallel_for jobs are not allocated, they live in the stack frame of
+ *   whoever spawned them, which always waits for them before returning.
+ *   task_group::run allocates its job (a std::function in a deque entry)
+ * - waiting never blocks a worker: wait() keeps executing other jobs until
+ *   the counter drops to zero, so jobs can spawn and wait for child jobs
+ * - an exception thrown by a job is caught on the thread that ran it and
+ *   rethrown by wait() once every job of the scope has finished, the first
+ *   one wins
+ * - only worker 0 (the thread owning the gl context) may issue gl calls,
+ *   jobs produce cpu data and the main thread uploads it after wait()
+ */
+
+export namespace jobs {
+    /* the jobs of one fork-join scope still running, and the first exception
+     * one of them threw */
+    struct join_counter {
+        atomic<int> pending = 0;
+        atomic<bool> failed = false;
+        exception_ptr error;
+
+        void fail(exception_ptr e) {
+            if (!failed.exchange(true, memory_order_acq_rel))
+                error = std::move(e);
+        }
+
+        /* after pending reached zero */
+        void rethrow() {
+            if (!failed.load(memory_order_acquire))
+                return;
+            failed.store(false, memory_order_relaxed);
+            std::rethrow_exception(std::exchange(error, nullptr));
+        }
+    };
+
+    struct job {
+        void (*invoke)(void *context);
+        void *context;
+        join_counter *join;
+    };
+
+    /* Chase-Lev deque: push/pop by the owner at the bottom, steal at the top */
+    struct work_deque {
+        static constexpr size_t capacity = 1 << 12;
+        static constexpr size_t mask = capacity - 1;
+
+        alignas(64) atomic<int64_t> top = 0;
+        alignas(64) atomic<int64_t> bottom = 0;
+        array<atomic<job *>, capacity> slots = {};
+
+        bool push(job *j) {
+            int64_t b = bottom.load(memory_order_relaxed);
+            int64_t t = top.load(memory_order_acquire);
+            if (b - t >= int64_t(capacity))
+                return false;
+            slots[b & mask].store(j, memory_order_relaxed);
+            atomic_thread_fence(memory_order_release);
+            bottom.store(b + 1, memory_order_relaxed);
+            return true;
+        }
+
+        job *pop() {
+            int64_t b = bottom.load(memory_order_relaxed) - 1;
+            bottom.store(b, memory_order_relaxed);
+            atomic_thread_fence(memory_order_seq_cst);
+            int64_t t = top.load(memory_order_relaxed);
+            if (t > b) {
+                bottom.store(b + 1, memory_order_relaxed);
+                return nullptr;
+            }
+            job *j = slots[b & mask].load(memory_order_relaxed);
+            if (t == b) {
+                /* last job, race against thieves */
+                if (!top.compare_exchange_strong(t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+                    j = nullptr;
+                bottom.store(b + 1, memory_order_relaxed);
+            }
+            return j;
+        }
+
+        job *steal() {
+            int64_t t = top.load(memory_order_acquire);
+            atomic_thread_fence(memory_order_seq_cst);
+            int64_t b = bottom.load(memory_order_acquire);
+            if (t >= b)
+                return nullptr;
+            job *j = slots[t & mask].load(memory_order_relaxed);
+            if (!top.compare_exchange_strong(t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+                return nullptr;
+            return j;
+        }
+    };
+
+    struct scheduler;
+
+    /* the scheduler parallel algorithms use, nullptr = run serially */
+    atomic<scheduler *> active = nullptr;
+    thread_local int worker_index = -1;
+
+    struct scheduler {
+        vector<unique_ptr<work_deque>> deques;
+        vector<jthread> threads;
+        atomic<uint32_t> work_epoch = 0;
+        atomic<bool> stopping = false;
+
+        explicit scheduler(unsigned thread_count = std::thread::hardware_concurrency()) {
+            thread_count = max(thread_count, 1u);
+            for (unsigned i = 0; i < thread_count; ++i)
+                deques.push_back(std::make_unique<work_deque>());
+
+            worker_index = 0;
+            scheduler *expected = nullptr;
+            active.compare_exchange_strong(expected, this, memory_order_release);
+
+            for (unsigned i = 1; i < thread_count; ++i)
+                threads.emplace_back([this, i] (stop_token token) { worker_loop(i, token); });
+        }
+
+        ~scheduler() {
+            stopping.store(true, memory_order_release);
+            for (auto &t : threads)
+                t.request_stop();
+            work_epoch.fetch_add(1, memory_order_release);
+            work_epoch.notify_all();
+            threads.clear();
+
+            scheduler *self = this;
+            active.compare_exchange_strong(self, nullptr, memory_order_release);
+            worker_index = -1;
+        }
+
+        scheduler(const scheduler &) = delete;
+        scheduler & operator=(const scheduler &) = delete;
+
+        size_t size() const {
+            return deques.size();
+        }
+
+        /* never throws, workers would terminate */
+        static void execute(job *j) {
+            try {
+                j->invoke(j->context);
+            } catch (...) {
+                j->join->fail(std::current_exception());
+            }
+            j->join->pending.fetch_sub(1, memory_order_release);
+        }
+
+        /* queues a job on the calling worker, runs it inline if the caller
+         * is not a worker or its deque is full */
+        void submit(job *j) {
+            if (worker_index < 0 || !deques[worker_index]->push(j)) {
+                execute(j);
+                return;
+            }
+            work_epoch.fetch_add(1, memory_order_release);
+            work_epoch.notify_one();
+        }
+
+        bool run_one() {
+            int self = worker_index;
+            if (self < 0)
+                return false;
+            if (job *j = deques[self]->pop()) {
+                execute(j);
+                return true;
+            }
+            size_t n = deques.size();
+            for (size_t k = 1; k < n; ++k) {
+                if (job *j = deques[(self + k) % n]->steal()) {
+                    execute(j);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /* helps with other jobs until the scope's jobs are done */
+        void drain(join_counter &join) {
+            while (join.pending.load(memory_order_acquire) > 0) {
+                if (!run_one())
+                    std::this_thread::yield();
+            }
+        }
+
+        /* drain, then rethrow what one of the jobs threw */
+        void wait(join_counter &join) {
+            drain(join);
+            join.rethrow();
+        }
+
+        void worker_loop(int index, stop_token token) {
+            worker_index = index;
+            while (!token.stop_requested()) {
+                uint32_t epoch = work_epoch.load(memory_order_acquire);
+                if (run_one())
+                    continue;
+                /* spin a little before going to sleep */
+                bool found = false;
+                for (int spin = 0; spin < 64 && !found; ++spin) {
+                    std::this_thread::yield();
+                    found = run_one();
+                }
+                if (!found && !stopping.load(memory_order_acquire))
+                    work_epoch.wait(epoch, memory_order_acquire);
+            }
+        }
+    };
+
+    scheduler *current() {
+        return worker_index >= 0 ? active.load(memory_order_acquire) : nullptr;
+    }
+
+    bool is_main_thread() {
+        return worker_index == 0;
+    }
+
+    /* calls f(i) for every i in [begin, end), splitting the range in halves
+     * until it is at most grain long; grain = 0 picks one from the worker count */
+    template<typename F>
+    struct range_task {
+        F *body;
+        size_t begin;
+        size_t end;
+        size_t grain;
+
+        static void invoke(void *self) {
+            static_cast<range_task *>(self)->run();
+        }
+
+        void run() {
+            scheduler *s = current();
+            if (s == nullptr || end - begin <= grain) {
+                for (size_t i = begin; i < end; ++i)
+                    (*body)(i);
+                return;
+            }
+            size_t mid = begin + (end - begin) / 2;
+            range_task right = {body, mid, end, grain};
+            join_counter join;
+            join.pending.store(1, memory_order_relaxed);
+            job j = {&invoke, &right, &join};
+            s->submit(&j);
+
+            /* right and join live in this frame: wait even when left throws */
+            range_task left = {body, begin, mid, grain};
+            try {
+                left.run();
+            } catch (...) {
+                join.fail(std::current_exception());
+            }
+            s->wait(join);
+        }
+    };
+
+    template<typename F>
+    void parallel_for(size_t begin, size_t end, F &&f, size_t grain = 0) {
+        if (begin >= end)
+            return;
+        scheduler *s = current();
+        if (grain == 0)
+            grain = max<size_t>(1, (end - begin) / (s != nullptr ? s->size() * 8 : 1));
+        range_task<std::remove_reference_t<F>> task = {&f, begin, end, grain};
+        task.run();
+    }
+
+    /* calls f(entity) for every entity of an entt view, in parallel over
+     * the view's leading storage */
+    template<typename View, typename F>
+    void parallel_for_each(const View &view, F &&f, size_t grain = 0) {
+        const auto *storage = view.handle();
+        if (storage == nullptr)
+            return;
+        const auto *entities = storage->data();
+        parallel_for(0, storage->size(), [&] (size_t i) {
+            auto entity = entities[i];
+            if (view.contains(entity))
+                f(entity);
+        }, grain);
+    }
+
+    /* independent jobs of any type, wait() (or the destructor) joins them.
+     * only wait() rethrows, the destructor drops the exception */
+    struct task_group {
+        struct entry {
+            function<void()> fn;
+            job j;
+        };
+
+        deque<entry> entries;
+        join_counter join;
+
+        task_group() = default;
+        task_group(const task_group &) = delete;
+
+        ~task_group() {
+            drain();
+        }
+
+        template<typename F>
+        void run(F &&f) {
+            scheduler *s = current();
+            if (s == nullptr) {
+                f();
+                return;
+            }
+            entry &e = entries.emplace_back(function<void()>(std::forward<F>(f)));
+            e.j = {
+                [] (void *fn) { (*static_cast<function<void()> *>(fn))(); },
+                &e.fn,
+                &join
+            };
+            join.pending.fetch_add(1, memory_order_relaxed);
+            s->submit(&e.j);
+        }
+
+        void wait() {
+            drain();
+            join.rethrow();
+        }
+
+        void drain() {
+            if (scheduler *s = current())
+                s->drain(join);
+            while (join.pending.load(memory_order_acquire) > 0)
+                std::this_thread::yield();
+        }
+    };
+}
@@ -0,0 +1,147 @@
+export module lod;
+
+import std;
+import glm;
+import gl;
+import geometry;
+import meshlet;
+
+using std::array;
+using std::optional;
+using std::size_t;
+using std::span;
+using std::uint32_t;
+using std::vector;
+using namespace glm;
+
+/*
+ * continuous level of detail for parametric surfaces:
+ * a chain of grids of decreasing resolution is generated from the surface
+ * function, each level knows its geometric error (in object space).
+ * per instance the coarsest level whose error projected to the screen stays
+ * under a pixel threshold is drawn.
+ */
+
+export constexpr array<int, 6> default_lod_resolutions = {128, 64, 32, 16, 8, 4};
+
+/* control points per side of the patch grid used by the tessellation path */
+export constexpr int patch_grid_size = 9;
+
+/* largest distance between the surface and the flat grid cell approximating it,
+ * sampled at cell centers */
+export float surface_error(int W, int H, can_make_surface auto f) {
+    float error = 0;
+    for (int i = 0; i < W - 1; ++i) {
+        float u0 = float(i) / (W - 1);
+        float u1 = float(i + 1) / (W - 1);
+        for (int j = 0; j < H - 1; ++j) {
+            float v0 = float(j) / (H - 1);
+            float v1 = float(j + 1) / (H - 1);
+            vec3 center = f((u0 + u1) / 2, (v0 + v1) / 2);
+            vec3 cell = (f(u0, v0) + f(u1, v0) + f(u0, v1) + f(u1, v1)) / 4.f;
+            error = max(error, distance(center, cell));
+        }
+    }
+    return error;
+}
+
+export struct lod_chain {
+    /* index of the finest level in the mesh array, level i is first_mesh + i */
+    uint32_t first_mesh;
+    /* object space error of every level, finest first */
+    vector<float> errors;
+    /* object space bounding sphere around the origin, of any level */
+    float radius = 0;
+    vector<uint32_t> triangles;
+    /* coarse grid of (u, v) quad patches, the surface itself is evaluated
+     * in the tessellation shaders */
+    uint32_t patch_mesh;
+
+    uint32_t mesh(uint32_t level) const {
+        return first_mesh + level;
+    }
+
+    uint32_t levels() const {
+        return errors.size();
+    }
+};
+
+/* generates the meshes of every level and the patch grid and appends them to meshes,
+ * clusters gets the meshlets of every mesh (none for the patch grid) */
+export lod_chain make_lod_chain(
+    vector<gl::mesh> &meshes,
+    vector<meshlet_clusters> &clusters,
+    can_make_surface auto f,
+    span<const int> resolutions = default_lod_resolutions
+) {
+    lod_chain chain;
+    chain.first_mesh = meshes.size();
+    for (int n : resolutions) {
+        vector<vec3> positions = generate_surface(n, n, f);
+        /* the finest level's samples plus its error bound the surface between them */
+        if (chain.errors.empty()) {
+            for (vec3 p : positions)
+                chain.radius = max(chain.radius, length(p));
+            chain.radius += surface_error(n, n, f);
+        }
+        meshlet_mesh m = build_meshlets(generate_grid_indices(n, n), positions);
+        clusters.push_back(upload_meshlets(m));
+        vector<vec3> normals = generate_normals(n, n, f);
+        vector<vec2> texcoords = generate_texcoords(n, n);
+        meshes.push_back(gl::make_mesh(
+            span<const uint32_t>(m.indices),
+            span<const vec3>(positions),
+            span<const vec3>(normals),
+            span<const vec2>(texcoords)
+        ));
+        chain.errors.push_back(surface_error(n, n, f));
+        chain.triangles.push_back((n - 1) * (n - 1) * 2);
+    }
+
+    constexpr int n = patch_grid_size;
+    chain.patch_mesh = meshes.size();
+    vector<unsigned int> patches = generate_patch_indices(n, n);
+    vector<vec3> grid = generate_surface(n, n, [] (float u, float v) { return vec3(u, v, 0); });
+    array<span<const vec3>, 1> attributes = {grid};
+    meshes.push_back(gl::make_mesh(span<const unsigned int>(patches), span<const span<const vec3>>(attributes)));
+    clusters.emplace_back();
+    return chain;
+}
+
+export struct lod_selector {
+    /* allowed screen space error in pixels */
+    float threshold = 1.f;
+    /* a coarser level is only taken once its error is below threshold * hysteresis,
+     * so instances sitting at a boundary do not flicker between two levels */
+    float hysteresis = 0.75f;
+    /* pixels covered by one world unit at distance 1 */
+    float pixels_per_unit = 1.f;
+
+    void set_projection(float fov_y, float viewport_height) {
+        pixels_per_unit = viewport_height / (2.f * tan(fov_y / 2.f));
+    }
+
+    float projected_error(float error, float scale, float dist) const {
+        return error * scale * pixels_per_unit / max(dist, 1e-3f);
+    }
+
+    uint32_t select(const lod_chain &chain, uint32_t current, const mat4 &model, vec3 eye) const {
+        float scale = max(length(vec3(model[0])), max(length(vec3(model[1])), length(vec3(model[2]))));
+        /* distance to the closest point of the surface's bounding sphere */
+        float dist = distance(vec3(model[3]), eye) - chain.radius * scale;
+
+        /* coarsest level, no finer than finest, whose projected error is within limit */
+        auto coarsest = [&] (uint32_t finest, float limit) -> optional<uint32_t> {
+            for (uint32_t i = chain.levels(); i-- > finest;)
+                if (projected_error(chain.errors[i], scale, dist) <= limit)
+                    return i;
+            return std::nullopt;
+        };
+        uint32_t level = coarsest(0, threshold).value_or(0);
+        /* finer levels are taken at once, coarser ones step as far as the
+         * stricter limit allows */
+        if (level > current)
+            level = coarsest(current + 1, threshold * hysteresis).value_or(current);
+        return level;
+    }
+};
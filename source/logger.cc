@@ -1,16 +1,17 @@
 export module logger;
 
 import std;
-using std::string;
+import trace;
+using std::array;
+using std::size_t;
 using std::string_view;
-using std::format_string;
-using std::make_format_args;
-using std::vformat;
-using std::format;
+using std::format_to_n;
 using std::forward;
+using std::min;
 using std::cout;
-using std::endl;
 using std::chrono::utc_clock;
+using std::chrono::seconds;
+using std::chrono::floor;
 
 namespace logger {
     namespace detail {
@@ -28,6 +29,26 @@ namespace logger {
 
         template<>
         struct explode<0> : to_chars<0> {};
+
+        constexpr size_t count_digits(unsigned n) {
+            size_t digits = 1;
+            while (n /= 10)
+                ++digits;
+            return digits;
+        }
+
+        /* length of one line written by log(), longer messages are truncated */
+        constexpr size_t line_capacity = 1024;
+
+        /* every log call formats into this buffer instead of allocating a string,
+         * the timestamp prefix is only reformatted when the second changes */
+        struct line_buffer {
+            array<char, line_capacity> chars;
+            size_t timestamp_size = 0;
+            utc_clock::time_point timestamp_time = {};
+        };
+
+        thread_local line_buffer line;
     }
 }
 
@@ -87,54 +108,109 @@ export namespace logger {
         return normal;
     }
 
+    /* "\x1b[" code (";" code)* "m" */
     template<unsigned... Codes>
-    constexpr auto escape() {
-        auto _ = [] () {
-            string result = "\x1b[";
-            if constexpr (sizeof...(Codes) > 0) {
-                ((result += to_str<Codes>::value, result += ";"), ...);
-                result.pop_back();
-            }
-            result += 'm';
+    struct escape_sequence {
+        static constexpr size_t size =
+            3 + (0 + ... + (detail::count_digits(Codes) + 1)) - (sizeof...(Codes) > 0);
+
+        static constexpr array<char, size + 1> value = [] {
+            array<char, size + 1> result = {};
+            size_t i = 0;
+            auto append = [&] (const char * s) {
+                while (*s)
+                    result[i++] = *s++;
+            };
+            append("\x1b[");
+            ((append(to_str<Codes>::value), result[i++] = ';'), ...);
+            if constexpr (sizeof...(Codes) > 0)
+                --i;
+            result[i++] = 'm';
             return result;
-        };
-        return _();
+        }();
+    };
+
+    template<unsigned... Codes>
+    constexpr string_view escape() {
+        return {escape_sequence<Codes...>::value.data(), escape_sequence<Codes...>::size};
     }
 
+    static_assert(escape<>() == "\x1b[m");
+    static_assert(escape<normal>() == "\x1b[0m");
+    static_assert(escape<fg::bright::yellow, bold>() == "\x1b[93;1m");
+
     template<int level, typename... Args>
-    void log(format_string<Args...> fmt, Args&&... args) {
+    void log(trace::format<Args...> fmt, Args&&... args) {
         constexpr auto color = level_to_color<level>();
-        cout << format("{0:%x} {0:%X}", utc_clock::now());
-        cout << escape<normal>();
-        cout << ": ";
-        cout << escape<color, bold>();
-        cout << vformat(fmt.get(), make_format_args(args...));
-        cout << escape<normal>();
-        cout << endl;
+        constexpr string_view reset = escape<normal>();
+        constexpr string_view separator = ": ";
+        constexpr string_view message_style = escape<color, bold>();
+        constexpr string_view ellipsis = "...";
+        constexpr size_t capacity = detail::line_capacity;
+        /* reset + newline are always written, even after truncation */
+        constexpr size_t tail_size = reset.size() + 1;
+
+        if (trace::enabled()) {
+            trace::write(level, fmt.id, fmt.get(), args...);
+            return;
+        }
+
+        auto &line = detail::line;
+        char *out = line.chars.data();
+
+        auto now = floor<seconds>(utc_clock::now());
+        if (line.timestamp_size == 0 || now != line.timestamp_time) {
+            line.timestamp_time = now;
+            line.timestamp_size = format_to_n(out, capacity / 4, "{0:%x} {0:%X}", now).out - out;
+        }
+        size_t size = line.timestamp_size;
+
+        auto append = [&] (string_view s) {
+            size_t n = min(s.size(), capacity - tail_size - size);
+            s.copy(out + size, n);
+            size += n;
+        };
+        append(reset);
+        append(separator);
+        append(message_style);
+
+        size_t limit = capacity - tail_size - size;
+        auto result = format_to_n(out + size, limit, fmt.fmt, forward<Args>(args)...);
+        if (static_cast<size_t>(result.size) > limit) {
+            size += limit - ellipsis.size();
+            append(ellipsis);
+        } else {
+            size += result.size;
+        }
+
+        reset.copy(out + size, reset.size());
+        size += reset.size();
+        out[size++] = '\n';
+        cout.write(out, size).flush();
     }
 
     template<typename... Args>
-    void error(format_string<Args...> fmt, Args&&... args) {
+    void error(trace::format<Args...> fmt, Args&&... args) {
         log<Error>(fmt, forward<Args>(args)...);
     }
 
     template<typename... Args>
-    void warn(format_string<Args...> fmt, Args&&... args) {
+    void warn(trace::format<Args...> fmt, Args&&... args) {
         log<Warn>(fmt, forward<Args>(args)...);
     }
 
     template<typename... Args>
-    void notice(format_string<Args...> fmt, Args&&... args) {
+    void notice(trace::format<Args...> fmt, Args&&... args) {
         log<Notice>(fmt, forward<Args>(args)...);
     }
 
     template<typename... Args>
-    void info(format_string<Args...> fmt, Args&&... args) {
+    void info(trace::format<Args...> fmt, Args&&... args) {
         log<Info>(fmt, forward<Args>(args)...);
     }
 
     template<typename... Args>
-    void debug(format_string<Args...> fmt, Args&&... args) {
+    void debug(trace::format<Args...> fmt, Args&&... args) {
         log<Debug>(fmt, forward<Args>(args)...);
     }
 };
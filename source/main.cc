@@ -1,6 +1,5 @@
 #include <entt/entity/registry.hpp>
-#define GL_GLEXT_PROTOTYPES
-#include <GL/glcorearb.h>
+#include "gl_api.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
@@ -16,10 +15,30 @@ import imgui_impl_glfw;
 import imgui_impl_opengl3;
 
 import logger;
+import trace;
 import camera;
 import geometry;
+import pacing;
+import simulation;
+import jobs;
+import lod;
+import meshlet;
+import asset_io;
+import scene_file;
+import hot_reload;
+import shadow;
+import render_graph;
+import commands;
+import ecs;
+import bvh;
+import streaming;
+import memory;
+import planet;
 
 using std::array;
+using std::flat_map;
+using std::map;
+using std::optional;
 using std::span;
 using std::string;
 using std::vector;
@@ -30,6 +49,33 @@ extern const uint8_t _binary_main_vert_glsl_spv_start[];
 extern const uint8_t _binary_main_vert_glsl_spv_end[];
 extern const uint8_t _binary_main_frag_glsl_spv_start[];
 extern const uint8_t _binary_main_frag_glsl_spv_end[];
+extern const uint8_t _binary_surface_vert_glsl_spv_start[];
+extern const uint8_t _binary_surface_vert_glsl_spv_end[];
+extern const uint8_t _binary_surface_tesc_glsl_spv_start[];
+extern const uint8_t _binary_surface_tesc_glsl_spv_end[];
+extern const uint8_t _binary_surface_tese_glsl_spv_start[];
+extern const uint8_t _binary_surface_tese_glsl_spv_end[];
+extern const uint8_t _binary_meshlet_cull_comp_glsl_spv_start[];
+extern const uint8_t _binary_meshlet_cull_comp_glsl_spv_end[];
+extern const uint8_t _binary_hi_z_comp_glsl_spv_start[];
+extern const uint8_t _binary_hi_z_comp_glsl_spv_end[];
+extern const uint8_t _binary_shadow_vert_glsl_spv_start[];
+extern const uint8_t _binary_shadow_vert_glsl_spv_end[];
+extern const uint8_t _binary_bloom_downsample_comp_glsl_spv_start[];
+extern const uint8_t _binary_bloom_downsample_comp_glsl_spv_end[];
+extern const uint8_t _binary_bloom_upsample_comp_glsl_spv_start[];
+extern const uint8_t _binary_bloom_upsample_comp_glsl_spv_end[];
+extern const uint8_t _binary_tonemap_vert_glsl_spv_start[];
+extern const uint8_t _binary_tonemap_vert_glsl_spv_end[];
+extern const uint8_t _binary_tonemap_frag_glsl_spv_start[];
+extern const uint8_t _binary_tonemap_frag_glsl_spv_end[];
+extern const uint8_t _binary_sky_vert_glsl_spv_start[];
+extern const uint8_t _binary_sky_vert_glsl_spv_end[];
+extern const uint8_t _binary_sky_frag_glsl_spv_start[];
+extern const uint8_t _binary_sky_frag_glsl_spv_end[];
+extern const uint8_t _binary_equirectangular_to_cube_comp_glsl_spv_start[];
+extern const uint8_t _binary_equirectangular_to_cube_comp_glsl_spv_end[];
+
 /*
  * packed:
  * - implementation defined
@@ -51,22 +97,45 @@ enum {
     binding_uniform_buffer,
     binding_instances_data,
     binding_light_positions,
-    binding_textures
+    binding_textures,
+    binding_meshlets,
+    binding_draw_commands,
+    binding_draw_command_count,
+    binding_shadow_uniforms
+};
+
+/* texture units below binding_textures */
+enum {
+    texture_unit_post_source,
+    texture_unit_point_shadows,
+    texture_unit_cascade_shadows,
+    /* the sky pass and the conversion to its cubemap, outside the post passes */
+    texture_unit_sky = texture_unit_post_source,
+    /* the meshlet cull, before the scene */
+    texture_unit_hi_z = texture_unit_post_source
+};
+
+/* image units of the post processing passes */
+enum {
+    image_unit_post_destination,
+    image_unit_post_scene,
+    image_unit_sky = image_unit_post_destination
 };
 
 enum {
-    constant_texture_count
+    constant_texture_count,
+    constant_surface_kind
 };
 
-/* binding_instance_data : std430 ssbo, array of */
-struct alignas(vec4) instance_data {
-    mat4 normal_matrix;
-    mat4 model_matrix;
-    vec4 color;
-    int  texture_index;
-    uint32_t _[27];
+/* constant_surface_kind values */
+enum {
+    surface_kind_sphere,
+    surface_kind_torus,
+    surface_kind_helicoid
 };
 
+/* binding_instance_data : std430 ssbo, array of instance_data (ecs) */
+
 /* binding_view_projection : std140 ubo */
 struct alignas(vec4) uniform_buffer {
     mat4 projection_matrix;
@@ -77,13 +146,34 @@ struct alignas(vec4) uniform_buffer {
     float diffuse;
     float specular;
     int   specular_power;
+    float tess_edge_pixels;
+    float viewport_height;
 };
 /* === */
 
 struct imgui {
     bool vsync = 1;
+    float target_fps = 0;
+    bool tessellation = false;
+    float sun_intensity = 0.5f;
+    float exposure = 1.f;
+    float bloom_strength = 0.05f;
+    float bloom_threshold = 1.f;
+    float bloom_radius = 1.f;
     imgui(GLFWwindow * window) {
         ImGui::CheckVersion();
+        /* counted like operator new */
+        ImGui::SetAllocatorFunctions(
+            [] (size_t size, void *) {
+                memory::count_allocation(size);
+                return malloc(size);
+            },
+            [] (void *p, void *) {
+                if (p != nullptr)
+                    memory::count_free();
+                free(p);
+            }
+        );
         ImGui::CreateContext();
         ImGuiIO& io = ImGui::GetIO();
         io.ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard;
@@ -100,6 +190,20 @@ struct imgui {
 
     void new_frame(
         float fps,
+        frame_pacer *pacer,
+        lod_selector *lod,
+        size_t triangles,
+        shadow_system *shadows,
+        render_graph *graph,
+        commands::call_stats *calls,
+        streaming::metrics *world,
+        streaming::config *world_settings,
+        const spatial_stats *spatial,
+        size_t visible,
+        const memory::frame_stats *frame_memory,
+        const planet::metrics *planet,
+        planet::config *planet_settings,
+        float *tess_edge_pixels,
         float *screen_color,
         float *ambient,
         float *diffuse,
@@ -117,7 +221,73 @@ struct imgui {
         if (ImGui::Checkbox("Vsync", &vsync)) {
             glfw::swap_interval(vsync ? 1 : 0);
         }
+        ImGui::SliderInt("Frames in flight", &pacer->frames_in_flight, 1, frame_pacer::max_frames_in_flight);
+        ImGui::Checkbox("Late latch", &pacer->late_latch);
+        if (ImGui::SliderFloat("Target fps (vsync off)", &target_fps, 0.f, 480.f)) {
+            pacer->target_frame_time = target_fps > 0 ? 1. / target_fps : 0;
+        }
+        ImGui::SliderFloat("LOD error (px)", &lod->threshold, 0.25f, 16.f);
+        ImGui::Checkbox("Tessellation", &tessellation);
+        ImGui::SliderFloat("Tessellation edge (px)", tess_edge_pixels, 2.f, 64.f);
+        ImGui::SliderFloat("Sun", &sun_intensity, 0.f, 2.f);
+        ImGui::SliderInt("Shadow updates per frame", &shadows->update_budget, 0, 30);
+        ImGui::Text("shadow maps: %d static, %d dynamic, %d pending",
+            shadows->stats.static_renders, shadows->stats.dynamic_renders, shadows->stats.pending);
+        ImGui::SliderFloat("Exposure", &exposure, 0.1f, 8.f);
+        ImGui::SliderFloat("Bloom strength", &bloom_strength, 0.f, 0.5f);
+        ImGui::SliderFloat("Bloom threshold", &bloom_threshold, 0.f, 4.f);
+        ImGui::SliderFloat("Bloom radius", &bloom_radius, 0.5f, 3.f);
+        for (render_graph::pass &p : graph->passes) {
+            ImGui::Checkbox(p.name.c_str(), &p.enabled);
+            ImGui::SameLine(200);
+            if (p.culled && p.enabled)
+                ImGui::TextDisabled("culled");
+            else
+                ImGui::Text("%.3f ms", p.gpu_ms);
+        }
+        ImGui::Text("render targets = %.1f MB (%.1f MB unaliased)",
+            graph->allocated_bytes / 1e6, graph->unaliased_bytes / 1e6);
+        ImGui::Text("scene gl calls = %zu issued, %zu elided", calls->total_issued(), calls->total_elided());
+        for (size_t i = 0; i < calls->issued.size(); ++i)
+            ImGui::Text("  %-22s %4zu / %zu", commands::call_names[i], calls->issued[i], calls->elided[i]);
+        ImGui::Text("spatial index = %zu entities, %zu nodes, %zu pending, %zu in view",
+            spatial->entities, spatial->nodes, spatial->pending, visible);
+        ImGui::Text("spatial index = %zu rebuilds, %zu refits, cost x%.2f, %.2f ms",
+            spatial->rebuilds, spatial->refits, spatial->degradation, spatial->update_ms);
+        if (world != nullptr) {
+            int ram_mb = world_settings->ram_budget >> 20;
+            if (ImGui::SliderInt("World RAM budget (MB)", &ram_mb, 16, 4096))
+                world_settings->ram_budget = size_t(ram_mb) << 20;
+            int vram_mb = world_settings->vram_budget >> 20;
+            if (ImGui::SliderInt("World VRAM budget (MB)", &vram_mb, 16, 4096))
+                world_settings->vram_budget = size_t(vram_mb) << 20;
+            ImGui::SliderFloat("World prefetch (s)", &world_settings->prefetch_seconds, 0.f, 10.f);
+            ImGui::Text("world cells = %d active, %d loaded, %d loading, %d queued, %d missing",
+                world->active, world->loaded, world->loading, world->queued, world->missing);
+            ImGui::Text("world ram = %.1f / %.1f MB, vram = %.1f / %.1f MB",
+                world->ram_used / 1e6, world_settings->ram_budget / 1e6,
+                world->vram_used / 1e6, world_settings->vram_budget / 1e6);
+            ImGui::Text("world over budget = %d ram, %d vram", world->over_ram_budget, world->over_vram_budget);
+            ImGui::Text("world i/o = %.1f MB/s, %zu files, %.1f MB",
+                world->read_throughput() / 1e6, world->files_read, world->bytes_read / 1e6);
+            ImGui::Text("world loads = %zu, evictions = %zu, wasted = %zu, failed = %zu",
+                world->loads, world->evictions, world->wasted, world->failed);
+            ImGui::Text("world update = %.2f ms (worst %.2f), hitches = %zu",
+                world->update_ms, world->worst_update_ms, world->hitches);
+        }
+        ImGui::Text("heap = %llu allocations, %.1f KB last frame, %llu frames without",
+            (unsigned long long) frame_memory->allocations, frame_memory->bytes / 1e3,
+            (unsigned long long) frame_memory->frames_without_allocations);
+        ImGui::Text("frame arenas = %.1f / %.1f KB", frame_memory->arena_used / 1e3, frame_memory->arena_capacity / 1e3);
+        ImGui::SliderFloat("Planet detail", &planet_settings->split_factor, 0.5f, 8.f);
+        ImGui::Text("planet = %zu patches shown (depth %d), %zu resident, %zu nodes",
+            planet->shown, planet->depth, planet->resident, planet->nodes);
+        ImGui::Text("planet builds = %zu, %zu queued, %.2f ms (update %.2f ms)",
+            planet->builds, planet->queued, planet->build_ms, planet->update_ms);
         ImGui::Text("fps = %f", fps);
+        ImGui::Text("triangles = %zu", triangles);
+        ImGui::Text("input latency = %.2f ms", pacer->latency * 1000);
+        ImGui::Text("fence wait = %.2f ms", pacer->fence_wait * 1000);
     }
 
     void render() {
@@ -131,11 +301,16 @@ uniform_buffer *ub; // somewhere in the gpu
 lerp_camera camera;
 vec4 screen_color = vec4(1);
 bool camera_enabled = true;
+/* P: the entity under the cursor (the screen center while the camera is on) */
+bool pick_requested = false;
 dvec2 mouse_position = vec2(0, 0);
 double camera_sensitivity = 0.1f;
+ivec2 framebuffer_size = ivec2(WIDTH, HEIGHT);
 
 void framebuffer_size_callback(glfw::window_view, int w, int h) {
     glViewport(0, 0, w, h);
+    framebuffer_size = ivec2(w, h);
+    ub->viewport_height = h;
     ub->projection_matrix = glm::perspective(glm::radians(45.0f), (float) w / (float) h, 0.1f, 100.f);
 }
 
@@ -188,6 +363,10 @@ void key_callback(glfw::window_view window, glfw::Key key, int, glfw::Action act
         }
     }
 
+    if (action == Action::Press && key == Key::P) {
+        pick_requested = true;
+    }
+
     if (action == Action::Press && key == Key::Escape) {
         window.close();
     }
@@ -198,101 +377,114 @@ enum {
     texture_index_earth_daymap
 };
 
-vector<gl::texture> make_textures() {
-    constexpr size_t n = 2;
-    array<path, n> filenames = {
-        "/home/andrew/Source/geometry++/assets/8k_stars.jpg",
-        "/home/andrew/Source/geometry++/assets/8k_earth_daymap.jpg"
-    };
-    vector<gl::texture> textures;
-    textures.reserve(2);
+const vector<path> default_texture_paths = {
+    "/home/andrew/Source/geometry++/assets/8k_stars.jpg",
+    "/home/andrew/Source/geometry++/assets/8k_earth_daymap.jpg"
+};
+
+struct image {
     uint8_t * pixels;
     int x, y, channels;
+};
+
+/* safe on any thread, no gl calls */
+image decode_image(span<const std::byte> bytes, const path &filename) {
+    image im = {};
+    im.pixels = stbi_load_from_memory(
+        reinterpret_cast<const stbi_uc *>(bytes.data()), int(bytes.size()), &im.x, &im.y, &im.channels, STBI_default);
+    if (im.pixels == nullptr)
+        logger::error("texture data = nullptr (path = {})", filename.c_str());
+    return im;
+}
+
+/* safe on any thread, no gl calls */
+image load_image(const path &filename) {
+    try {
+        return decode_image(asset_io::read_file(filename).bytes(), filename);
+    } catch (const asset_io::error &e) {
+        logger::error("{}", e.what());
+        return {};
+    }
+}
+
+vector<gl::texture> make_textures(span<const path> filenames) {
+    size_t n = filenames.size();
+    vector<image> images(n);
     stbi_set_flip_vertically_on_load(false);
-    for (size_t i = 0; i < n; ++i) {
-        pixels = stbi_load(filenames[i].c_str(), &x, &y, &channels, STBI_default);
-        if (pixels == nullptr)
-            logger::error("texture data = nullptr (path = {})", filenames[i].c_str());
-        textures.push_back(gl::make_texture(pixels, x, y, channels));
-        stbi_image_free(pixels);
+
+    /* every file is read at once, a file is decoded on the workers as soon
+     * as it is in memory; upload on this (gl) thread */
+    asset_io::reader io;
+    vector<asset_io::buffer> files(n);
+    jobs::task_group decodes;
+    io.read_all(filenames, [&] (size_t i, optional<asset_io::buffer> data) {
+        if (!data)
+            return;
+        files[i] = std::move(*data);
+        decodes.run([&, i] {
+            images[i] = decode_image(files[i].bytes(), filenames[i]);
+        });
+    });
+    decodes.wait();
+
+    vector<gl::texture> textures;
+    textures.reserve(n);
+    for (image &im : images) {
+        textures.push_back(gl::make_texture(im.pixels, im.x, im.y, im.channels));
+        stbi_image_free(im.pixels);
     }
     return textures;
 }
 
+/* scene files from before the sky pass still draw the stars on it */
 enum {
-    mesh_index_sphere_32x32,
-    mesh_index_sphere_64x64,
     mesh_index_inner_cube
 };
 
-vector<gl::mesh> make_meshes() {
+enum {
+    lod_chain_sphere
+};
+
+vector<gl::mesh> make_meshes(vector<lod_chain> &lod_chains, vector<meshlet_clusters> &clusters) {
     vector<gl::mesh> meshes;
-    meshes.reserve(3);
-    meshes.push_back(gl::make_mesh(
-        generate_grid_indices(32, 32),
-        generate_surface(32, 32, sphere),
-        generate_normals(32, 32, sphere),
-        generate_texcoords(32, 32)
-    ));
-    meshes.push_back(gl::make_mesh(
-        generate_grid_indices(64, 64),
-        generate_surface(64, 64, sphere),
-        generate_normals(64, 64, sphere),
-        generate_texcoords(64, 64)
-    ));
+    meshes.reserve(2 + default_lod_resolutions.size());
     auto cube = create_cube_cw();
+    meshlet_mesh cube_meshlets = build_meshlets(
+        vector<uint32_t>(cube.indices.begin(), cube.indices.end()),
+        cube.positions
+    );
+    clusters.push_back(upload_meshlets(cube_meshlets));
     meshes.push_back(gl::make_mesh(
-        cube.indices,
-        cube.positions,
-        cube.normals,
-        cube.texcoords
+        span<const uint32_t>(cube_meshlets.indices),
+        span<const vec3>(cube.positions),
+        span<const vec3>(cube.normals),
+        span<const vec2>(cube.texcoords)
     ));
+    lod_chains.push_back(make_lod_chain(meshes, clusters, sphere));
     return meshes;
 }
 
-struct model_component {
-    mat4 model_matrix;
-    mat4 normal_matrix;
-};
-
-struct color_component {
-    vec4 value;
-};
-
-struct texture_component {
-    uint32_t index;
-};
-
-struct mesh_component {
-    uint32_t index;
-};
-
-struct light_source_component {
-    vec3 position;
-};
-
 vector<vec4> light_positions = {
     vec4(2),
 };
 
-void create_entities(entt::registry &reg) {
-    {
-        auto room = reg.create();
-        const mat4 S = scale(mat4(1), vec3(5));
-        const mat4 M = S;
-        reg.emplace<model_component>(room, M, transpose(inverse(M)));
-        reg.emplace<mesh_component> (room, mesh_index_inner_cube);
-        reg.emplace<texture_component>(room, texture_index_stars);
-    }
+/* the stars are not an entity, the sky pass draws them behind everything */
+void create_entities(entt::registry &reg, const vector<lod_chain> &lod_chains) {
+    const lod_chain &sphere_lods = lod_chains[lod_chain_sphere];
+    /* every level of the sphere */
+    const aabb unit_box = {vec3(-1), vec3(1)};
 
+    /* only casts the planet's shadow, without a material it is not drawn:
+     * the terrain's patches are (see planet_center) */
     {
         auto planet = reg.create();
         const mat4 T = translate(mat4(1), vec3(-1));
         const mat4 S = scale(mat4(1), vec3(1.5));
         const mat4 M = S * T;
         reg.emplace<model_component>  (planet, M, transpose(inverse(M)));
-        reg.emplace<mesh_component>   (planet, mesh_index_sphere_64x64);
-        reg.emplace<texture_component>(planet, texture_index_earth_daymap);
+        reg.emplace<mesh_component>   (planet, sphere_lods.mesh(0));
+        reg.emplace<lod_component>    (planet, lod_chain_sphere, 0u);
+        reg.emplace<shadow_caster_component>(planet, false);
     }
 
     for (auto & position : light_positions) {
@@ -301,14 +493,279 @@ void create_entities(entt::registry &reg) {
         const mat4 S = scale(mat4(1), vec3(0.2));
         const mat4 M = S * T;
         reg.emplace<model_component>(e, M, transpose(inverse(M)));
-        reg.emplace<mesh_component> (e, mesh_index_sphere_32x32);
-        reg.emplace<color_component>(e, vec4(1));
+        reg.emplace<mesh_component> (e, sphere_lods.mesh(0));
+        reg.emplace<lod_component>  (e, lod_chain_sphere, 0u);
+        reg.emplace<material_component>(e, vec4(1), -1);
         reg.emplace<light_source_component>(e, vec3(position));
+        reg.emplace<bounds_component>(e, unit_box);
     }
 }
 
+/* scene files store these components, changing one of them invalidates
+ * existing files (they are rebuilt from create_entities) */
+template<typename... Components>
+struct scene_components {
+    /* entities are numbered by their entity index */
+    static void save(const entt::registry &reg, span<const path> texture_paths, const path &filename) {
+        scene_file::writer w;
+        (save_table<Components>(reg, w), ...);
+        for (const path &p : texture_paths)
+            w.add_texture(p.native());
+        w.save(filename);
+    }
+
+    template<typename T>
+    static void save_table(const entt::registry &reg, scene_file::writer &w) {
+        vector<uint32_t> entities;
+        vector<T> values;
+        for (auto [entity, value] : reg.view<T>().each()) {
+            uint32_t index = entt::to_entity(entity);
+            entities.push_back(index);
+            values.push_back(value);
+            w.entity_count = std::max(w.entity_count, index + 1);
+        }
+        w.add_table(span<const uint32_t>(entities), span<const T>(values));
+    }
+
+    /* the created entities, in file order */
+    static vector<entt::entity> load(entt::registry &reg, const scene_file::scene_view &scene) {
+        vector<entt::entity> entities(scene.entity_count());
+        reg.create(entities.begin(), entities.end());
+        (load_table<Components>(reg, scene, entities), ...);
+        return entities;
+    }
+
+    /* throws what load would throw, without touching a registry */
+    static void check(const scene_file::scene_view &scene) {
+        (check_table<Components>(scene), ...);
+    }
+
+    template<typename T>
+    static void check_table(const scene_file::scene_view &scene) {
+        if (auto table = scene.table<T>())
+            for (uint32_t index : table->first)
+                if (index >= scene.entity_count())
+                    throw scene_file::error("scene file is truncated or corrupt");
+    }
+
+    template<typename T>
+    static void load_table(entt::registry &reg, const scene_file::scene_view &scene, span<const entt::entity> entities) {
+        auto table = scene.table<T>();
+        if (!table)
+            return;
+        auto [indices, values] = *table;
+        for (size_t i = 0; i < indices.size(); ++i) {
+            if (indices[i] >= entities.size())
+                throw scene_file::error("scene file is truncated or corrupt");
+            reg.emplace<T>(entities[indices[i]], values[i]);
+        }
+    }
+};
+
+using scene_storage = scene_components<
+    model_component,
+    mesh_component,
+    material_component,
+    light_source_component,
+    shadow_caster_component,
+    lod_component,
+    bounds_component
+>;
+
+/* a world cell (written by make-world) as the i/o thread leaves it: read,
+ * checked, meshlets built and textures decoded. mesh and texture indices in
+ * the file are local to the cell, activation maps them to slots */
+struct world_cell {
+    scene_file::loaded_scene scene;
+    vector<meshlet_mesh> meshlets = {};
+    vector<image> images = {};
+    /* while active */
+    vector<entt::entity> entities = {};
+    vector<uint32_t> mesh_slots = {};
+    vector<int32_t> texture_slots = {};
+
+    ~world_cell() {
+        for (image &im : images)
+            stbi_image_free(im.pixels);
+    }
+};
+
+/* texture units for the textures of active cells, after the scene's own */
+constexpr uint32_t world_texture_slots = 24;
+
+/* streamer i/o thread, no gl. lod_levels: levels of every lod chain.
+ * the file is not trusted, every index is checked before it is used */
+streaming::loaded_cell<world_cell> load_world_cell(const path &file, asset_io::reader &io, span<const uint32_t> lod_levels) {
+    auto cell = std::make_unique<world_cell>(scene_file::loaded_scene(io.read(file)));
+    const scene_file::scene_view &scene = cell->scene;
+    scene_storage::check(scene);
+    auto meshes = scene.meshes();
+    auto textures = scene.textures();
+    if (auto table = scene.table<mesh_component>())
+        for (const mesh_component &m : table->second)
+            if (m.index >= meshes.size())
+                throw scene_file::error("mesh index out of range");
+    if (auto table = scene.table<material_component>())
+        for (const material_component &m : table->second)
+            if (m.texture_index >= int32_t(textures.size()))
+                throw scene_file::error("texture index out of range");
+    if (auto table = scene.table<lod_component>())
+        for (const lod_component &l : table->second)
+            if (l.chain >= lod_levels.size() || l.level >= lod_levels[l.chain])
+                throw scene_file::error("lod chain or level out of range");
+    for (const scene_file::mesh_blob &m : meshes) {
+        size_t vertex_count = m.positions.get().size();
+        if (m.normals.get().size() != vertex_count || m.texcoords.get().size() != vertex_count)
+            throw scene_file::error("mesh attributes of different lengths");
+        auto indices = m.indices.get();
+        if (indices.size() % 3 != 0 || std::ranges::any_of(indices, [=] (uint32_t i) { return i >= vertex_count; }))
+            throw scene_file::error("mesh index out of range");
+    }
+
+    size_t ram = scene.size;
+    size_t vram = 0;
+    for (const scene_file::mesh_blob &m : meshes) {
+        meshlet_mesh &built = cell->meshlets.emplace_back(build_meshlets(m.indices.get(), m.positions.get()));
+        size_t mesh_bytes = built.indices.size() * sizeof(uint32_t) + built.meshlets.size() * sizeof(meshlet_bounds);
+        ram += mesh_bytes;
+        vram += mesh_bytes + m.positions.get().size_bytes() + m.normals.get().size_bytes() + m.texcoords.get().size_bytes();
+    }
+    vector<path> texture_paths;
+    for (const scene_file::texture_ref &t : textures) {
+        auto name = t.path.get();
+        texture_paths.push_back(file.parent_path() / string(name.begin(), name.end()));
+    }
+    /* decoded while the other textures of the cell are read */
+    cell->images.resize(texture_paths.size());
+    io.read_all(texture_paths, [&] (size_t i, optional<asset_io::buffer> data) {
+        if (data)
+            cell->images[i] = decode_image(data->bytes(), texture_paths[i]);
+    });
+    for (size_t i = 0; i < texture_paths.size(); ++i) {
+        const image &im = cell->images[i];
+        if (im.pixels == nullptr)
+            throw scene_file::error(std::format("could not load {}", texture_paths[i].string()));
+        ram += size_t(im.x) * im.y * im.channels;
+        /* rgb is padded to 4 bytes */
+        vram += size_t(im.x) * im.y * 4;
+    }
+    return {std::move(cell), ram, vram};
+}
+
+struct shader_source {
+    GLenum type;
+    /* file name of the glsl source, hot reload matches on it */
+    string file;
+    span<const uint8_t> embedded;
+    flat_map<uint32_t, uint32_t> constants = {};
+};
+
+/* newest spir-v of every shader changed at runtime, by file name */
+map<string, vector<uint8_t>> reloaded_spirv;
+
+/* nothing if a stage does not specialize or the program does not link */
+optional<gl::program> build_program(span<const shader_source> stages) {
+    gl::program p;
+    vector<gl::shader> shaders;
+    shaders.reserve(stages.size());
+    for (const shader_source &stage : stages) {
+        auto reloaded = reloaded_spirv.find(stage.file);
+        span<const uint8_t> binary = reloaded != reloaded_spirv.end() ? span<const uint8_t>(reloaded->second) : stage.embedded;
+        gl::shader &shader = shaders.emplace_back(stage.type);
+        shader.binary(GL_SHADER_BINARY_FORMAT_SPIR_V, binary);
+        shader.specialize("main", stage.constants);
+        if (!shader.compiled()) {
+            logger::error("{} does not specialize", stage.file);
+            return std::nullopt;
+        }
+        p.attach_shader(shader);
+    }
+    if (!p.try_link())
+        return std::nullopt;
+    return p;
+}
+
+/*
+ * GEOMETRY_TIMING=<frames>:<file.json> records <frames> frames after a
+ * warm-up, then writes them as json and closes the window:
+ * - cpu_ms: from the end of begin_frame to the swap, the work gl-debug adds to
+ * - frame_ms: swap to swap, includes vsync and the fence wait
+ * - gpu_ms of every pass, 0 while culled
+ * median, mean, p99 and max of each. gl_debug names the build profile, a run
+ * of each (xmake f --gl-debug=y / n) compares the two
+ */
+struct frame_timing {
+    static constexpr size_t warmup_frames = 120;
+
+    size_t frames = 0;
+    path file;
+    size_t frame = 0;
+    vector<double> cpu_ms;
+    vector<double> frame_ms;
+    vector<vector<double>> pass_ms;
+
+    frame_timing(std::string_view setting) {
+        size_t colon = setting.find(':');
+        auto [end, ec] = std::from_chars(setting.data(), setting.data() + std::min(colon, setting.size()), frames);
+        if (colon == setting.npos || ec != std::errc() || end != setting.data() + colon || frames == 0 || colon + 1 == setting.size())
+            throw std::runtime_error(std::format("GEOMETRY_TIMING = <frames>:<file.json>, not {}", setting));
+        file = setting.substr(colon + 1);
+        cpu_ms.reserve(frames);
+        frame_ms.reserve(frames);
+    }
+
+    /* true once every frame is recorded */
+    bool record(double cpu_seconds, double frame_seconds, const render_graph &graph) {
+        if (frame++ < warmup_frames)
+            return false;
+        cpu_ms.push_back(cpu_seconds * 1e3);
+        frame_ms.push_back(frame_seconds * 1e3);
+        pass_ms.resize(graph.passes.size());
+        for (size_t i = 0; i < graph.passes.size(); ++i)
+            pass_ms[i].push_back(graph.passes[i].frame_gpu_ms);
+        return cpu_ms.size() == frames;
+    }
+
+    void write(const render_graph &graph) const {
+        auto stats = [] (vector<double> samples) {
+            std::ranges::sort(samples);
+            double mean = std::ranges::fold_left(samples, 0.0, std::plus()) / samples.size();
+            return std::format(R"({{"median": {:.4f}, "mean": {:.4f}, "p99": {:.4f}, "max": {:.4f}}})",
+                samples[samples.size() / 2], mean, samples[samples.size() * 99 / 100], samples.back());
+        };
+        std::ofstream out(file);
+        std::println(out, R"({{"gl_debug": {}, "frames": {}, "cpu_ms": {}, "frame_ms": {}, "passes": [)",
+            gl::debug_output, cpu_ms.size(), stats(cpu_ms), stats(frame_ms));
+        for (size_t i = 0; i < pass_ms.size(); ++i)
+            std::println(out, R"({}{{"name": "{}", "gpu_ms": {}}})", i > 0 ? "," : "", graph.passes[i].name, stats(pass_ms[i]));
+        std::println(out, "]}}");
+        if (!out)
+            logger::error("timing not written to {}", file.string());
+        else
+            logger::info("timing of {} frames written to {} (gl-debug {})", cpu_ms.size(), file.string(), gl::debug_output ? "on" : "off");
+    }
+};
+
 int main()
 {
+    /* binary trace instead of text logs, decode with trace-decode */
+    optional<trace::writer> trace_writer;
+    if (const char *trace_path = getenv("GEOMETRY_TRACE"))
+        trace_writer.emplace(trace_path);
+    optional<frame_timing> timing;
+    if (const char *timing_setting = getenv("GEOMETRY_TIMING")) {
+        try {
+            timing.emplace(timing_setting);
+        } catch (const std::runtime_error &e) {
+            logger::error("{}", e.what());
+        }
+    }
+
+    /* this thread becomes worker 0, the only one issuing gl calls */
+    jobs::scheduler scheduler;
+    /* per frame lists of the workers, reset after every frame */
+    memory::frame_arenas frame_memory(scheduler.size());
+
     glfw::set_default_error_handler();
     glfw::window window = glfw::create_window(WIDTH, HEIGHT, "glfw", {
         {glfw::WindowHint::ContextCreationApi, glfw::NativeContextApi},
@@ -317,7 +774,9 @@ int main()
         {glfw::WindowHint::ContextVersionMinor, 6},
         {glfw::WindowHint::OpenglProfile, glfw::OpenglCoreProfile},
         {glfw::WindowHint::OpenglForwardCompat, true},
-        {glfw::WindowHint::ContextDebug, true}
+        {glfw::WindowHint::ContextDebug, gl::debug_output},
+        /* no error checking in the driver at all */
+        {glfw::WindowHint::ContextNoError, !gl::debug_output}
     });
 
     glfw::set_current_context(window);
@@ -331,65 +790,170 @@ int main()
     window.set_cursor_mode(glfw::CursorMode::Disabled);
 
     gl::load(glfw::get_proc_address);
-    gl::set_default_debug_message_handler();
-    gl::enable(GL_DEBUG_OUTPUT);
-    gl::enable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+    if constexpr (gl::debug_output) {
+        gl::set_default_debug_message_handler();
+        gl::enable(GL_DEBUG_OUTPUT);
+        gl::enable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+    }
     gl::enable(GL_DEPTH_TEST);
     gl::enable(GL_CULL_FACE);
 
     imgui gui(window.handle);
 
-    vector<gl::texture> textures = make_textures();
-    vector<gl::mesh> meshes = make_meshes();
+    /* scene snapshot: loaded in place if it exists, written after the
+     * scene was built otherwise */
+    optional<scene_file::mapped_scene> scene;
+    const char *scene_path = getenv("GEOMETRY_SCENE");
+    if (scene_path != nullptr && std::filesystem::exists(scene_path)) {
+        try {
+            scene.emplace(scene_path);
+        } catch (const scene_file::error &e) {
+            logger::warn("ignoring scene file {}: {}", scene_path, e.what());
+        }
+    }
 
-    /* --- entities --- */
-    entt::registry registry;
-    create_entities(registry);
-    vector<vector<instance_data>> instance_groups(meshes.size());
-    for (auto entity : registry.view<model_component, mesh_component>()) {
-        auto &model = registry.get<model_component>(entity);
-        instance_data data = {
-            .normal_matrix = model.normal_matrix,
-            .model_matrix = model.model_matrix
-        };
-        if (registry.all_of<texture_component>(entity)) {
-            auto &texture = registry.get<texture_component>(entity);
-            data.texture_index = texture.index;
-        } else if (registry.all_of<color_component>(entity)) {
-            auto &color = registry.get<color_component>(entity);
-            data.color = color.value;
-            data.texture_index = -1;
-        } else {
-            logger::warn("entity has neither color nor texture");
-            data.color = vec4(1, 0, 0, 1);
+    vector<path> texture_paths = default_texture_paths;
+    if (scene) {
+        texture_paths.clear();
+        for (const scene_file::texture_ref &t : scene->textures()) {
+            auto name = t.path.get();
+            texture_paths.emplace_back(string(name.begin(), name.end()));
         }
+    }
 
-        auto &mesh = registry.get<mesh_component>(entity);
-        instance_groups[mesh.index].push_back(data);
+    vector<gl::texture> textures = make_textures(texture_paths);
+    /* GEOMETRY_WORLD = directory written by make-world, streamed around the camera */
+    const char *world_path = getenv("GEOMETRY_WORLD");
+    uint8_t white_pixel[4] = {255, 255, 255, 255};
+    auto empty_texture = [&] {
+        return gl::make_texture(white_pixel, 1, 1, 4);
+    };
+    vector<uint32_t> free_texture_slots;
+    if (world_path != nullptr) {
+        for (uint32_t i = 0; i < world_texture_slots; ++i) {
+            free_texture_slots.push_back(textures.size());
+            textures.push_back(empty_texture());
+        }
+        std::ranges::reverse(free_texture_slots);
     }
+    vector<lod_chain> lod_chains;
+    vector<meshlet_clusters> clusters;
+    vector<gl::mesh> meshes = make_meshes(lod_chains, clusters);
+    lod_selector lod;
 
-    vector<instance_data> instances;
-    vector<size_t>        instance_group_offsets;
-    for (auto &instance_group : instance_groups) {
-        instance_group_offsets.push_back(instances.size() * sizeof(instance_data));
-        instances.insert(instances.end(), instance_group.begin(), instance_group.end());
+    /* --- entities --- */
+    entt::registry registry;
+    bool loaded = false;
+    if (scene) {
+        try {
+            scene_storage::load(registry, *scene);
+            loaded = true;
+        } catch (const scene_file::error &e) {
+            logger::warn("ignoring scene file {}: {}", scene_path, e.what());
+            registry.clear();
+        }
     }
+    if (!loaded) {
+        create_entities(registry, lod_chains);
+        if (scene_path != nullptr)
+            scene_storage::save(registry, texture_paths, scene_path);
+    }
+    /* follows the registry from here on, streamed cells included */
+    spatial_index spatial(registry);
+    vector<entt::entity> visible;
+    bool lod_tessellation = false;
+    render_snapshot snapshot;
+    extract_render_snapshot(registry, snapshot, meshes.size());
+    auto &instances = snapshot.instances;
+    auto &instance_counts = snapshot.counts;
+    auto &instance_group_offsets = snapshot.offsets;
 
     gl::buffer instances_buffer = gl::store(span(instances));
+    /* grows with the streamed world */
+    size_t instances_capacity = instances.size();
     gl::buffer light_positions_buffer = gl::store(span(light_positions));
 
     /* --- shaders --- */
-    gl::shader vs(GL_VERTEX_SHADER), fs(GL_FRAGMENT_SHADER);
-    vs.binary(GL_SHADER_BINARY_FORMAT_SPIR_V, span(_binary_main_vert_glsl_spv_start, _binary_main_vert_glsl_spv_end));
-    vs.specialize();
-    fs.binary(GL_SHADER_BINARY_FORMAT_SPIR_V, span(_binary_main_frag_glsl_spv_start, _binary_main_frag_glsl_spv_end));
-    fs.specialize("main", {
-        {constant_texture_count, 2}
-    });
-    gl::program program;
-    program.attach_shader(vs);
-    program.attach_shader(fs);
-    program.link();
+    uint32_t texture_count = textures.size();
+    vector<shader_source> main_stages = {
+        {GL_VERTEX_SHADER, "main.vert.glsl", span(_binary_main_vert_glsl_spv_start, _binary_main_vert_glsl_spv_end)},
+        {GL_FRAGMENT_SHADER, "main.frag.glsl", span(_binary_main_frag_glsl_spv_start, _binary_main_frag_glsl_spv_end), {
+            {constant_texture_count, texture_count}
+        }}
+    };
+    /* tessellation path: patch grid in, surface evaluated per vertex on the gpu */
+    vector<shader_source> sphere_stages = {
+        {GL_VERTEX_SHADER, "surface.vert.glsl", span(_binary_surface_vert_glsl_spv_start, _binary_surface_vert_glsl_spv_end)},
+        {GL_TESS_CONTROL_SHADER, "surface.tesc.glsl", span(_binary_surface_tesc_glsl_spv_start, _binary_surface_tesc_glsl_spv_end), {
+            {constant_surface_kind, surface_kind_sphere}
+        }},
+        {GL_TESS_EVALUATION_SHADER, "surface.tese.glsl", span(_binary_surface_tese_glsl_spv_start, _binary_surface_tese_glsl_spv_end), {
+            {constant_surface_kind, surface_kind_sphere}
+        }},
+        main_stages[1]
+    };
+    vector<shader_source> cull_stages = {
+        {GL_COMPUTE_SHADER, "meshlet_cull.comp.glsl", span(_binary_meshlet_cull_comp_glsl_spv_start, _binary_meshlet_cull_comp_glsl_spv_end)}
+    };
+
+    gl::program program = build_program(main_stages).value();
+    gl::program sphere_program = build_program(sphere_stages).value();
+    gl::program cull_program = build_program(cull_stages).value();
+    vector<shader_source> hi_z_stages = {
+        {GL_COMPUTE_SHADER, "hi_z.comp.glsl", span(_binary_hi_z_comp_glsl_spv_start, _binary_hi_z_comp_glsl_spv_end)}
+    };
+    gl::program hi_z_program = build_program(hi_z_stages).value();
+    vector<shader_source> shadow_stages = {
+        {GL_VERTEX_SHADER, "shadow.vert.glsl", span(_binary_shadow_vert_glsl_spv_start, _binary_shadow_vert_glsl_spv_end)}
+    };
+    gl::program shadow_program = build_program(shadow_stages).value();
+    vector<shader_source> bloom_downsample_stages = {
+        {GL_COMPUTE_SHADER, "bloom_downsample.comp.glsl", span(_binary_bloom_downsample_comp_glsl_spv_start, _binary_bloom_downsample_comp_glsl_spv_end)}
+    };
+    vector<shader_source> bloom_upsample_stages = {
+        {GL_COMPUTE_SHADER, "bloom_upsample.comp.glsl", span(_binary_bloom_upsample_comp_glsl_spv_start, _binary_bloom_upsample_comp_glsl_spv_end)}
+    };
+    vector<shader_source> tonemap_stages = {
+        {GL_VERTEX_SHADER, "tonemap.vert.glsl", span(_binary_tonemap_vert_glsl_spv_start, _binary_tonemap_vert_glsl_spv_end)},
+        {GL_FRAGMENT_SHADER, "tonemap.frag.glsl", span(_binary_tonemap_frag_glsl_spv_start, _binary_tonemap_frag_glsl_spv_end)}
+    };
+    gl::program bloom_downsample_program = build_program(bloom_downsample_stages).value();
+    gl::program bloom_upsample_program = build_program(bloom_upsample_stages).value();
+    gl::program tonemap_program = build_program(tonemap_stages).value();
+    vector<shader_source> sky_stages = {
+        {GL_VERTEX_SHADER, "sky.vert.glsl", span(_binary_sky_vert_glsl_spv_start, _binary_sky_vert_glsl_spv_end)},
+        {GL_FRAGMENT_SHADER, "sky.frag.glsl", span(_binary_sky_frag_glsl_spv_start, _binary_sky_frag_glsl_spv_end)}
+    };
+    vector<shader_source> sky_convert_stages = {
+        {GL_COMPUTE_SHADER, "equirectangular_to_cube.comp.glsl", span(_binary_equirectangular_to_cube_comp_glsl_spv_start, _binary_equirectangular_to_cube_comp_glsl_spv_end)}
+    };
+    gl::program sky_program = build_program(sky_stages).value();
+    gl::program sky_convert_program = build_program(sky_convert_stages).value();
+    gl::patch_vertices(4);
+
+    vector<bool> is_patch_mesh(meshes.size());
+    for (auto &chain : lod_chains)
+        is_patch_mesh[chain.patch_mesh] = true;
+    /* --- */
+
+    /* --- sky --- */
+    /* the equirectangular stars as a cubemap, converted on the gpu: faces a
+     * quarter of the source's width, which keeps its texel density at their
+     * centers. mips are box filtered from level 0 */
+    gl::enable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+    auto make_sky = [&] {
+        ivec2 source = gl::texture_size(textures[texture_index_stars]);
+        GLsizei size = std::max(source.x / 4, 1);
+        gl::texture cube = gl::make_cube_texture(GL_RGBA8, size, std::bit_width(unsigned(size)));
+        sky_convert_program.use();
+        gl::bind_texture_unit(texture_unit_sky, textures[texture_index_stars]);
+        gl::bind_image_texture_layered(image_unit_sky, cube, 0, GL_WRITE_ONLY, GL_RGBA8);
+        gl::dispatch_compute((size + 7) / 8, (size + 7) / 8, 6);
+        gl::memory_barrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+        gl::generate_mipmap(cube);
+        return cube;
+    };
+    gl::texture sky = make_sky();
     /* --- */
 
     /* --- uniforms --- */
@@ -402,49 +966,620 @@ int main()
     ub->specular = .5f;
     ub->specular_power = 8;
     ub->enable_light = 1;
+    ub->tess_edge_pixels = 8.f;
+    ub->viewport_height = HEIGHT;
     /* --- */
 
     gl::bind_uniform_buffer(binding_uniform_buffer, ubo_buffer);
     gl::bind_shader_storage_buffer(binding_instances_data, instances_buffer);
     gl::bind_texture_units(binding_textures, span(textures));
+
+    shadow_system shadows;
+    gl::bind_uniform_buffer(binding_shadow_uniforms, shadows.uniform_buffer);
+    gl::bind_texture_unit(texture_unit_point_shadows, shadows.cubes);
+    gl::bind_texture_unit(texture_unit_cascade_shadows, shadows.cascades);
+    /* coarse level for shadow casters: lod changes do not invalidate cached maps */
+    constexpr uint32_t shadow_lod_level = 2;
+    const vec3 sun_direction = normalize(vec3(1, 2, 1));
+    vector<shadow_caster> casters;
     gl::bind_shader_storage_buffer(binding_light_positions, light_positions_buffer);
 
-    double dt = 0;
-    double last_frame_time = 0;
-    glfw::set_time(0);
-    while (!window.should_close()) {
-        glfw::poll_events();
-        double now = glfw::get_time();
-        dt = now - last_frame_time;
-        last_frame_time = now;
-        if (camera_enabled) {
-            camera.update(dt);
-            ub->view_matrix = camera.compute_view_matrix();
-            ub->camera_position = camera.position;
+    /* --- hot reload --- */
+    struct shader_update {
+        string file;
+        vector<uint8_t> spirv;
+    };
+    struct texture_update {
+        size_t index;
+        image im;
+    };
+    hot_reload::pending_queue<shader_update> shader_updates;
+    hot_reload::pending_queue<texture_update> texture_updates;
+    optional<hot_reload::watcher> watcher;
+    /* GEOMETRY_HOT_RELOAD = directory of the glsl sources */
+    if (const char *shader_dir = getenv("GEOMETRY_HOT_RELOAD")) {
+        vector<path> directories = {path(shader_dir)};
+        for (const path &p : texture_paths)
+            if (std::ranges::find(directories, p.parent_path()) == directories.end())
+                directories.push_back(p.parent_path());
+        try {
+            /* runs on the watcher thread: compile / decode only, no gl */
+            watcher.emplace(directories, [&, shader_dir = path(shader_dir)] (const path &changed) {
+                string name = changed.filename().string();
+                if (changed.parent_path() == shader_dir && name.ends_with(".glsl")) {
+                    if (auto spirv = hot_reload::compile_glsl(changed))
+                        shader_updates.push({name, std::move(*spirv)});
+                    else
+                        logger::warn("{} does not compile, keeping the running version", name);
+                }
+                for (size_t i = 0; i < texture_paths.size(); ++i) {
+                    if (texture_paths[i] != changed)
+                        continue;
+                    image im = load_image(changed);
+                    if (im.pixels != nullptr)
+                        texture_updates.push({i, im});
+                }
+            });
+        } catch (const hot_reload::error &e) {
+            logger::warn("hot reload disabled: {}", e.what());
+        }
+    }
+
+    /* swaps reloaded assets in, called between two frames */
+    auto apply_reloads = [&] {
+        vector<shader_update> shaders = shader_updates.take();
+        if (!shaders.empty()) {
+            for (shader_update &update : shaders)
+                reloaded_spirv[update.file] = std::move(update.spirv);
+            auto rebuild = [&] (gl::program &target, span<const shader_source> stages) {
+                bool affected = std::ranges::any_of(stages, [&] (const shader_source &stage) {
+                    return std::ranges::any_of(shaders, [&] (const shader_update &u) { return u.file == stage.file; });
+                });
+                if (!affected)
+                    return;
+                if (optional<gl::program> rebuilt = build_program(stages)) {
+                    target = std::move(*rebuilt);
+                    logger::info("reloaded program ({} stages)", stages.size());
+                } else {
+                    logger::warn("program rebuild failed, keeping the running version");
+                }
+            };
+            rebuild(program, main_stages);
+            rebuild(sphere_program, sphere_stages);
+            rebuild(cull_program, cull_stages);
+            rebuild(hi_z_program, hi_z_stages);
+            rebuild(shadow_program, shadow_stages);
+            rebuild(bloom_downsample_program, bloom_downsample_stages);
+            rebuild(bloom_upsample_program, bloom_upsample_stages);
+            rebuild(tonemap_program, tonemap_stages);
+            rebuild(sky_program, sky_stages);
+            rebuild(sky_convert_program, sky_convert_stages);
+            if (std::ranges::any_of(shaders, [] (const shader_update &u) { return u.file == "equirectangular_to_cube.comp.glsl"; }))
+                sky = make_sky();
+        }
+
+        vector<texture_update> updated_textures = texture_updates.take();
+        for (texture_update &update : updated_textures) {
+            textures[update.index] = gl::make_texture(update.im.pixels, update.im.x, update.im.y, update.im.channels);
+            stbi_image_free(update.im.pixels);
+            logger::info("reloaded {}", texture_paths[update.index].c_str());
+            if (update.index == texture_index_stars)
+                sky = make_sky();
         }
+        if (!updated_textures.empty())
+            gl::bind_texture_units(binding_textures, span(textures));
+    };
+    /* --- */
+
+    /* --- world streaming --- */
+    /* cells take free mesh slots (or append them) and texture slots, a cell
+     * finding no free texture slot is drawn with its colors */
+    vector<uint32_t> free_mesh_slots;
+    bool textures_changed = false;
+    optional<streaming::streamer<world_cell>> world;
+    if (world_path != nullptr) {
+        auto activate = [&] (streaming::cell_coord, world_cell &cell) {
+            auto blobs = cell.scene.meshes();
+            for (size_t i = 0; i < blobs.size(); ++i) {
+                uint32_t slot;
+                if (free_mesh_slots.empty()) {
+                    slot = meshes.size();
+                    meshes.emplace_back();
+                    clusters.emplace_back();
+                    is_patch_mesh.push_back(false);
+                } else {
+                    slot = free_mesh_slots.back();
+                    free_mesh_slots.pop_back();
+                }
+                /* straight from the file's buffer */
+                meshes[slot] = gl::make_mesh(
+                    span<const uint32_t>(cell.meshlets[i].indices),
+                    blobs[i].positions.get(),
+                    blobs[i].normals.get(),
+                    blobs[i].texcoords.get()
+                );
+                clusters[slot] = upload_meshlets(cell.meshlets[i]);
+                cell.mesh_slots.push_back(slot);
+            }
+            for (image &im : cell.images) {
+                int32_t slot = -1;
+                if (!free_texture_slots.empty()) {
+                    slot = free_texture_slots.back();
+                    free_texture_slots.pop_back();
+                    textures[slot] = gl::make_texture(im.pixels, im.x, im.y, im.channels);
+                    textures_changed = true;
+                }
+                cell.texture_slots.push_back(slot);
+            }
+            /* indices were checked on the i/o thread */
+            cell.entities = scene_storage::load(registry, cell.scene);
+            for (entt::entity e : cell.entities) {
+                if (auto *mesh = registry.try_get<mesh_component>(e)) {
+                    if (auto *state = registry.try_get<lod_component>(e))
+                        mesh->index = lod_chains[state->chain].mesh(state->level);
+                    else
+                        mesh->index = cell.mesh_slots[mesh->index];
+                }
+                auto *material = registry.try_get<material_component>(e);
+                if (material != nullptr && material->texture_index >= 0)
+                    material->texture_index = cell.texture_slots[material->texture_index];
+            }
+        };
+        auto deactivate = [&] (streaming::cell_coord, world_cell &cell) {
+            registry.destroy(cell.entities.begin(), cell.entities.end());
+            for (uint32_t slot : cell.mesh_slots) {
+                meshes[slot] = {};
+                clusters[slot] = {};
+                free_mesh_slots.push_back(slot);
+            }
+            for (int32_t slot : cell.texture_slots) {
+                if (slot < 0)
+                    continue;
+                textures[slot] = empty_texture();
+                free_texture_slots.push_back(slot);
+                textures_changed = true;
+            }
+            cell.entities.clear();
+            cell.mesh_slots.clear();
+            cell.texture_slots.clear();
+        };
+        vector<uint32_t> lod_levels;
+        for (const lod_chain &chain : lod_chains)
+            lod_levels.push_back(chain.levels());
+        auto load = [lod_levels = std::move(lod_levels)] (streaming::cell_coord, const path &file, asset_io::reader &io) {
+            return load_world_cell(file, io, lod_levels);
+        };
+        try {
+            world.emplace(world_path, streaming::config{}, load, activate, deactivate);
+        } catch (const streaming::error &e) {
+            logger::warn("world streaming disabled: {}", e.what());
+        }
+    }
+    vec3 last_camera_position = camera.position;
+    /* --- */
+
+    /* --- planet --- */
+    /* patches take mesh slots like world cells, a shown patch is an entity
+     * drawn with the earth texture */
+    const vec3 planet_center = vec3(-1.5f);
+    const mat4 planet_model = translate(mat4(1), planet_center);
+    /* by node id, entt::null = hidden */
+    vector<uint32_t> patch_slots;
+    vector<entt::entity> patch_entities;
+    optional<planet::terrain> planet_terrain;
+    auto upload_patch = [&] (uint32_t id, const planet::patch &p) {
+        uint32_t slot;
+        if (free_mesh_slots.empty()) {
+            slot = meshes.size();
+            meshes.emplace_back();
+            clusters.emplace_back();
+            is_patch_mesh.push_back(false);
+        } else {
+            slot = free_mesh_slots.back();
+            free_mesh_slots.pop_back();
+        }
+        meshes[slot] = gl::make_mesh(
+            span<const unsigned int>(planet_terrain->indices),
+            span<const vec3>(p.positions),
+            span<const vec3>(p.normals),
+            span<const vec2>(p.texcoords)
+        );
+        meshes[slot].add_attribute(3, span<const vec3>(p.morph_offsets));
+        meshes[slot].add_attribute(4, span<const vec2>(p.morph_ranges));
+        if (id >= patch_slots.size()) {
+            patch_slots.resize(id + 1);
+            patch_entities.resize(id + 1, entt::null);
+        }
+        patch_slots[id] = slot;
+    };
+    auto release_patch = [&] (uint32_t id) {
+        meshes[patch_slots[id]] = {};
+        free_mesh_slots.push_back(patch_slots[id]);
+    };
+    auto show_patch = [&] (uint32_t id) {
+        auto e = registry.create();
+        registry.emplace<model_component>(e, planet_model, transpose(inverse(planet_model)));
+        registry.emplace<mesh_component>(e, patch_slots[id]);
+        registry.emplace<material_component>(e, vec4(1), texture_index_earth_daymap);
+        registry.emplace<bounds_component>(e, planet_terrain->nodes[id].box);
+        patch_entities[id] = e;
+    };
+    auto hide_patch = [&] (uint32_t id) {
+        registry.destroy(patch_entities[id]);
+        patch_entities[id] = entt::null;
+    };
+    planet_terrain.emplace(planet::config{}, upload_patch, release_patch, show_patch, hide_patch);
+    /* --- */
+
+    /* camera movement runs at a fixed step on the simulation thread,
+     * the orientation is handed over with the input every frame. while the
+     * camera is disabled it gets no movement, so it stops like it used to and
+     * a key released meanwhile does not leave it flying */
+    simulation sim;
+    sim.camera.position = camera.position;
+    sim.camera.front = camera.front;
+    sim.start();
+
+    auto update_view = [&] {
+        sim.set_input(camera_enabled ? camera.movement_bits : decltype(camera.movement_bits)(), camera.front);
+        camera_snapshot c = sim.interpolate_camera(sim.now());
+        camera.position = c.position;
+        ub->view_matrix = camera.compute_view_matrix();
+        ub->camera_position = camera.position;
+    };
 
-        gl::clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        gl::clear_color(screen_color);
-        program.use();
+    /* --- render graph --- */
+    /* the scene is lit in hdr, bloom and tonemapping bring it to the screen.
+     * bright (bloom input) and bloom (bloom output) never live at the same
+     * time and share one texture. barriers between the passes come from the
+     * declared uses, the passes only bind and draw */
+    render_graph graph;
+    using resource = render_graph::resource;
+    resource backbuffer = graph.import_external("backbuffer");
+    graph.mark_output(backbuffer);
+    resource point_shadow_maps = graph.import_texture("point shadows", shadows.cubes);
+    resource cascade_shadow_maps = graph.import_texture("cascade shadows", shadows.cascades);
+    resource instances_resource = graph.import_buffer("instances", instances_buffer);
+    /* commands and command counts of every meshlet_clusters */
+    resource draw_commands = graph.import_external("draw commands");
+    resource hdr = graph.create_texture("hdr", {GL_RGBA16F});
+    resource depth = graph.create_texture("depth", {GL_DEPTH_COMPONENT32F});
+    /* farthest depth pyramid of the scene, built after it and tested by the
+     * next frame's meshlet cull: what comes out from behind an occluder shows
+     * up a frame late. sized to the depth on the first build after a resize */
+    ivec2 hi_z_size = ivec2(0);
+    gl::texture hi_z = gl::make_render_texture(GL_R32F, ivec2(1));
+    /* the view projection it was built with, none while there is no pyramid */
+    optional<mat4> hi_z_view_projection;
+    resource hi_z_resource = graph.import_texture("hi-z", hi_z);
+    resource bright = graph.create_texture("bright", {GL_RGBA16F, 2});
+    resource bloom = graph.create_texture("bloom", {GL_RGBA16F, 2});
+    constexpr int bloom_levels = 4;
+    array<resource, bloom_levels> bloom_chain;
+    for (int i = 0; i < bloom_levels; ++i)
+        bloom_chain[i] = graph.create_texture(std::format("bloom {}", i + 1), {GL_RGBA16F, 4 << i});
 
+    gl::framebuffer scene_target;
+    commands::command_list scene_commands;
+    commands::state_cache<commands::gl_api> scene_state;
+    gl::vertex_array fullscreen;
+    size_t triangles = 0;
+
+    graph.add_pass("shadows", {}, {
+        {point_shadow_maps, usage::attachment},
+        {cascade_shadow_maps, usage::attachment}
+    }, [&] (render_graph &) {
+        shadows.update(
+            shadow_program,
+            span(meshes),
+            casters,
+            light_positions,
+            vec4(sun_direction, gui.sun_intensity),
+            ub->view_matrix,
+            radians(45.0f),
+            float(framebuffer_size.x) / framebuffer_size.y,
+            0.1f,
+            framebuffer_size
+        );
+    }).side_effects = true; /* cached maps */
+
+    /* switching this pass off draws every meshlet, switching hi-z off only
+     * stops the occlusion test */
+    graph.add_pass("meshlet cull", {
+        {instances_resource, usage::storage},
+        {hi_z_resource, usage::sampled}
+    }, {
+        {draw_commands, usage::storage}
+    }, [&] (render_graph &g) {
+        if (!g.enabled("hi-z"))
+            hi_z_view_projection.reset();
+        cull_program.use();
+        cull_program.uniform(0, hi_z_view_projection.value_or(mat4(1)));
+        cull_program.uniform(1, hi_z_view_projection.has_value());
+        gl::bind_texture_unit(texture_unit_hi_z, hi_z);
         for (size_t i = 0; i < meshes.size(); ++i) {
-            if (instance_groups[i].size() == 0)
+            if (instance_counts[i] == 0 || clusters[i].count == 0)
                 continue;
-            static_assert(sizeof(instance_data) == 256);
+            meshlet_clusters &c = clusters[i];
+            c.reserve(instance_counts[i]);
             gl::bind_shader_storage_buffer(
                 binding_instances_data,
                 instances_buffer,
                 instance_group_offsets[i],
-                instance_groups[i].size() * sizeof(instance_data)
+                instance_counts[i] * sizeof(instance_data)
             );
-            meshes[i].draw(gl::DrawMode::Triangles, instance_groups[i].size());
+            gl::bind_shader_storage_buffer(binding_meshlets, c.bounds);
+            gl::bind_shader_storage_buffer(binding_draw_commands, c.commands);
+            gl::bind_shader_storage_buffer(binding_draw_command_count, c.command_count);
+            gl::clear_buffer(c.command_count);
+            gl::dispatch_compute((c.count + 63) / 64, instance_counts[i]);
+        }
+    });
+
+    graph.add_pass("scene", {
+        {instances_resource, usage::storage},
+        {draw_commands, usage::indirect},
+        {point_shadow_maps, usage::sampled},
+        {cascade_shadow_maps, usage::sampled}
+    }, {
+        {hdr, usage::attachment},
+        {depth, usage::attachment}
+    }, [&] (render_graph &g) {
+        scene_target.attach_color(g.texture(hdr));
+        scene_target.attach_depth(g.texture(depth));
+        scene_target.bind();
+        gl::viewport(g.size(hdr));
+        scene_target.clear_color(screen_color);
+        scene_target.clear_depth();
+
+        auto is_culled = [&] (size_t i) {
+            return g.enabled("meshlet cull") && clusters[i].count > 0;
+        };
+        triangles = 0;
+        scene_commands.clear();
+        for (size_t i = 0; i < meshes.size(); ++i) {
+            if (instance_counts[i] == 0)
+                continue;
+            commands::draw_packet packet;
+            if (is_patch_mesh[i]) {
+                /* triangles are generated on the gpu, not counted */
+                packet = commands::make_draw(sphere_program, meshes[i], gl::DrawMode::Patches, instance_counts[i]);
+            } else if (is_culled(i)) {
+                /* one command per visible (meshlet, instance), triangles are counted before culling */
+                packet = commands::make_draw_indirect_count(
+                    program,
+                    meshes[i],
+                    gl::DrawMode::Triangles,
+                    clusters[i].commands,
+                    clusters[i].command_count,
+                    clusters[i].count * instance_counts[i]
+                );
+                triangles += meshes[i].count / 3 * instance_counts[i];
+            } else {
+                packet = commands::make_draw(program, meshes[i], gl::DrawMode::Triangles, instance_counts[i]);
+                triangles += meshes[i].count / 3 * instance_counts[i];
+            }
+            static_assert(sizeof(instance_data) == 256);
+            packet.storage_binding = binding_instances_data;
+            packet.storage_buffer = instances_buffer.name;
+            packet.storage_offset = instance_group_offsets[i];
+            packet.storage_size = instance_counts[i] * sizeof(instance_data);
+            scene_commands.add(packet);
+        }
+        scene_commands.sort();
+        scene_state.invalidate();
+        commands::submit(span<const commands::draw_packet>(scene_commands.packets), scene_state);
+    });
+
+    /* the barrier after each level orders the next level's and the next
+     * frame's fetches, the graph only orders within a frame */
+    graph.add_pass("hi-z", {{depth, usage::sampled}}, {{hi_z_resource, usage::image}}, [&] (render_graph &g) {
+        ivec2 size = g.size(depth);
+        GLsizei levels = std::bit_width(unsigned(std::max(size.x, size.y)));
+        if (size != hi_z_size) {
+            hi_z = gl::make_render_texture(GL_R32F, size, levels);
+            hi_z_size = size;
+        }
+        hi_z_program.use();
+        for (GLsizei level = 0; level < levels; ++level) {
+            hi_z_program.uniform(0, std::max(level - 1, 0));
+            gl::bind_texture_unit(texture_unit_post_source, level == 0 ? g.texture(depth) : hi_z);
+            gl::bind_image_texture(image_unit_post_destination, hi_z, level, GL_WRITE_ONLY, GL_R32F);
+            ivec2 level_size = max(size >> level, ivec2(1));
+            gl::dispatch_compute((level_size.x + 7) / 8, (level_size.y + 7) / 8);
+            gl::memory_barrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+        }
+        hi_z_view_projection = ub->projection_matrix * ub->view_matrix;
+    }).side_effects = true; /* read by the next frame */
+
+    /* behind the opaques: at the far plane, where depth is still cleared */
+    graph.add_pass("sky", {
+        {hdr, usage::attachment},
+        {depth, usage::attachment}
+    }, {
+        {hdr, usage::attachment}
+    }, [&] (render_graph &g) {
+        scene_target.attach_color(g.texture(hdr));
+        scene_target.attach_depth(g.texture(depth));
+        scene_target.bind();
+        gl::viewport(g.size(hdr));
+        gl::depth_func(GL_LEQUAL);
+        gl::disable(GL_CULL_FACE);
+        sky_program.use();
+        gl::bind_texture_unit(texture_unit_sky, sky);
+        fullscreen.draw_arrays(gl::DrawMode::Triangles, 0, 3);
+        gl::enable(GL_CULL_FACE);
+        gl::depth_func(GL_LESS);
+    });
+
+    /* --- bloom: compute chain of ever smaller levels and back up --- */
+    auto bloom_downsample = [&] (render_graph &g, resource from, resource to, bool prefilter) {
+        bloom_downsample_program.use();
+        bloom_downsample_program.uniform(0, prefilter);
+        bloom_downsample_program.uniform(1, gui.bloom_threshold);
+        gl::bind_texture_unit(texture_unit_post_source, g.texture(from));
+        gl::bind_image_texture(image_unit_post_destination, g.texture(to), 0, GL_WRITE_ONLY, GL_RGBA16F);
+        ivec2 size = g.size(to);
+        gl::dispatch_compute((size.x + 7) / 8, (size.y + 7) / 8);
+    };
+    /* accumulate: add to the level's own downsample instead of replacing it */
+    auto bloom_upsample = [&] (render_graph &g, resource from, resource to, bool accumulate) {
+        bloom_upsample_program.use();
+        bloom_upsample_program.uniform(0, accumulate);
+        bloom_upsample_program.uniform(1, gui.bloom_radius);
+        gl::bind_texture_unit(texture_unit_post_source, g.texture(from));
+        gl::bind_image_texture(image_unit_post_destination, g.texture(to), 0, GL_READ_WRITE, GL_RGBA16F);
+        ivec2 size = g.size(to);
+        gl::dispatch_compute((size.x + 7) / 8, (size.y + 7) / 8);
+    };
+
+    graph.add_pass("bloom prefilter", {{hdr, usage::sampled}}, {{bright, usage::image}}, [&] (render_graph &g) {
+        bloom_downsample(g, hdr, bright, true);
+    });
+    for (int i = 0; i < bloom_levels; ++i) {
+        resource from = i == 0 ? bright : bloom_chain[i - 1];
+        graph.add_pass(std::format("bloom down {}", i + 1), {{from, usage::sampled}}, {{bloom_chain[i], usage::image}}, [&, from, to = bloom_chain[i]] (render_graph &g) {
+            bloom_downsample(g, from, to, false);
+        });
+    }
+    for (int i = bloom_levels - 1; i > 0; --i) {
+        resource from = bloom_chain[i], to = bloom_chain[i - 1];
+        graph.add_pass(std::format("bloom up {}", i), {{from, usage::sampled}, {to, usage::image}}, {{to, usage::image}}, [&, from, to] (render_graph &g) {
+            bloom_upsample(g, from, to, true);
+        });
+    }
+    graph.add_pass("bloom final", {{bloom_chain[0], usage::sampled}}, {{bloom, usage::image}}, [&] (render_graph &g) {
+        bloom_upsample(g, bloom_chain[0], bloom, false);
+    });
+
+    graph.add_pass("tonemap", {{hdr, usage::image}, {bloom, usage::sampled}}, {{backbuffer, usage::attachment}}, [&] (render_graph &g) {
+        gl::bind_default_framebuffer();
+        gl::viewport(framebuffer_size);
+        gl::disable(GL_DEPTH_TEST);
+        gl::disable(GL_CULL_FACE);
+        tonemap_program.use();
+        tonemap_program.uniform(0, gui.exposure);
+        /* stale (aliased) bloom when its passes are off */
+        tonemap_program.uniform(1, g.enabled("bloom final") ? gui.bloom_strength : 0.f);
+        gl::bind_texture_unit(texture_unit_post_source, g.texture(bloom));
+        gl::bind_image_texture(image_unit_post_scene, g.texture(hdr), 0, GL_READ_ONLY, GL_RGBA16F);
+        fullscreen.draw_arrays(gl::DrawMode::Triangles, 0, 3);
+        gl::enable(GL_CULL_FACE);
+        gl::enable(GL_DEPTH_TEST);
+    });
+    /* --- */
+
+    frame_pacer pacer;
+    double dt = 0;
+    double last_frame_time = 0;
+    glfw::set_time(0);
+    while (!window.should_close()) {
+        pacer.begin_frame(gui.vsync);
+        apply_reloads();
+        double now = glfw::get_time();
+        dt = now - last_frame_time;
+        last_frame_time = now;
+        update_view();
+
+        if (pacer.latch())
+            update_view();
+
+        if (world) {
+            vec3 velocity = dt > 0 ? (camera.position - last_camera_position) / float(dt) : vec3(0);
+            last_camera_position = camera.position;
+            world->update(camera.position, velocity);
+            if (textures_changed) {
+                gl::bind_texture_units(binding_textures, span(textures));
+                textures_changed = false;
+            }
+        }
+        planet_terrain->update(camera.position - planet_center);
+
+        /* --- spatial queries --- */
+        spatial.update();
+        const mat4 view_projection = ub->projection_matrix * ub->view_matrix;
+        visible.clear();
+        spatial.query(make_frustum(view_projection), visible);
+        if (pick_requested) {
+            pick_requested = false;
+            vec2 ndc = vec2(0);
+            if (!camera_enabled) {
+                dvec2 cursor = window.get_cursor_position();
+                ndc = vec2(2 * cursor.x / framebuffer_size.x - 1, 1 - 2 * cursor.y / framebuffer_size.y);
+            }
+            mat4 unproject = inverse(view_projection);
+            vec4 near = unproject * vec4(ndc, -1, 1);
+            vec4 far = unproject * vec4(ndc, 1, 1);
+            vec3 origin = vec3(near) / near.w;
+            if (auto hit = spatial.pick({origin, normalize(vec3(far) / far.w - origin)}))
+                logger::info("picked entity {} at {:.2f}", entt::to_integral(hit->first), hit->second);
+            else
+                logger::info("picked nothing");
         }
+        /* --- */
 
-        gui.new_frame(1 / dt, glm::value_ptr(screen_color), &ub->ambient, &ub->diffuse, &ub->specular, &ub->specular_power);
+        /* --- lod --- */
+        /* entities in view and those without bounds, all of them when
+         * tessellation switched the meshes */
+        lod.set_projection(radians(45.0f), framebuffer_size.y);
+        auto select_lod = [&] (const model_component &model, mesh_component &mesh, lod_component &state) {
+            const lod_chain &chain = lod_chains[state.chain];
+            state.level = lod.select(chain, state.level, model.model_matrix, camera.position);
+            mesh.index = gui.tessellation ? chain.patch_mesh : chain.mesh(state.level);
+        };
+        if (gui.tessellation != lod_tessellation) {
+            lod_tessellation = gui.tessellation;
+            for (auto [entity, model, mesh, state] : registry.view<model_component, mesh_component, lod_component>().each())
+                select_lod(model, mesh, state);
+        } else {
+            for (entt::entity e : visible) {
+                auto *mesh = registry.try_get<mesh_component>(e);
+                auto *state = registry.try_get<lod_component>(e);
+                if (mesh != nullptr && state != nullptr)
+                    select_lod(registry.get<model_component>(e), *mesh, *state);
+            }
+            auto unbounded = registry.view<model_component, mesh_component, lod_component>(entt::exclude<bounds_component>);
+            for (auto [entity, model, mesh, state] : unbounded.each())
+                select_lod(model, mesh, state);
+        }
+        extract_render_snapshot(registry, snapshot, meshes.size());
+        if (instances.size() > instances_capacity) {
+            instances_capacity = std::bit_ceil(instances.size());
+            instances_buffer = gl::store(static_cast<const instance_data *>(nullptr), instances_capacity * sizeof(instance_data));
+            gl::bind_shader_storage_buffer(binding_instances_data, instances_buffer);
+        }
+        instances_buffer.update(span(instances));
+
+        /* --- shadow casters --- */
+        casters.clear();
+        for (auto [entity, model, mesh, caster] : registry.view<model_component, mesh_component, shadow_caster_component>().each()) {
+            uint32_t caster_mesh = mesh.index;
+            if (auto *state = registry.try_get<lod_component>(entity)) {
+                const lod_chain &chain = lod_chains[state->chain];
+                caster_mesh = chain.mesh(std::min(shadow_lod_level, chain.levels() - 1));
+            }
+            const mat4 &M = model.model_matrix;
+            float scale = std::max({length(vec3(M[0])), length(vec3(M[1])), length(vec3(M[2]))});
+            casters.push_back({caster_mesh, M, scale * std::sqrt(3.f), caster.dynamic});
+        }
+
+        graph.resize(framebuffer_size);
+        scene_state.stats = {};
+        graph.execute();
+
+        gui.new_frame(1 / dt, &pacer, &lod, triangles, &shadows, &graph, &scene_state.stats, world ? &world->stats : nullptr, world ? &world->settings : nullptr, &spatial.stats, visible.size(), &frame_memory.stats, &planet_terrain->stats, &planet_terrain->settings, &ub->tess_edge_pixels, glm::value_ptr(screen_color), &ub->ambient, &ub->diffuse, &ub->specular, &ub->specular_power);
         gui.render();
 
+        if (timing && timing->record(glfw::get_time() - now, dt, graph)) {
+            timing->write(graph);
+            timing.reset();
+            window.close();
+        }
         window.swap_buffers();
+        pacer.end_frame();
+        frame_memory.end_frame();
     }
 
+    sim.stop();
     return 0;
 }
@@ -9,12 +9,28 @@ layout (std140, binding = 0) uniform _0 {
     float diffuse;
     float specular;
     int   specular_power;
+    float tess_edge_pixels;
+    float viewport_height;
 };
 
 layout (std430, binding = 2) buffer _2 {
     vec4 light_positions[];
 };
 
+layout (std140, binding = 7) uniform _7 {
+    mat4  cascade_matrices[4];
+    vec4  cascade_splits;
+    vec4  sun;
+    int   point_shadow_count;
+    int   cascade_count;
+    float point_near;
+    float point_far;
+    float shadow_bias;
+};
+
+layout (binding = 1) uniform samplerCubeArrayShadow point_shadows;
+layout (binding = 2) uniform sampler2DArrayShadow cascade_shadows;
+
 layout (constant_id = 0) const uint    texture_count = 32U;
 layout (binding = 3) uniform sampler2D textures[texture_count];
 
@@ -26,6 +42,30 @@ layout (location = 4) in flat  int instance_texture_index;
 
 layout (location = 0) out vec4 fragment_color;
 
+/* 1 = lit, 0 = in shadow */
+float point_shadow(int light, vec3 position) {
+    vec3 d = position - light_positions[light].xyz;
+    /* depth the cube face's perspective projection wrote for this distance */
+    float z = max(abs(d.x), max(abs(d.y), abs(d.z)));
+    float n = point_near, f = point_far;
+    if (z >= f)
+        return 1.0;
+    float depth = ((f + n) / (f - n) - 2.0 * f * n / ((f - n) * z)) * 0.5 + 0.5;
+    return texture(point_shadows, vec4(d, light), depth - shadow_bias);
+}
+
+float sun_shadow(vec3 position) {
+    float depth = -(view_matrix * vec4(position, 1.0)).z;
+    if (cascade_count == 0 || depth > cascade_splits[cascade_count - 1])
+        return 1.0;
+    int c = 0;
+    while (c < cascade_count - 1 && depth > cascade_splits[c])
+        ++c;
+    vec4 p = cascade_matrices[c] * vec4(position, 1.0);
+    vec3 uvz = p.xyz / p.w * 0.5 + 0.5;
+    return texture(cascade_shadows, vec4(uvz.xy, c, uvz.z - shadow_bias));
+}
+
 vec4 get_fragment_color() {
     vec4 base_color;
     if (instance_texture_index < 0) {
@@ -45,7 +85,12 @@ vec4 get_fragment_color() {
         float diff = max(dot(normal, light_dir), 0.0f) * diffuse;
         vec3 reflect_dir = reflect(-light_dir, normal);
         float spec = pow(max(dot(view_dir, reflect_dir), 0.0f), specular_power) * specular;
-        color.rgb += (ambient + diff + spec) * base_color.rgb;
+        float shadow = i < point_shadow_count ? point_shadow(i, fragment_position) : 1.0;
+        color.rgb += (ambient + shadow * (diff + spec)) * base_color.rgb;
+    }
+    if (sun.w > 0.0) {
+        float diff = max(dot(normal, sun.xyz), 0.0f) * diffuse * sun.w;
+        color.rgb += sun_shadow(fragment_position) * diff * base_color.rgb;
     }
     return color;
 }
@@ -17,6 +17,8 @@ layout (std140, binding = 0) uniform _0 {
     float diffuse;
     float specular;
     int   specular_power;
+    float tess_edge_pixels;
+    float viewport_height;
 };
 
 layout (std430, binding = 1) buffer _1 {
@@ -26,6 +28,10 @@ layout (std430, binding = 1) buffer _1 {
 layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec2 texcoords;
+/* geomorphing of planet patches: towards morph_offset between the camera
+ * distances of morph_range. other meshes leave them disabled, (0, 0) */
+layout (location = 3) in vec3 morph_offset;
+layout (location = 4) in vec2 morph_range;
 
 layout (location = 0) out vec3 fragment_position;
 layout (location = 1) out vec3 fragment_normal;
@@ -34,8 +40,13 @@ layout (location = 3) out flat vec4 instance_color;
 layout (location = 4) out flat  int instance_texture_index;
 
 vec4 get_position() {
-    instance_data data = instances[gl_InstanceID];
+    /* base instance is set by the indirect draws of the meshlet path, 0 otherwise */
+    instance_data data = instances[gl_BaseInstance + gl_InstanceID];
     vec4 world_position = data.model * vec4(position, 1.0);
+    if (morph_range.y > morph_range.x) {
+        float morph = clamp((distance(camera_position, world_position.xyz) - morph_range.x) / (morph_range.y - morph_range.x), 0.0, 1.0);
+        world_position = data.model * vec4(position + morph * morph_offset, 1.0);
+    }
 
     fragment_position = world_position.xyz;
     fragment_normal = mat3(data.normal_matrix) * normal;
@@ -0,0 +1,247 @@
+export module memory;
+
+import std;
+import jobs;
+
+using std::atomic;
+using std::byte;
+using std::max;
+using std::size_t;
+using std::uint64_t;
+using std::uintptr_t;
+using std::unique_ptr;
+using std::vector;
+using std::memory_order_acquire;
+using std::memory_order_relaxed;
+using std::memory_order_release;
+using std::pmr::memory_resource;
+
+/*
+ * allocators for transient data, all of them std::pmr::memory_resources so
+ * std::pmr containers take them as is:
+ * - arena: bump allocation from blocks, nothing is freed before reset().
+ *   the frame arenas, one per scheduler worker, are reset together once a
+ *   frame is done: a frame's lists cost a pointer bump and stop reaching the
+ *   heap once the blocks have grown to a frame's worth
+ * - pool: records up to a fixed size on a free list, one pool per thread.
+ *   records go back to the pool of the thread that allocated them
+ * - heap counts the global operator new / delete, which the viewer replaces
+ *   to feed it. frame_arenas::end_frame() turns it into per frame numbers
+ */
+
+export namespace memory {
+    struct heap_counters {
+        atomic<uint64_t> allocations = 0;
+        atomic<uint64_t> frees = 0;
+        atomic<uint64_t> bytes = 0;
+    };
+
+    heap_counters heap;
+
+    void count_allocation(size_t bytes) {
+        heap.allocations.fetch_add(1, memory_order_relaxed);
+        heap.bytes.fetch_add(bytes, memory_order_relaxed);
+    }
+
+    void count_free() {
+        heap.frees.fetch_add(1, memory_order_relaxed);
+    }
+
+    struct arena: memory_resource {
+        static constexpr size_t default_block_size = size_t(64) << 10;
+
+        struct block {
+            unique_ptr<byte[]> storage;
+            size_t size;
+        };
+
+        size_t block_size;
+        vector<block> blocks;
+        /* allocating from blocks[current] at offset */
+        size_t current = 0;
+        size_t offset = 0;
+        /* since the last reset, alignment padding included */
+        size_t used = 0;
+        size_t high_water = 0;
+
+        explicit arena(size_t block_size = default_block_size)
+            : block_size(block_size) {}
+
+        arena(const arena &) = delete;
+        arena & operator=(const arena &) = delete;
+
+        /* invalidates everything allocated. blocks are kept, several are
+         * merged into one that holds them all, so a frame like the last one
+         * fits in a single block */
+        void reset() {
+            high_water = max(high_water, used);
+            if (blocks.size() > 1) {
+                size_t total = capacity();
+                blocks.clear();
+                blocks.push_back({std::make_unique_for_overwrite<byte[]>(total), total});
+            }
+            current = 0;
+            offset = 0;
+            used = 0;
+        }
+
+        size_t capacity() const {
+            size_t total = 0;
+            for (const block &b : blocks)
+                total += b.size;
+            return total;
+        }
+
+    protected:
+        void *do_allocate(size_t bytes, size_t alignment) override {
+            for (; current < blocks.size(); ++current, offset = 0) {
+                block &b = blocks[current];
+                uintptr_t base = reinterpret_cast<uintptr_t>(b.storage.get());
+                size_t start = ((base + offset + alignment - 1) & ~uintptr_t(alignment - 1)) - base;
+                if (start + bytes <= b.size) {
+                    used += start + bytes - offset;
+                    offset = start + bytes;
+                    return b.storage.get() + start;
+                }
+            }
+            size_t size = max(block_size, bytes + alignment);
+            blocks.push_back({std::make_unique_for_overwrite<byte[]>(size), size});
+            current = blocks.size() - 1;
+            offset = 0;
+            return do_allocate(bytes, alignment);
+        }
+
+        void do_deallocate(void *, size_t, size_t) override {}
+
+        bool do_is_equal(const memory_resource &other) const noexcept override {
+            return this == &other;
+        }
+    };
+
+    /* what a frame took from the heap and the frame arenas */
+    struct frame_stats {
+        uint64_t allocations = 0;
+        uint64_t bytes = 0;
+        size_t arena_used = 0;
+        size_t arena_capacity = 0;
+        /* in a row, up to the last one */
+        uint64_t frames_without_allocations = 0;
+    };
+
+    struct frame_arenas;
+
+    /* the frame arenas memory::frame() hands out, nullptr = none */
+    atomic<frame_arenas *> active_frame = nullptr;
+
+    /* one arena per worker of the scheduler. jobs of a frame take from their
+     * worker's arena, the main thread calls end_frame() once no job runs and
+     * none of the frame's memory is held anymore */
+    struct frame_arenas {
+        vector<unique_ptr<arena>> arenas;
+        frame_stats stats;
+        uint64_t allocations_before = heap.allocations.load(memory_order_relaxed);
+        uint64_t bytes_before = heap.bytes.load(memory_order_relaxed);
+
+        explicit frame_arenas(size_t workers) {
+            for (size_t i = 0; i < max<size_t>(workers, 1); ++i)
+                arenas.push_back(std::make_unique<arena>());
+            frame_arenas *expected = nullptr;
+            active_frame.compare_exchange_strong(expected, this, memory_order_release);
+        }
+
+        ~frame_arenas() {
+            frame_arenas *self = this;
+            active_frame.compare_exchange_strong(self, nullptr, memory_order_release);
+        }
+
+        frame_arenas(const frame_arenas &) = delete;
+        frame_arenas & operator=(const frame_arenas &) = delete;
+
+        void end_frame() {
+            uint64_t allocations = heap.allocations.load(memory_order_relaxed);
+            uint64_t bytes = heap.bytes.load(memory_order_relaxed);
+            stats.allocations = allocations - allocations_before;
+            stats.bytes = bytes - bytes_before;
+            stats.frames_without_allocations = stats.allocations == 0 ? stats.frames_without_allocations + 1 : 0;
+            stats.arena_used = 0;
+            stats.arena_capacity = 0;
+            for (auto &a : arenas) {
+                stats.arena_used += a->used;
+                stats.arena_capacity += a->capacity();
+                a->reset();
+            }
+            /* merging blocks above is growth, not the next frame's */
+            allocations_before = heap.allocations.load(memory_order_relaxed);
+            bytes_before = heap.bytes.load(memory_order_relaxed);
+        }
+    };
+
+    /* the calling worker's frame arena. the heap for threads that are not
+     * workers and when there are no frame arenas (tools, benchmarks) */
+    memory_resource &frame() {
+        frame_arenas *f = active_frame.load(memory_order_acquire);
+        int index = jobs::worker_index;
+        if (f == nullptr || index < 0 || size_t(index) >= f->arenas.size())
+            return *std::pmr::new_delete_resource();
+        return *f->arenas[index];
+    }
+
+    /* records up to record_size bytes, carved from blocks of
+     * records_per_block and recycled through a free list. bigger or over
+     * aligned requests go to the heap. not thread safe, see local_pool() */
+    struct pool: memory_resource {
+        struct free_record {
+            free_record *next;
+        };
+
+        size_t record_size;
+        size_t records_per_block;
+        vector<unique_ptr<byte[]>> blocks;
+        free_record *free_list = nullptr;
+        size_t live = 0;
+
+        explicit pool(size_t record_size, size_t records_per_block = 256)
+            : record_size((max(record_size, sizeof(free_record)) + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1))
+            , records_per_block(records_per_block) {}
+
+        pool(const pool &) = delete;
+        pool & operator=(const pool &) = delete;
+
+    protected:
+        void *do_allocate(size_t bytes, size_t alignment) override {
+            if (bytes > record_size || alignment > alignof(std::max_align_t))
+                return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+            if (free_list == nullptr) {
+                /* operator new[] of byte is aligned to max_align_t */
+                auto &b = blocks.emplace_back(std::make_unique_for_overwrite<byte[]>(record_size * records_per_block));
+                for (size_t i = records_per_block; i-- > 0;)
+                    free_list = new (b.get() + i * record_size) free_record{free_list};
+            }
+            free_record *r = free_list;
+            free_list = r->next;
+            live++;
+            return r;
+        }
+
+        void do_deallocate(void *p, size_t bytes, size_t alignment) override {
+            if (bytes > record_size || alignment > alignof(std::max_align_t)) {
+                std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+                return;
+            }
+            free_list = new (p) free_record{free_list};
+            live--;
+        }
+
+        bool do_is_equal(const memory_resource &other) const noexcept override {
+            return this == &other;
+        }
+    };
+
+    /* the calling thread's pool of records up to Size bytes. records must be
+     * freed on the thread that allocated them, before it exits */
+    template<size_t Size>
+    pool &local_pool() {
+        thread_local pool p(Size);
+        return p;
+    }
+}
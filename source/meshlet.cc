@@ -0,0 +1,218 @@
+export module meshlet;
+
+import std;
+import glm;
+import gl;
+
+using std::array;
+using std::size_t;
+using std::span;
+using std::uint8_t;
+using std::uint32_t;
+using std::vector;
+using namespace glm;
+
+/*
+ * meshlets: the triangles of a mesh are split into small clusters
+ * (at most max_vertices unique vertices and max_triangles triangles), every
+ * cluster gets a bounding sphere and a normal cone so that it can be culled
+ * on its own by meshlet_cull.comp.glsl.
+ * the index buffer is reordered cluster by cluster, a cluster is a range of it.
+ */
+
+export constexpr size_t max_meshlet_vertices = 64;
+export constexpr size_t max_meshlet_triangles = 124;
+
+/* binding_meshlets : std430 ssbo, array of */
+export struct alignas(vec4) meshlet_bounds {
+    vec4 sphere;        /* center, radius */
+    vec4 cone;          /* axis, cutoff (> 1 = never backfacing) */
+    uint32_t first_index;
+    uint32_t index_count;
+    uint32_t _[2];
+};
+
+static_assert(sizeof(meshlet_bounds) == 48);
+
+/* DrawElementsIndirectCommand, written by the culling pass */
+export struct draw_elements_command {
+    uint32_t count;
+    uint32_t instance_count;
+    uint32_t first_index;
+    int32_t  base_vertex;
+    uint32_t base_instance;
+};
+
+export struct meshlet_mesh {
+    vector<uint32_t> indices;
+    vector<meshlet_bounds> meshlets;
+};
+
+meshlet_bounds compute_bounds(
+    span<const uint32_t> triangles,
+    span<const uint32_t> vertices,
+    span<const vec3> positions
+) {
+    vec3 lo = positions[vertices[0]], hi = lo;
+    for (uint32_t v : vertices) {
+        lo = min(lo, positions[v]);
+        hi = max(hi, positions[v]);
+    }
+    vec3 center = (lo + hi) / 2.f;
+    float radius = 0;
+    for (uint32_t v : vertices)
+        radius = max(radius, distance(center, positions[v]));
+
+    /* normals from the winding, counter clockwise = front as gl culls */
+    vec3 axis = vec3(0);
+    vector<vec3> normals;
+    normals.reserve(triangles.size() / 3);
+    for (size_t t = 0; t < triangles.size(); t += 3) {
+        vec3 a = positions[triangles[t]], b = positions[triangles[t + 1]], c = positions[triangles[t + 2]];
+        vec3 n = cross(b - a, c - a);
+        float l = length(n);
+        if (l < 1e-12f)
+            continue;
+        normals.push_back(n / l);
+        axis += n / l;
+    }
+
+    float cutoff = 2.f;
+    if (length(axis) > 1e-6f) {
+        axis = normalize(axis);
+        float min_dot = 1.f;
+        for (vec3 n : normals)
+            min_dot = min(min_dot, dot(axis, n));
+        /* all normals within 90 degrees of the axis, the cone can be tested */
+        if (min_dot > 0.f)
+            cutoff = sqrt(1.f - min_dot * min_dot);
+    }
+
+    return {
+        .sphere = vec4(center, radius),
+        .cone = vec4(axis, cutoff)
+    };
+}
+
+/* greedy clustering: the next triangle is the one adjacent to the current
+ * meshlet that adds the fewest new vertices, a meshlet is closed once
+ * nothing fits anymore */
+export meshlet_mesh build_meshlets(span<const uint32_t> indices, span<const vec3> positions) {
+    size_t triangle_count = indices.size() / 3;
+
+    /* vertex -> triangles */
+    vector<uint32_t> offsets(positions.size() + 1, 0);
+    for (uint32_t i : indices)
+        offsets[i + 1]++;
+    for (size_t i = 1; i < offsets.size(); ++i)
+        offsets[i] += offsets[i - 1];
+    vector<uint32_t> adjacency(indices.size());
+    {
+        vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+        for (size_t t = 0; t < indices.size(); ++t)
+            adjacency[cursor[indices[t]]++] = t / 3;
+    }
+
+    constexpr uint8_t unused = 0xff;
+    vector<uint8_t> local(positions.size(), unused);
+    vector<bool> emitted(triangle_count, false);
+    vector<uint32_t> vertices;
+    vertices.reserve(max_meshlet_vertices);
+
+    meshlet_mesh out;
+    out.indices.reserve(indices.size());
+    size_t first_index = 0;
+    size_t scan = 0;
+
+    auto new_vertices = [&] (size_t t) {
+        int n = 0;
+        for (int k = 0; k < 3; ++k)
+            n += local[indices[t * 3 + k]] == unused;
+        return n;
+    };
+
+    auto finish = [&] {
+        size_t count = out.indices.size() - first_index;
+        if (count == 0)
+            return;
+        meshlet_bounds b = compute_bounds(
+            span(out.indices).subspan(first_index, count), vertices, positions);
+        b.first_index = first_index;
+        b.index_count = count;
+        out.meshlets.push_back(b);
+        for (uint32_t v : vertices)
+            local[v] = unused;
+        vertices.clear();
+        first_index = out.indices.size();
+    };
+
+    while (true) {
+        long best = -1;
+        int best_new = 4;
+        for (uint32_t v : vertices) {
+            for (uint32_t a = offsets[v]; a < offsets[v + 1]; ++a) {
+                uint32_t t = adjacency[a];
+                if (emitted[t])
+                    continue;
+                int n = new_vertices(t);
+                if (n < best_new) {
+                    best = t;
+                    best_new = n;
+                }
+            }
+        }
+        if (best < 0) {
+            while (scan < triangle_count && emitted[scan])
+                ++scan;
+            if (scan == triangle_count)
+                break;
+            best = scan;
+            best_new = new_vertices(scan);
+        }
+
+        size_t triangles = (out.indices.size() - first_index) / 3;
+        if (vertices.size() + best_new > max_meshlet_vertices || triangles + 1 > max_meshlet_triangles) {
+            finish();
+            continue;
+        }
+
+        for (int k = 0; k < 3; ++k) {
+            uint32_t v = indices[best * 3 + k];
+            if (local[v] == unused) {
+                local[v] = vertices.size();
+                vertices.push_back(v);
+            }
+            out.indices.push_back(v);
+        }
+        emitted[best] = true;
+    }
+    finish();
+    return out;
+}
+
+/* gpu side of the meshlets of one mesh plus the output of the culling pass */
+export struct meshlet_clusters {
+    gl::buffer bounds;
+    gl::buffer commands;
+    gl::buffer command_count;
+    uint32_t count = 0;
+    uint32_t capacity = 0;
+
+    /* room for one command per meshlet and instance */
+    void reserve(uint32_t instances) {
+        uint32_t needed = count * instances;
+        if (needed <= capacity)
+            return;
+        commands = gl::malloc(needed * sizeof(draw_elements_command), 0);
+        capacity = needed;
+    }
+};
+
+export meshlet_clusters upload_meshlets(const meshlet_mesh &m) {
+    meshlet_clusters c;
+    c.count = m.meshlets.size();
+    if (c.count > 0)
+        c.bounds.store(span(m.meshlets));
+    c.command_count.store(static_cast<const uint32_t *>(nullptr), sizeof(uint32_t));
+    return c;
+}
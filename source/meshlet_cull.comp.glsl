@@ -0,0 +1,152 @@
+#version 460 core
+
+/* one invocation per (meshlet, instance): x = meshlet, workgroup y = instance.
+ * meshlets surviving the frustum, normal cone and hi-z tests append a draw
+ * command */
+layout (local_size_x = 64) in;
+
+struct instance_data {
+    mat4 normal_matrix;
+    mat4 model;
+    vec4 color;
+    int  texture_index;
+    int  _[27];
+};
+
+layout (std140, binding = 0) uniform _0 {
+    mat4 projection_matrix;
+    mat4 view_matrix;
+    vec3 camera_position;
+    int   enable_light;
+    float ambient;
+    float diffuse;
+    float specular;
+    int   specular_power;
+    float tess_edge_pixels;
+    float viewport_height;
+};
+
+layout (std430, binding = 1) readonly buffer _1 {
+    instance_data instances[];
+};
+
+struct meshlet {
+    vec4 sphere;
+    vec4 cone;
+    uint first_index;
+    uint index_count;
+    uint _[2];
+};
+
+layout (std430, binding = 4) readonly buffer _4 {
+    meshlet meshlets[];
+};
+
+struct draw_command {
+    uint count;
+    uint instance_count;
+    uint first_index;
+    int  base_vertex;
+    uint base_instance;
+};
+
+layout (std430, binding = 5) writeonly buffer _5 {
+    draw_command commands[];
+};
+
+layout (std430, binding = 6) buffer _6 {
+    uint command_count;
+};
+
+/* farthest depth pyramid of the frame before, see hi_z.comp.glsl */
+layout (binding = 0) uniform sampler2D hi_z;
+
+/* the view projection hi_z was built with */
+layout (location = 0) uniform mat4 hi_z_view_projection;
+layout (location = 1) uniform bool occlusion;
+
+bool outside_frustum(vec3 center, float radius) {
+    mat4 m = projection_matrix * view_matrix;
+    vec4 rows[4] = vec4[4](
+        vec4(m[0][0], m[1][0], m[2][0], m[3][0]),
+        vec4(m[0][1], m[1][1], m[2][1], m[3][1]),
+        vec4(m[0][2], m[1][2], m[2][2], m[3][2]),
+        vec4(m[0][3], m[1][3], m[2][3], m[3][3])
+    );
+    for (int i = 0; i < 3; ++i) {
+        vec4 near_plane = rows[3] + rows[i];
+        vec4 far_plane = rows[3] - rows[i];
+        if (dot(near_plane.xyz, center) + near_plane.w < -radius * length(near_plane.xyz))
+            return true;
+        if (dot(far_plane.xyz, center) + far_plane.w < -radius * length(far_plane.xyz))
+            return true;
+    }
+    return false;
+}
+
+/* every triangle of the meshlet faces away from the camera */
+bool backfacing(vec3 center, float radius, vec3 axis, float cutoff) {
+    vec3 d = center - camera_position;
+    return dot(d, axis) >= cutoff * length(d) + radius;
+}
+
+/* the sphere's nearest depth lies behind the farthest depth under its screen
+ * rectangle, read from the level where the rectangle is at most one texel
+ * wide: 2x2 texels cover it. spheres crossing the camera plane or the screen
+ * edges of the last frame are never occluded, nothing is known about them */
+bool occluded(vec3 center, float radius) {
+    vec2 low = vec2(1e30);
+    vec2 high = vec2(-1e30);
+    float nearest = 1.0;
+    for (int i = 0; i < 8; ++i) {
+        vec3 corner = center + radius * vec3((i & 1) != 0 ? 1 : -1, (i & 2) != 0 ? 1 : -1, (i & 4) != 0 ? 1 : -1);
+        vec4 clip = hi_z_view_projection * vec4(corner, 1);
+        if (clip.w <= 0)
+            return false;
+        vec3 ndc = clip.xyz / clip.w;
+        low = min(low, ndc.xy);
+        high = max(high, ndc.xy);
+        nearest = min(nearest, ndc.z);
+    }
+    low = low * 0.5 + 0.5;
+    high = high * 0.5 + 0.5;
+    if (any(lessThan(low, vec2(0))) || any(greaterThan(high, vec2(1))))
+        return false;
+
+    vec2 extent = (high - low) * vec2(textureSize(hi_z, 0));
+    int level = clamp(int(ceil(log2(max(max(extent.x, extent.y), 1.0)))), 0, textureQueryLevels(hi_z) - 1);
+    ivec2 size = textureSize(hi_z, level);
+    ivec2 a = min(ivec2(low * vec2(size)), size - 1);
+    ivec2 b = min(ivec2(high * vec2(size)), size - 1);
+    float farthest = max(
+        max(texelFetch(hi_z, a, level).r, texelFetch(hi_z, ivec2(b.x, a.y), level).r),
+        max(texelFetch(hi_z, ivec2(a.x, b.y), level).r, texelFetch(hi_z, b, level).r)
+    );
+    return nearest * 0.5 + 0.5 > farthest;
+}
+
+void main() {
+    uint m = gl_GlobalInvocationID.x;
+    uint instance = gl_WorkGroupID.y;
+    if (m >= meshlets.length())
+        return;
+
+    mat4 model = instances[instance].model;
+    vec3 center = (model * vec4(meshlets[m].sphere.xyz, 1)).xyz;
+    /* instances are scaled uniformly */
+    float scale = max(length(model[0].xyz), max(length(model[1].xyz), length(model[2].xyz)));
+    float radius = meshlets[m].sphere.w * scale;
+
+    if (outside_frustum(center, radius))
+        return;
+
+    float cutoff = meshlets[m].cone.w;
+    if (cutoff <= 1 && backfacing(center, radius, normalize(mat3(model) * meshlets[m].cone.xyz), cutoff))
+        return;
+
+    if (occlusion && occluded(center, radius))
+        return;
+
+    uint slot = atomicAdd(command_count, 1);
+    commands[slot] = draw_command(meshlets[m].index_count, 1, meshlets[m].first_index, 0, instance);
+}
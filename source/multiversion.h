@@ -0,0 +1,12 @@
+#pragma once
+/*
+ * MULTIVERSION before a function: with the multiversion build option, gcc
+ * emits a clone per listed cpu level and an ifunc resolver that picks the
+ * best one once at load time. only for non-inline, non-template functions;
+ * templates (generate_surface over its lambda) follow -march instead
+ */
+#if defined(GEOMETRY_MULTIVERSION) && defined(__x86_64__)
+#define MULTIVERSION __attribute__((target_clones("default", "arch=x86-64-v3", "arch=x86-64-v4")))
+#else
+#define MULTIVERSION
+#endif
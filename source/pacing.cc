@@ -0,0 +1,117 @@
+module;
+#include "gl_api.h"
+
+export module pacing;
+
+import std;
+import gl;
+import glfw;
+import logger;
+
+using std::array;
+using std::max;
+using std::min;
+using std::size_t;
+using std::chrono::duration;
+using std::this_thread::sleep_for;
+
+/*
+ * frame timeline with pacing:
+ *
+ * begin_frame: wait for the fence of frame (n - frames_in_flight)
+ *              sleep until the frame deadline (vsync off + target fps)
+ *              poll events = input sample
+ * latch:       (late latch) poll events again right before submission
+ * end_frame:   swap, insert fence for frame n
+ *
+ * input-to-present latency is measured from the last input sample of a frame
+ * to the moment its fence is observed signaled, so it is an upper bound that
+ * includes the gpu work but not the scanout.
+ */
+
+export struct frame_pacer {
+    static constexpr int max_frames_in_flight = 4;
+
+    int frames_in_flight = 2;
+    bool late_latch = false;
+    /* seconds per frame when vsync is off, 0 = uncapped */
+    double target_frame_time = 0;
+
+    array<gl::fence, max_frames_in_flight> fences;
+    array<double, max_frames_in_flight> input_times = {};
+    size_t frame = 0;
+
+    double deadline = 0;
+    /* how much longer than requested sleep_for usually takes */
+    double sleep_overshoot = 0.001;
+
+    /* exponentially smoothed, seconds */
+    double latency = 0;
+    double fence_wait = 0;
+
+    void begin_frame(bool vsync) {
+        wait_for_frames_in_flight();
+        if (!vsync && target_frame_time > 0)
+            sleep_until_deadline();
+        sample_input();
+    }
+
+    /* called right before the frame is submitted, when late latch is enabled
+     * the input is sampled a second time and returns true so that the caller
+     * can rebuild the camera state */
+    bool latch() {
+        if (!late_latch)
+            return false;
+        sample_input();
+        return true;
+    }
+
+    void end_frame() {
+        fences[frame % max_frames_in_flight].insert();
+        ++frame;
+    }
+
+    void sample_input() {
+        glfw::poll_events();
+        input_times[frame % max_frames_in_flight] = glfw::get_time();
+    }
+
+    void wait_for_frames_in_flight() {
+        int n = std::clamp(frames_in_flight, 1, max_frames_in_flight);
+        if (frame < size_t(n))
+            return;
+        size_t previous = frame - n;
+        size_t slot = previous % max_frames_in_flight;
+
+        double start = glfw::get_time();
+        GLenum result;
+        while ((result = fences[slot].wait(1'000'000'000)) == GL_TIMEOUT_EXPIRED) {}
+        if (result == GL_WAIT_FAILED) {
+            logger::error("waiting for frame {} failed, not pacing it", previous);
+            return;
+        }
+        double now = glfw::get_time();
+
+        fence_wait = smooth(fence_wait, now - start);
+        latency = smooth(latency, now - input_times[slot]);
+    }
+
+    void sleep_until_deadline() {
+        double now = glfw::get_time();
+        deadline = max(deadline + target_frame_time, now);
+        double remaining = deadline - now;
+        if (remaining > sleep_overshoot) {
+            double requested = remaining - sleep_overshoot;
+            double before = glfw::get_time();
+            sleep_for(duration<double>(requested));
+            double slept = glfw::get_time() - before;
+            sleep_overshoot = std::clamp(smooth(sleep_overshoot, slept - requested + 0.0002), 0.0, 0.004);
+        }
+        /* spin the rest, sleeping is not precise enough */
+        while (glfw::get_time() < deadline) {}
+    }
+
+    static double smooth(double average, double sample) {
+        return average == 0 ? sample : average + (sample - average) * 0.1;
+    }
+};
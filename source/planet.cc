@@ -0,0 +1,463 @@
+module;
+#include "multiversion.h"
+
+export module planet;
+
+import std;
+import glm;
+import jobs;
+import geometry;
+import bvh;
+
+using std::array;
+using std::function;
+using std::int32_t;
+using std::optional;
+using std::size_t;
+using std::uint32_t;
+using std::vector;
+using std::chrono::steady_clock;
+using namespace glm;
+
+/*
+ * procedural planets: a cube whose faces are pushed out to a sphere and
+ * displaced by fractal noise
+ * - every face is a quadtree of square patches with the same vertex grid,
+ *   a patch covers the surface of its four children at half their detail
+ * - a patch splits once the camera is within split_factor times its size
+ *   and merges back past hysteresis times that. children are shown once all
+ *   four are built, their parent stays up in the meantime
+ * - patches are built on demand (positions through generate_surface, in
+ *   parallel) by jobs of the frame, coarse before fine and nearest first,
+ *   at most builds_per_frame of them. max_patches caps how many are kept,
+ *   merged subtrees are dropped
+ * - geomorphing: every vertex knows where its parent's surface is and the
+ *   camera distances over which it moves there, so a patch looks like its
+ *   parent when it appears and when it merges
+ * - skirts hang from every patch border and hide the cracks between
+ *   neighbours of different levels
+ * - the gl side is up to the caller: upload / release a patch's mesh,
+ *   show / hide (draw) it, all from update()
+ */
+
+export namespace planet {
+    struct config {
+        float radius = 1.5f;
+        /* of the radius */
+        float height_scale = 0.03f;
+        float noise_frequency = 2.f;
+        int noise_octaves = 10;
+        uint32_t seed = 1;
+        /* vertices along a patch side without the skirt, odd so every other
+         * vertex is one of the parent's */
+        int patch_resolution = 33;
+        int max_depth = 10;
+        float split_factor = 2.f;
+        float hysteresis = 1.15f;
+        /* part of the parent's split distance the morph takes */
+        float morph_range = 0.3f;
+        int builds_per_frame = 8;
+        size_t max_patches = 1536;
+    };
+
+    struct metrics {
+        size_t nodes = 0;
+        /* built, with a mesh */
+        size_t resident = 0;
+        size_t shown = 0;
+        /* wanted this frame but over the budget */
+        size_t queued = 0;
+        int depth = 0;
+        /* since start */
+        size_t builds = 0;
+        double build_ms = 0;
+        double update_ms = 0;
+    };
+
+    /* one patch's vertices, skirt ring included, in planet space */
+    struct patch {
+        vector<vec3> positions;
+        vector<vec3> normals;
+        vector<vec2> texcoords;
+        /* from the vertex to the parent's surface */
+        vector<vec3> morph_offsets;
+        /* camera distance where the morph starts and where it is complete */
+        vector<vec2> morph_ranges;
+        aabb bounds;
+    };
+
+    uint32_t hash(ivec3 c, uint32_t seed) {
+        uint32_t h = seed ^ uint32_t(c.x) * 0x8da6b343u ^ uint32_t(c.y) * 0xd8163841u ^ uint32_t(c.z) * 0xcb1ab31fu;
+        h ^= h >> 16;
+        h *= 0x7feb352du;
+        h ^= h >> 15;
+        h *= 0x846ca68bu;
+        h ^= h >> 16;
+        return h;
+    }
+
+    /* value noise in [-1, 1], quintic between the lattice points */
+    float value_noise(vec3 p, uint32_t seed) {
+        vec3 cell = floor(p);
+        vec3 f = p - cell;
+        vec3 w = f * f * f * (f * (f * 6.f - 15.f) + 10.f);
+        ivec3 c = ivec3(cell);
+        auto corner = [&] (int x, int y, int z) {
+            return float(hash(c + ivec3(x, y, z), seed)) * (2.f / 4294967295.f) - 1.f;
+        };
+        float x00 = mix(corner(0, 0, 0), corner(1, 0, 0), w.x);
+        float x10 = mix(corner(0, 1, 0), corner(1, 1, 0), w.x);
+        float x01 = mix(corner(0, 0, 1), corner(1, 0, 1), w.x);
+        float x11 = mix(corner(0, 1, 1), corner(1, 1, 1), w.x);
+        return mix(mix(x00, x10, w.y), mix(x01, x11, w.y), w.z);
+    }
+
+    /* octaves of halving amplitude, about [-1, 1] */
+    float fbm(vec3 p, int octaves, uint32_t seed) {
+        float sum = 0;
+        float amplitude = 0.5f;
+        for (int o = 0; o < octaves; ++o) {
+            sum += amplitude * value_noise(p, seed + o);
+            p *= 2.03f;
+            amplitude *= 0.5f;
+        }
+        return sum;
+    }
+
+    /* face i of create_cube's order: normal, and the axes along the patch grid */
+    struct face_basis {
+        vec3 n;
+        vec3 u;
+        vec3 v;
+    };
+
+    face_basis basis(int face) {
+        vec3 n = (face % 2 == 0 ? -1.f : 1.f) * mat3(1)[face / 2];
+        vec3 u = vec3(n.y, n.z, n.x);
+        return {n, u, cross(n, u)};
+    }
+
+    /* spreads the cube's points more evenly over the sphere than normalizing */
+    vec3 cube_to_sphere(vec3 p) {
+        vec3 q = p * p;
+        return p * sqrt(max(vec3(1) - vec3(q.y, q.z, q.x) / 2.f - vec3(q.z, q.x, q.y) / 2.f + vec3(q.y, q.z, q.x) * vec3(q.z, q.x, q.y) / 3.f, vec3(0)));
+    }
+
+    struct node {
+        int32_t face;
+        int32_t level;
+        /* of 2^level patches along the face */
+        int32_t x;
+        int32_t y;
+        int32_t parent = -1;
+        /* first of four, -1 = none */
+        int32_t children = -1;
+        bool ready = false;
+        /* drawn by its children */
+        bool split = false;
+        bool shown = false;
+        aabb box;
+    };
+
+    struct terrain {
+        /* all of them on the thread calling update() */
+        using upload_function = function<void(uint32_t id, const patch &)>;
+        using release_function = function<void(uint32_t id)>;
+        using show_function = function<void(uint32_t id)>;
+        using hide_function = function<void(uint32_t id)>;
+
+        config settings;
+        /* of every patch */
+        vector<unsigned int> indices;
+        vector<node> nodes;
+        /* first nodes of unused groups of four */
+        vector<int32_t> free_groups;
+        metrics stats;
+        upload_function upload;
+        release_function release;
+        show_function show;
+        hide_function hide;
+        vector<uint32_t> wanted;
+        vector<optional<patch>> built;
+
+        terrain(config settings, upload_function upload, release_function release, show_function show, hide_function hide)
+            : settings(settings)
+            , upload(std::move(upload))
+            , release(std::move(release))
+            , show(std::move(show))
+            , hide(std::move(hide)) {
+            int side = settings.patch_resolution + 2;
+            indices = generate_grid_indices(side, side);
+            for (int face = 0; face < 6; ++face)
+                nodes.push_back({.face = face, .level = 0, .x = 0, .y = 0});
+        }
+
+        terrain(const terrain &) = delete;
+        terrain & operator=(const terrain &) = delete;
+
+        /* edge length, in planet units */
+        float size(int level) const {
+            return 2 * settings.radius / float(1 << level);
+        }
+
+        float split_distance(int level) const {
+            return settings.split_factor * size(level);
+        }
+
+        /* once per frame, camera in planet space (the planet's center at the origin) */
+        void update(vec3 camera) {
+            auto start = steady_clock::now();
+            wanted.clear();
+            for (uint32_t root = 0; root < 6; ++root)
+                visit(root, camera);
+            build_wanted(camera);
+
+            stats.nodes = nodes.size() - free_groups.size() * 4;
+            stats.shown = 0;
+            stats.depth = 0;
+            for (const node &n : nodes) {
+                if (n.shown) {
+                    stats.shown++;
+                    stats.depth = std::max(stats.depth, n.level);
+                }
+            }
+            stats.update_ms = std::chrono::duration<double, std::milli>(steady_clock::now() - start).count();
+        }
+
+        /* runs on any thread, reads the node and the settings only */
+        patch build(const node &n) const;
+
+    private:
+        static float distance(const aabb &box, vec3 p) {
+            return length(max(max(box.min - p, p - box.max), vec3(0)));
+        }
+
+        void visit(uint32_t id, vec3 camera) {
+            if (!nodes[id].ready) {
+                wanted.push_back(id);
+                return;
+            }
+            float d = distance(nodes[id].box, camera);
+            float split = split_distance(nodes[id].level);
+            if (nodes[id].split) {
+                if (d > split * settings.hysteresis) {
+                    merge(id);
+                    return;
+                }
+                for (int k = 0; k < 4; ++k)
+                    visit(nodes[id].children + k, camera);
+                return;
+            }
+
+            if (!nodes[id].shown) {
+                show(id);
+                nodes[id].shown = true;
+            }
+            bool wants_split = nodes[id].level < settings.max_depth && d < split;
+            if (!wants_split) {
+                /* built for a split that did not happen */
+                if (nodes[id].children >= 0 && d > split * settings.hysteresis)
+                    free_children(id);
+                return;
+            }
+            if (nodes[id].children < 0) {
+                if (stats.resident + 4 > settings.max_patches)
+                    return;
+                allocate_children(id);
+            }
+            int32_t first = nodes[id].children;
+            bool all_ready = true;
+            for (int k = 0; k < 4; ++k) {
+                if (!nodes[first + k].ready) {
+                    wanted.push_back(first + k);
+                    all_ready = false;
+                }
+            }
+            if (!all_ready)
+                return;
+            hide(id);
+            nodes[id].shown = false;
+            nodes[id].split = true;
+            for (int k = 0; k < 4; ++k)
+                visit(first + k, camera);
+        }
+
+        void allocate_children(uint32_t id) {
+            int32_t first;
+            if (!free_groups.empty()) {
+                first = free_groups.back();
+                free_groups.pop_back();
+            } else {
+                first = nodes.size();
+                nodes.resize(nodes.size() + 4);
+            }
+            const node &parent = nodes[id];
+            for (int k = 0; k < 4; ++k) {
+                nodes[first + k] = {
+                    .face = parent.face,
+                    .level = parent.level + 1,
+                    .x = parent.x * 2 + k % 2,
+                    .y = parent.y * 2 + k / 2,
+                    .parent = int32_t(id)
+                };
+            }
+            nodes[id].children = first;
+        }
+
+        /* hides and releases the node's subtree, the node itself stays */
+        void free_children(uint32_t id) {
+            int32_t first = nodes[id].children;
+            for (int k = 0; k < 4; ++k) {
+                uint32_t child = first + k;
+                if (nodes[child].children >= 0)
+                    free_children(child);
+                if (nodes[child].shown)
+                    hide(child);
+                if (nodes[child].ready) {
+                    release(child);
+                    stats.resident--;
+                }
+                nodes[child] = {};
+            }
+            free_groups.push_back(first);
+            nodes[id].children = -1;
+            nodes[id].split = false;
+        }
+
+        void merge(uint32_t id) {
+            free_children(id);
+            show(id);
+            nodes[id].shown = true;
+        }
+
+        void build_wanted(vec3 camera) {
+            auto start = steady_clock::now();
+            std::ranges::sort(wanted, [&] (uint32_t a, uint32_t b) {
+                if (nodes[a].level != nodes[b].level)
+                    return nodes[a].level < nodes[b].level;
+                return distance(nodes[nodes[a].parent < 0 ? a : nodes[a].parent].box, camera)
+                     < distance(nodes[nodes[b].parent < 0 ? b : nodes[b].parent].box, camera);
+            });
+            size_t count = std::min<size_t>(wanted.size(), std::max(settings.builds_per_frame, 0));
+            stats.queued = wanted.size() - count;
+            if (count == 0) {
+                stats.build_ms = 0;
+                return;
+            }
+            built.resize(count);
+            {
+                jobs::task_group builds;
+                for (size_t k = 0; k < count; ++k)
+                    builds.run([this, k] { built[k] = build(nodes[wanted[k]]); });
+            }
+            for (size_t k = 0; k < count; ++k) {
+                node &n = nodes[wanted[k]];
+                n.box = built[k]->bounds;
+                n.ready = true;
+                upload(wanted[k], *built[k]);
+                stats.resident++;
+                stats.builds++;
+            }
+            built.clear();
+            stats.build_ms = std::chrono::duration<double, std::milli>(steady_clock::now() - start).count();
+        }
+    };
+
+    /* positions come from a grid one vertex wider on every side, so border
+     * normals see their neighbours, that ring then becomes the skirt */
+    MULTIVERSION patch terrain::build(const node &n) const {
+        const int R = settings.patch_resolution;
+        const int G = R + 2;
+        const face_basis b = basis(n.face);
+        const float scale = 1.f / float(1 << n.level);
+        const float height = settings.radius * settings.height_scale;
+        auto surface = [&] (float s, float t) {
+            /* ring vertices fall just outside [0, 1] */
+            float a = (float(n.x) + (round(s * (G - 1)) - 1) / (R - 1)) * scale;
+            float c = (float(n.y) + (round(t * (G - 1)) - 1) / (R - 1)) * scale;
+            vec3 dir = normalize(cube_to_sphere(b.n + b.u * (2 * a - 1) + b.v * (2 * c - 1)));
+            float h = fbm(dir * settings.noise_frequency, settings.noise_octaves, settings.seed);
+            return dir * (settings.radius + height * h);
+        };
+
+        patch p;
+        p.positions = generate_surface(G, G, surface);
+        auto at = [&] (int i, int j) -> size_t {
+            return size_t(i) * G + j;
+        };
+        const auto &P = p.positions;
+
+        p.normals.resize(P.size());
+        p.texcoords.resize(P.size());
+        for (int i = 1; i <= R; ++i) {
+            for (int j = 1; j <= R; ++j) {
+                vec3 du = P[at(i + 1, j)] - P[at(i - 1, j)];
+                vec3 dv = P[at(i, j + 1)] - P[at(i, j - 1)];
+                p.normals[at(i, j)] = normalize(cross(du, dv));
+                /* equirectangular, like the texcoords of the sphere lambda */
+                vec3 dir = normalize(P[at(i, j)]);
+                float theta = atan(dir.z, dir.x);
+                if (theta < 0)
+                    theta += 2 * pi<float>();
+                p.texcoords[at(i, j)] = vec2(1 - theta / (2 * pi<float>()), acos(clamp(dir.y, -1.f, 1.f)) / pi<float>());
+            }
+        }
+        /* a patch across the seam would interpolate over the whole texture */
+        float low = 1, high = 0;
+        for (int i = 1; i <= R; ++i) {
+            for (int j = 1; j <= R; ++j) {
+                low = std::min(low, p.texcoords[at(i, j)].x);
+                high = std::max(high, p.texcoords[at(i, j)].x);
+            }
+        }
+        if (high - low > 0.5f)
+            for (vec2 &uv : p.texcoords)
+                if (uv.x < 0.5f)
+                    uv.x += 1;
+
+        /* odd vertices lie on an edge or the diagonal of one of the parent's
+         * cells (the diagonal runs from RT to LB, see grid_indices_row) */
+        p.morph_offsets.assign(P.size(), vec3(0));
+        if (n.level > 0) {
+            for (int i = 1; i <= R; ++i) {
+                for (int j = 1; j <= R; ++j) {
+                    bool odd_i = (i - 1) % 2 == 1;
+                    bool odd_j = (j - 1) % 2 == 1;
+                    vec3 parent = P[at(i, j)];
+                    if (odd_i && odd_j)
+                        parent = (P[at(i - 1, j + 1)] + P[at(i + 1, j - 1)]) * 0.5f;
+                    else if (odd_i)
+                        parent = (P[at(i - 1, j)] + P[at(i + 1, j)]) * 0.5f;
+                    else if (odd_j)
+                        parent = (P[at(i, j - 1)] + P[at(i, j + 1)]) * 0.5f;
+                    p.morph_offsets[at(i, j)] = parent - P[at(i, j)];
+                }
+            }
+        }
+
+        /* the ring takes its border vertex, sunk towards the center */
+        const float skirt = size(n.level) * 0.05f;
+        for (int i = 0; i < G; ++i) {
+            for (int j = 0; j < G; ++j) {
+                if (i > 0 && i <= R && j > 0 && j <= R)
+                    continue;
+                size_t border = at(clamp(i, 1, R), clamp(j, 1, R));
+                p.positions[at(i, j)] = P[border] - normalize(P[border]) * skirt;
+                p.normals[at(i, j)] = p.normals[border];
+                p.texcoords[at(i, j)] = p.texcoords[border];
+                p.morph_offsets[at(i, j)] = p.morph_offsets[border];
+            }
+        }
+
+        /* complete where the parent merges it, roots never morph */
+        vec2 range = vec2(0);
+        if (n.level > 0) {
+            float end = split_distance(n.level - 1);
+            range = vec2(end * (1 - settings.morph_range), end);
+        }
+        p.morph_ranges.assign(P.size(), range);
+        for (const vec3 &v : p.positions)
+            p.bounds.grow(v);
+        return p;
+    }
+}
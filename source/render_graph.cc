@@ -0,0 +1,395 @@
+module;
+#include "gl_api.h"
+
+export module render_graph;
+
+import std;
+import glm;
+import gl;
+
+using std::array;
+using std::function;
+using std::size_t;
+using std::string;
+using std::string_view;
+using std::uint32_t;
+using std::vector;
+using namespace glm;
+
+/*
+ * frame as a list of passes that declare how they access resources:
+ * - transient textures belong to the graph, everything else is imported
+ *   (textures, buffers, or external state like the backbuffer that is only
+ *   used for ordering)
+ * - compile() works on the declarations only, no gl calls:
+ *   - culling: walking back from the outputs, a pass runs if it has side
+ *     effects or writes something a later running pass reads
+ *   - aliasing: a transient texture's lifetime is the range of running
+ *     passes using it, textures with the same description whose lifetimes
+ *     do not overlap share one gl texture
+ *   - barriers: before a pass, the glMemoryBarrier bits for the ways it
+ *     accesses memory written incoherently (image store, ssbo) that no
+ *     earlier barrier made visible yet, at most one call per pass
+ * - sizes of transient textures are relative to the output (divisor)
+ * - every pass is timed with timestamp queries (read back timer_frames
+ *   later, so never stalls) and can be switched off
+ */
+
+export struct texture_desc {
+    GLenum format;
+    /* size = output size / divisor */
+    int divisor = 1;
+    GLsizei levels = 1;
+
+    bool operator==(const texture_desc &) const = default;
+};
+
+export size_t format_bytes(GLenum format) {
+    switch (format) {
+        case GL_RGBA16F:            return 8;
+        case GL_RGBA32F:            return 16;
+        case GL_R11F_G11F_B10F:     return 4;
+        case GL_RGBA8:              return 4;
+        case GL_DEPTH_COMPONENT32F: return 4;
+        case GL_DEPTH24_STENCIL8:   return 4;
+        default:                    return 4;
+    }
+}
+
+/* how a pass touches a resource, decides the barrier bit */
+export enum class usage {
+    sampled,
+    image,
+    storage,
+    uniform,
+    indirect,
+    vertex,
+    attachment
+};
+
+/* image stores and ssbo writes are not ordered with later reads */
+export bool incoherent(usage how) {
+    return how == usage::image || how == usage::storage;
+}
+
+export GLbitfield barrier_bits(usage how) {
+    switch (how) {
+        case usage::sampled:    return GL_TEXTURE_FETCH_BARRIER_BIT;
+        case usage::image:      return GL_SHADER_IMAGE_ACCESS_BARRIER_BIT;
+        case usage::storage:    return GL_SHADER_STORAGE_BARRIER_BIT;
+        case usage::uniform:    return GL_UNIFORM_BARRIER_BIT;
+        case usage::indirect:   return GL_COMMAND_BARRIER_BIT;
+        case usage::vertex:     return GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_ELEMENT_ARRAY_BARRIER_BIT;
+        case usage::attachment: return GL_FRAMEBUFFER_BARRIER_BIT;
+    }
+    return GL_ALL_BARRIER_BITS;
+}
+
+export struct render_graph {
+    /* must be more than the frames the pacer lets into flight */
+    static constexpr int timer_frames = 6;
+
+    using resource = uint32_t;
+
+    struct use {
+        resource id;
+        usage how;
+    };
+
+    enum class resource_kind {
+        transient,
+        texture,
+        buffer,
+        external
+    };
+
+    struct resource_entry {
+        string name;
+        resource_kind kind;
+        texture_desc desc = {};
+        gl::texture *texture = nullptr;
+        gl::buffer *buffer = nullptr;
+        /* read after the graph, passes writing it are never culled */
+        bool output = false;
+        /* compile results, transient textures only */
+        int physical = -1;
+        int first_use = -1;
+        int last_use = -1;
+    };
+
+    struct pass {
+        string name;
+        vector<use> reads;
+        vector<use> writes;
+        function<void(render_graph &)> execute;
+        bool enabled = true;
+        /* writes state the graph does not see (caches kept across frames) */
+        bool side_effects = false;
+        /* compile results */
+        bool culled = false;
+        GLbitfield barriers = 0;
+        /* exponentially smoothed, and of the frame the queries came back for */
+        double gpu_ms = 0;
+        double frame_gpu_ms = 0;
+    };
+
+    /* timestamps around a pass, one pair per frame in flight */
+    struct pass_timer {
+        array<gl::timestamp_query, timer_frames> begin = {};
+        array<gl::timestamp_query, timer_frames> end = {};
+    };
+
+    ivec2 output_size = ivec2(1);
+    vector<resource_entry> resources;
+    vector<pass> passes;
+    /* by pass index, created by execute(): declaring and compiling a graph
+     * needs no gl context */
+    vector<pass_timer> timers;
+    size_t frame = 0;
+
+    /* compile results */
+    bool compiled = false;
+    vector<bool> compiled_enabled;
+    vector<texture_desc> physical_descs;
+
+    /* gl textures behind physical_descs */
+    vector<gl::texture> physical;
+    vector<texture_desc> allocated_descs;
+    ivec2 allocated_size = ivec2(0);
+
+    /* bytes of all transient textures, and what they would take without aliasing */
+    size_t allocated_bytes = 0;
+    size_t unaliased_bytes = 0;
+
+    resource create_texture(string name, texture_desc desc) {
+        return add_resource({std::move(name), resource_kind::transient, desc});
+    }
+
+    resource import_texture(string name, gl::texture &t) {
+        return add_resource({.name = std::move(name), .kind = resource_kind::texture, .texture = &t});
+    }
+
+    resource import_buffer(string name, gl::buffer &b) {
+        return add_resource({.name = std::move(name), .kind = resource_kind::buffer, .buffer = &b});
+    }
+
+    /* anything else passes have to be ordered by: the backbuffer, a set of buffers */
+    resource import_external(string name) {
+        return add_resource({.name = std::move(name), .kind = resource_kind::external});
+    }
+
+    void mark_output(resource r) {
+        resources[r].output = true;
+        compiled = false;
+    }
+
+    pass &add_pass(string name, vector<use> reads, vector<use> writes, function<void(render_graph &)> execute) {
+        compiled = false;
+        return passes.emplace_back(std::move(name), std::move(reads), std::move(writes), std::move(execute));
+    }
+
+    pass *find_pass(string_view name) {
+        auto p = std::ranges::find(passes, name, &pass::name);
+        return p != passes.end() ? &*p : nullptr;
+    }
+
+    /* switched on and not culled */
+    bool enabled(string_view name) {
+        pass *p = find_pass(name);
+        return p != nullptr && p->enabled && !p->culled;
+    }
+
+    void resize(ivec2 size) {
+        output_size = size;
+    }
+
+    ivec2 size(resource r) const {
+        return max(output_size / resources[r].desc.divisor, ivec2(1));
+    }
+
+    gl::texture &texture(resource r) {
+        const resource_entry &e = resources[r];
+        return e.kind == resource_kind::transient ? physical[e.physical] : *e.texture;
+    }
+
+    gl::buffer &buffer(resource r) {
+        return *resources[r].buffer;
+    }
+
+    size_t bytes(const texture_desc &desc) const {
+        ivec2 s = max(output_size / desc.divisor, ivec2(1));
+        size_t b = size_t(s.x) * s.y * format_bytes(desc.format);
+        /* a full mip chain adds a third */
+        return desc.levels > 1 ? b * 4 / 3 : b;
+    }
+
+    /* no gl calls, only the declarations are looked at */
+    void compile() {
+        cull();
+        assign_physical();
+        place_barriers();
+        compiled_enabled.resize(passes.size());
+        for (size_t i = 0; i < passes.size(); ++i)
+            compiled_enabled[i] = passes[i].enabled;
+        compiled = true;
+    }
+
+    /* (re)creates gl textures when the physical descriptions or the output size changed */
+    void allocate() {
+        if (physical_descs == allocated_descs && output_size == allocated_size)
+            return;
+        physical.clear();
+        allocated_bytes = 0;
+        for (const texture_desc &desc : physical_descs) {
+            ivec2 s = max(output_size / desc.divisor, ivec2(1));
+            physical.push_back(gl::make_render_texture(desc.format, s, desc.levels));
+            allocated_bytes += bytes(desc);
+        }
+        unaliased_bytes = 0;
+        for (const resource_entry &e : resources)
+            if (e.physical >= 0)
+                unaliased_bytes += bytes(e.desc);
+        allocated_descs = physical_descs;
+        allocated_size = output_size;
+    }
+
+    void execute() {
+        bool toggled = !std::ranges::equal(passes, compiled_enabled, {}, &pass::enabled);
+        if (!compiled || toggled)
+            compile();
+        allocate();
+        if (timers.size() < passes.size())
+            timers.resize(passes.size());
+
+        size_t slot = frame % timer_frames;
+        for (size_t i = 0; i < passes.size(); ++i) {
+            pass &p = passes[i];
+            gl::timestamp_query &begin = timers[i].begin[slot];
+            gl::timestamp_query &end = timers[i].end[slot];
+            if (begin.available() && end.available()) {
+                double ms = double(end.value() - begin.value()) / 1e6;
+                p.gpu_ms = p.gpu_ms == 0 ? ms : p.gpu_ms + (ms - p.gpu_ms) * 0.1;
+                p.frame_gpu_ms = ms;
+            }
+            if (p.culled) {
+                p.gpu_ms = 0;
+                p.frame_gpu_ms = 0;
+                continue;
+            }
+            begin.record();
+            if (p.barriers != 0)
+                gl::memory_barrier(p.barriers);
+            p.execute(*this);
+            end.record();
+        }
+        ++frame;
+    }
+
+private:
+    resource add_resource(resource_entry e) {
+        resources.push_back(std::move(e));
+        compiled = false;
+        return resources.size() - 1;
+    }
+
+    /* writes do not end the need for a resource: passes may write parts of it */
+    void cull() {
+        vector<bool> needed(resources.size());
+        for (resource r = 0; r < resources.size(); ++r)
+            needed[r] = resources[r].output;
+        for (size_t i = passes.size(); i-- > 0;) {
+            pass &p = passes[i];
+            p.culled = !p.enabled || !(p.side_effects || std::ranges::any_of(p.writes, [&] (const use &u) {
+                return needed[u.id];
+            }));
+            if (p.culled)
+                continue;
+            for (const use &u : p.reads)
+                needed[u.id] = true;
+        }
+    }
+
+    /* greedy: in order of first use, take a texture of the same description
+     * whose last user runs before this one's first */
+    void assign_physical() {
+        for (resource_entry &e : resources) {
+            e.first_use = -1;
+            e.last_use = -1;
+            e.physical = -1;
+        }
+        for (int i = 0; i < int(passes.size()); ++i) {
+            if (passes[i].culled)
+                continue;
+            for (auto list : {&passes[i].reads, &passes[i].writes}) {
+                for (const use &u : *list) {
+                    resource_entry &e = resources[u.id];
+                    if (e.first_use < 0)
+                        e.first_use = i;
+                    e.last_use = i;
+                }
+            }
+        }
+
+        vector<resource> order;
+        for (resource r = 0; r < resources.size(); ++r)
+            if (resources[r].kind == resource_kind::transient && resources[r].first_use >= 0)
+                order.push_back(r);
+        std::ranges::stable_sort(order, {}, [&] (resource r) { return resources[r].first_use; });
+
+        physical_descs.clear();
+        vector<int> physical_last_use;
+        for (resource r : order) {
+            resource_entry &e = resources[r];
+            size_t slot = 0;
+            while (slot < physical_descs.size() && !(physical_descs[slot] == e.desc && physical_last_use[slot] < e.first_use))
+                ++slot;
+            if (slot == physical_descs.size()) {
+                physical_descs.push_back(e.desc);
+                physical_last_use.push_back(-1);
+            }
+            physical_last_use[slot] = e.last_use;
+            e.physical = slot;
+        }
+    }
+
+    /* memory is tracked per gl object: aliased transients share their state */
+    void place_barriers() {
+        struct memory_state {
+            /* written incoherently since the frame started */
+            bool dirty = false;
+            /* access paths a barrier made the last write visible to */
+            GLbitfield visible = 0;
+        };
+        vector<memory_state> memory(physical_descs.size() + resources.size());
+        auto state = [&] (resource r) -> memory_state & {
+            const resource_entry &e = resources[r];
+            return memory[e.kind == resource_kind::transient ? e.physical : physical_descs.size() + r];
+        };
+
+        for (pass &p : passes) {
+            p.barriers = 0;
+            if (p.culled)
+                continue;
+            for (auto list : {&p.reads, &p.writes}) {
+                for (const use &u : *list) {
+                    memory_state &s = state(u.id);
+                    GLbitfield bits = barrier_bits(u.how);
+                    if (s.dirty && (s.visible & bits) != bits)
+                        p.barriers |= bits;
+                }
+            }
+            /* glMemoryBarrier is global, it covers everything written so far */
+            if (p.barriers != 0)
+                for (memory_state &s : memory)
+                    if (s.dirty)
+                        s.visible |= p.barriers;
+            for (const use &u : p.writes) {
+                if (!incoherent(u.how))
+                    continue;
+                memory_state &s = state(u.id);
+                s.dirty = true;
+                s.visible = 0;
+            }
+        }
+    }
+};
@@ -0,0 +1,384 @@
+module;
+#include <cstddef>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+export module scene_file;
+
+import std;
+import glm;
+import asset_io;
+
+using std::byte;
+using std::int64_t;
+using std::is_trivially_copyable_v;
+using std::memcpy;
+using std::optional;
+using std::pair;
+using std::runtime_error;
+using std::size_t;
+using std::span;
+using std::string;
+using std::string_view;
+using std::uint32_t;
+using std::uint64_t;
+using std::vector;
+using std::filesystem::path;
+using namespace glm;
+
+/*
+ * binary scene snapshot, used in place from a read only mapping:
+ *
+ * file_header | tables | meshes | textures | blobs ...
+ *
+ * - every reference is a rel_span: offset relative to the rel_span itself
+ *   plus element count, so nothing is patched or parsed on load
+ * - a table holds one component type: entity numbers and the packed
+ *   component values, the type is identified by its name and size, a layout
+ *   change of a component makes the table (and the file) unusable
+ * - components are stored bytewise, they must be trivially copyable and
+ *   must not contain pointers
+ * - every blob is 16 byte aligned, so mat4 / vec4 members can be read in place
+ */
+
+export namespace scene_file {
+    constexpr uint32_t file_magic = 0x6e637367; /* "gscn" */
+    constexpr uint32_t file_version = 1;
+    constexpr size_t blob_alignment = 16;
+
+    struct error: runtime_error {
+        error(string_view message)
+            : runtime_error(string(message)) {}
+    };
+
+    template<typename T>
+    struct rel_span {
+        int64_t offset;
+        uint64_t count;
+
+        span<const T> get() const {
+            if (count == 0)
+                return {};
+            return {reinterpret_cast<const T *>(reinterpret_cast<const byte *>(this) + offset), count};
+        }
+    };
+
+    struct table_header {
+        uint64_t type_id;
+        uint32_t element_size;
+        uint32_t _;
+        rel_span<uint32_t> entities;
+        rel_span<byte> values;
+    };
+
+    struct mesh_blob {
+        rel_span<uint32_t> indices;
+        rel_span<vec3> positions;
+        rel_span<vec3> normals;
+        rel_span<vec2> texcoords;
+    };
+
+    struct texture_ref {
+        rel_span<char> path;
+    };
+
+    struct file_header {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t size;
+        uint32_t entity_count;
+        uint32_t _;
+        rel_span<table_header> tables;
+        rel_span<mesh_blob> meshes;
+        rel_span<texture_ref> textures;
+    };
+
+    constexpr uint64_t fnv1a(string_view s) {
+        uint64_t h = 0xcbf29ce484222325;
+        for (char c : s) {
+            h ^= static_cast<unsigned char>(c);
+            h *= 0x100000001b3;
+        }
+        return h;
+    }
+
+    /* the function name contains the type name */
+    template<typename T>
+    consteval uint64_t type_id() {
+        return fnv1a(std::source_location::current().function_name());
+    }
+
+    template<typename T>
+    concept storable = is_trivially_copyable_v<T>;
+
+    struct writer {
+        struct table {
+            uint64_t type_id;
+            uint32_t element_size;
+            vector<uint32_t> entities;
+            vector<byte> values;
+        };
+
+        struct mesh {
+            vector<uint32_t> indices;
+            vector<vec3> positions;
+            vector<vec3> normals;
+            vector<vec2> texcoords;
+        };
+
+        uint32_t entity_count = 0;
+        vector<table> tables;
+        vector<mesh> meshes;
+        vector<string> textures;
+
+        template<storable T>
+        void add_table(span<const uint32_t> entities, span<const T> values) {
+            table &t = tables.emplace_back(type_id<T>(), sizeof(T));
+            t.entities.assign(entities.begin(), entities.end());
+            auto bytes = std::as_bytes(values);
+            t.values.assign(bytes.begin(), bytes.end());
+        }
+
+        void add_mesh(
+            span<const uint32_t> indices,
+            span<const vec3> positions,
+            span<const vec3> normals,
+            span<const vec2> texcoords
+        ) {
+            meshes.push_back({
+                {indices.begin(), indices.end()},
+                {positions.begin(), positions.end()},
+                {normals.begin(), normals.end()},
+                {texcoords.begin(), texcoords.end()}
+            });
+        }
+
+        void add_texture(string_view texture_path) {
+            textures.emplace_back(texture_path);
+        }
+
+        /* writes to a temporary file first, a crash never leaves a torn snapshot */
+        void save(const path &filename) const;
+    };
+
+    /* a scene file's bytes, wherever they live: accessors in place, nothing
+     * is copied */
+    struct scene_view {
+        const byte *base = nullptr;
+        size_t size = 0;
+
+        const file_header &header() const {
+            return *reinterpret_cast<const file_header *>(base);
+        }
+
+        uint32_t entity_count() const {
+            return header().entity_count;
+        }
+
+        span<const mesh_blob> meshes() const {
+            return header().meshes.get();
+        }
+
+        span<const texture_ref> textures() const {
+            return header().textures.get();
+        }
+
+        /* entity numbers and values of component T, nothing if the file has no table for it */
+        template<storable T>
+        optional<pair<span<const uint32_t>, span<const T>>> table() const {
+            for (const table_header &t : header().tables.get()) {
+                if (t.type_id != type_id<T>())
+                    continue;
+                if (t.element_size != sizeof(T))
+                    throw scene_file::error("component layout changed since the scene was written");
+                auto values = t.values.get();
+                return pair(
+                    t.entities.get(),
+                    span(reinterpret_cast<const T *>(values.data()), values.size() / sizeof(T))
+                );
+            }
+            return std::nullopt;
+        }
+
+    protected:
+        template<typename T>
+        void check(const rel_span<T> &s) const {
+            const byte *first = reinterpret_cast<const byte *>(&s) + s.offset;
+            if (s.count > 0 && (first < base || first + s.count * sizeof(T) > base + size))
+                throw scene_file::error("scene file is truncated or corrupt");
+        }
+
+        void validate() const;
+    };
+
+    /* read only mapping of a scene file, throws scene_file::error if the file
+     * can not be used */
+    struct mapped_scene: scene_view {
+        explicit mapped_scene(const path &filename);
+        ~mapped_scene();
+
+        mapped_scene(const mapped_scene &) = delete;
+        mapped_scene & operator=(const mapped_scene &) = delete;
+    };
+
+    /* a scene file read into memory by the caller (the world streamer reads
+     * with explicit i/o instead of taking page faults), throws
+     * scene_file::error if the bytes can not be used */
+    struct loaded_scene: scene_view {
+        asset_io::buffer data;
+
+        explicit loaded_scene(asset_io::buffer bytes);
+
+        /* moving the buffer keeps its storage, base stays valid */
+        loaded_scene(loaded_scene &&) = default;
+        loaded_scene & operator=(loaded_scene &&) = default;
+    };
+}
+
+namespace scene_file {
+    /* bump allocator over a growing byte array, positions are offsets
+     * because the array moves while it grows */
+    struct builder {
+        vector<byte> data;
+
+        size_t allocate(size_t size) {
+            size_t offset = (data.size() + blob_alignment - 1) & ~(blob_alignment - 1);
+            data.resize(offset + size);
+            return offset;
+        }
+
+        template<typename T>
+        T &at(size_t offset) {
+            return *reinterpret_cast<T *>(data.data() + offset);
+        }
+
+        /* copies values into a new blob and points the rel_span at field to it */
+        template<typename T>
+        void link(size_t field, span<const T> values) {
+            size_t target = allocate(values.size_bytes());
+            if (!values.empty())
+                memcpy(data.data() + target, values.data(), values.size_bytes());
+            at<rel_span<T>>(field) = {int64_t(target) - int64_t(field), values.size()};
+        }
+    };
+
+    void writer::save(const path &filename) const {
+        builder b;
+        size_t header = b.allocate(sizeof(file_header));
+        size_t table_array = b.allocate(tables.size() * sizeof(table_header));
+        size_t mesh_array = b.allocate(meshes.size() * sizeof(mesh_blob));
+        size_t texture_array = b.allocate(textures.size() * sizeof(texture_ref));
+
+        b.at<file_header>(header) = {
+            .magic = file_magic,
+            .version = file_version,
+            .entity_count = entity_count,
+            .tables = {int64_t(table_array) - int64_t(header + offsetof(file_header, tables)), tables.size()},
+            .meshes = {int64_t(mesh_array) - int64_t(header + offsetof(file_header, meshes)), meshes.size()},
+            .textures = {int64_t(texture_array) - int64_t(header + offsetof(file_header, textures)), textures.size()}
+        };
+
+        for (size_t i = 0; i < tables.size(); ++i) {
+            size_t t = table_array + i * sizeof(table_header);
+            b.at<table_header>(t).type_id = tables[i].type_id;
+            b.at<table_header>(t).element_size = tables[i].element_size;
+            b.link(t + offsetof(table_header, entities), span<const uint32_t>(tables[i].entities));
+            b.link(t + offsetof(table_header, values), span<const byte>(tables[i].values));
+        }
+
+        for (size_t i = 0; i < meshes.size(); ++i) {
+            size_t m = mesh_array + i * sizeof(mesh_blob);
+            b.link(m + offsetof(mesh_blob, indices), span<const uint32_t>(meshes[i].indices));
+            b.link(m + offsetof(mesh_blob, positions), span<const vec3>(meshes[i].positions));
+            b.link(m + offsetof(mesh_blob, normals), span<const vec3>(meshes[i].normals));
+            b.link(m + offsetof(mesh_blob, texcoords), span<const vec2>(meshes[i].texcoords));
+        }
+
+        for (size_t i = 0; i < textures.size(); ++i) {
+            size_t t = texture_array + i * sizeof(texture_ref);
+            b.link(t + offsetof(texture_ref, path), span<const char>(textures[i]));
+        }
+
+        b.at<file_header>(header).size = b.data.size();
+
+        path temporary = filename;
+        temporary += ".tmp";
+        {
+            std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+            out.write(reinterpret_cast<const char *>(b.data.data()), b.data.size());
+            if (!out)
+                throw scene_file::error(std::format("could not write {}", temporary.string()));
+        }
+        std::filesystem::rename(temporary, filename);
+    }
+
+    mapped_scene::mapped_scene(const path &filename) {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw scene_file::error(std::format("could not open {}", filename.string()));
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(file_header)) {
+            ::close(fd);
+            throw scene_file::error(std::format("{} is not a scene file", filename.string()));
+        }
+        size = st.st_size;
+        void *p = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED)
+            throw scene_file::error(std::format("could not map {}", filename.string()));
+        base = static_cast<const byte *>(p);
+
+        try {
+            validate();
+        } catch (...) {
+            ::munmap(const_cast<byte *>(base), size);
+            throw;
+        }
+    }
+
+    mapped_scene::~mapped_scene() {
+        ::munmap(const_cast<byte *>(base), size);
+    }
+
+    loaded_scene::loaded_scene(asset_io::buffer bytes)
+        : data(std::move(bytes)) {
+        static_assert(asset_io::direct_alignment >= blob_alignment);
+        if (data.size < sizeof(file_header))
+            throw scene_file::error("not a scene file");
+        base = data.data();
+        size = data.size;
+        validate();
+    }
+
+    /* only the spans are checked, the blobs themselves are not touched so
+     * that loading stays bound by page faults */
+    void scene_view::validate() const {
+        const file_header &h = header();
+        if (h.magic != file_magic)
+            throw scene_file::error("not a scene file");
+        if (h.version != file_version)
+            throw scene_file::error(std::format("scene file version {}, expected {}", h.version, file_version));
+        if (h.size != size)
+            throw scene_file::error("scene file is truncated or corrupt");
+
+        check(h.tables);
+        check(h.meshes);
+        check(h.textures);
+        for (const table_header &t : h.tables.get()) {
+            check(t.entities);
+            check(t.values);
+            if (t.element_size == 0 || t.values.count != t.entities.count * t.element_size)
+                throw scene_file::error("scene file is truncated or corrupt");
+        }
+        for (const mesh_blob &m : h.meshes.get()) {
+            check(m.indices);
+            check(m.positions);
+            check(m.normals);
+            check(m.texcoords);
+        }
+        for (const texture_ref &t : h.textures.get())
+            check(t.path);
+    }
+}
@@ -0,0 +1,373 @@
+module;
+#include "gl_api.h"
+
+export module shadow;
+
+import std;
+import glm;
+import gl;
+
+using std::array;
+using std::min;
+using std::size_t;
+using std::span;
+using std::uint32_t;
+using std::uint64_t;
+using std::vector;
+using namespace glm;
+
+/*
+ * shadow maps with a static cache:
+ *
+ * every map (cube face of a point light, cascade of the sun) exists twice:
+ * - static: static casters only, rendered when something it depends on
+ *   changed (light moved, a static caster in range moved, cascade scrolled),
+ *   at most update_budget renders per frame, the rest waits for later frames
+ * - final: what lighting samples, a copy of the static map with the dynamic
+ *   casters drawn on top, redone every frame only for maps that have dynamic
+ *   casters in range
+ *
+ * cascades are placed on a grid of a quarter of their radius (and a bit
+ * larger than needed), so they only scroll, and have to be rendered again,
+ * when the camera moved that far.
+ */
+
+export struct shadow_caster {
+    uint32_t mesh;
+    mat4 model;
+    /* world space radius of the bounding sphere around model[3] */
+    float radius;
+    bool dynamic;
+};
+
+/* std140 ubo read by main.frag.glsl */
+export struct alignas(vec4) shadow_uniforms {
+    mat4  cascade_matrices[4];
+    vec4  cascade_splits;       /* view space depth where cascade i ends */
+    vec4  sun;                  /* direction towards the sun, intensity */
+    int   point_shadow_count;
+    int   cascade_count;
+    float point_near;
+    float point_far;
+    float bias;
+    float _[3];
+};
+
+export struct shadow_stats {
+    int static_renders = 0;
+    int dynamic_renders = 0;
+    int pending = 0;
+};
+
+uint64_t hash_bytes(uint64_t h, const void *data, size_t size) {
+    auto *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; ++i) {
+        h ^= bytes[i];
+        h *= 0x100000001b3;
+    }
+    return h;
+}
+
+export struct shadow_system {
+    static constexpr int max_point_lights = 4;
+    static constexpr int max_cascades = 4;
+    static constexpr int faces = 6;
+
+    const int cube_size;
+    const int cascade_size;
+    int cascade_count = 3;
+    float point_near = 0.05f;
+    float point_far = 20.f;
+    float shadow_distance = 30.f;
+    float bias = 0.002f;
+    /* static map renders (cube faces and cascades) per frame */
+    int update_budget = 6;
+
+    gl::texture static_cubes;
+    gl::texture cubes;
+    gl::texture static_cascades;
+    gl::texture cascades;
+    gl::framebuffer framebuffer;
+
+    /* caster model matrices, static first, grouped by mesh */
+    struct draw_group {
+        uint32_t mesh;
+        uint32_t first;
+        uint32_t count;
+    };
+    vector<mat4> models;
+    vector<draw_group> static_groups;
+    vector<draw_group> dynamic_groups;
+    gl::buffer models_buffer;
+    size_t models_capacity = 0;
+
+    struct map_state {
+        uint64_t static_key = 0;
+        bool static_dirty = true;
+        bool final_stale = true;
+        bool has_dynamic = false;
+        mat4 view_projection = mat4(1);
+    };
+    array<map_state, max_point_lights * faces> face_states;
+    array<map_state, max_cascades> cascade_states;
+
+    gl::buffer uniform_buffer;
+    shadow_uniforms *uniforms;
+    shadow_stats stats;
+
+    shadow_system(int cube_size = 512, int cascade_size = 1024)
+        : cube_size(cube_size)
+        , cascade_size(cascade_size)
+        , static_cubes(gl::make_depth_texture(GL_TEXTURE_CUBE_MAP_ARRAY, cube_size, max_point_lights * faces))
+        , cubes(gl::make_depth_texture(GL_TEXTURE_CUBE_MAP_ARRAY, cube_size, max_point_lights * faces))
+        , static_cascades(gl::make_depth_texture(GL_TEXTURE_2D_ARRAY, cascade_size, max_cascades))
+        , cascades(gl::make_depth_texture(GL_TEXTURE_2D_ARRAY, cascade_size, max_cascades))
+        , uniform_buffer(gl::malloc(sizeof(shadow_uniforms))) {
+        uniforms = uniform_buffer.data<shadow_uniforms>();
+        *uniforms = {};
+    }
+
+    /* forces every static map to be rendered again */
+    void invalidate() {
+        for (auto &s : face_states)
+            s.static_dirty = true;
+        for (auto &s : cascade_states)
+            s.static_dirty = true;
+    }
+
+    /* sun_direction points towards the sun, camera_* describe the view the cascades cover */
+    void update(
+        gl::program &caster_program,
+        span<gl::mesh> meshes,
+        span<const shadow_caster> casters,
+        span<const vec4> lights,
+        vec4 sun,
+        const mat4 &camera_view,
+        float fov_y,
+        float aspect,
+        float camera_near,
+        ivec2 viewport
+    ) {
+        stats = {};
+        upload_casters(casters);
+
+        int light_count = min<int>(lights.size(), max_point_lights);
+        for (int i = 0; i < light_count; ++i)
+            plan_point_light(i, vec3(lights[i]), casters);
+        int count = std::clamp(cascade_count, 1, max_cascades);
+        plan_cascades(count, vec3(sun), camera_view, fov_y, aspect, camera_near, casters);
+
+        caster_program.use();
+        framebuffer.bind();
+        gl::enable(GL_POLYGON_OFFSET_FILL);
+        gl::polygon_offset(2.f, 4.f);
+        /* closed casters: back faces are far enough from the lit surface to avoid acne */
+        gl::cull_face(GL_FRONT);
+        gl::bind_shader_storage_buffer(1, models_buffer);
+
+        /* static refresh: nearest cascades first, they scroll most often */
+        int budget = update_budget;
+        for (int c = 0; c < count; ++c)
+            refresh(cascade_states[c], static_cascades, c, cascade_size, caster_program, meshes, budget);
+        for (int i = 0; i < light_count * faces; ++i)
+            refresh(face_states[i], static_cubes, i, cube_size, caster_program, meshes, budget);
+
+        gl::viewport(ivec2(cascade_size));
+        for (int c = 0; c < count; ++c)
+            compose(cascade_states[c], static_cascades, cascades, GL_TEXTURE_2D_ARRAY, c, cascade_size, caster_program, meshes);
+        gl::viewport(ivec2(cube_size));
+        for (int i = 0; i < light_count * faces; ++i)
+            compose(face_states[i], static_cubes, cubes, GL_TEXTURE_CUBE_MAP_ARRAY, i, cube_size, caster_program, meshes);
+
+        gl::cull_face(GL_BACK);
+        gl::disable(GL_POLYGON_OFFSET_FILL);
+        gl::bind_default_framebuffer();
+        gl::viewport(viewport);
+
+        for (int i = 0; i < light_count * faces; ++i)
+            stats.pending += face_states[i].static_dirty;
+        for (int c = 0; c < count; ++c)
+            stats.pending += cascade_states[c].static_dirty;
+
+        for (int c = 0; c < count; ++c)
+            uniforms->cascade_matrices[c] = cascade_states[c].view_projection;
+        uniforms->sun = sun;
+        uniforms->point_shadow_count = light_count;
+        uniforms->cascade_count = count;
+        uniforms->point_near = point_near;
+        uniforms->point_far = point_far;
+        uniforms->bias = bias;
+    }
+
+    void upload_casters(span<const shadow_caster> casters) {
+        models.clear();
+        static_groups.clear();
+        dynamic_groups.clear();
+        auto append = [&] (bool dynamic, vector<draw_group> &groups) {
+            for (size_t i = 0; i < casters.size(); ++i) {
+                const shadow_caster &c = casters[i];
+                if (c.dynamic != dynamic)
+                    continue;
+                auto g = std::ranges::find(groups, c.mesh, &draw_group::mesh);
+                if (g == groups.end())
+                    groups.push_back({c.mesh, 0, 0});
+            }
+            for (draw_group &g : groups) {
+                g.first = models.size();
+                for (const shadow_caster &c : casters)
+                    if (c.dynamic == dynamic && c.mesh == g.mesh)
+                        models.push_back(c.model);
+                g.count = models.size() - g.first;
+            }
+        };
+        append(false, static_groups);
+        append(true, dynamic_groups);
+
+        if (models.size() > models_capacity) {
+            models_capacity = std::bit_ceil(models.size());
+            models_buffer = gl::malloc(models_capacity * sizeof(mat4), GL_DYNAMIC_STORAGE_BIT);
+        }
+        if (!models.empty())
+            models_buffer.update(span(models));
+    }
+
+    static bool in_range(const shadow_caster &c, vec3 center, float range) {
+        return distance(vec3(c.model[3]), center) < range + c.radius;
+    }
+
+    /* key of the static casters in range, changes when one moves, appears or goes */
+    static uint64_t static_key(span<const shadow_caster> casters, vec3 center, float range, uint64_t seed) {
+        uint64_t h = hash_bytes(0xcbf29ce484222325, &seed, sizeof(seed));
+        for (const shadow_caster &c : casters) {
+            if (c.dynamic || !in_range(c, center, range))
+                continue;
+            h = hash_bytes(h, &c.mesh, sizeof(c.mesh));
+            h = hash_bytes(h, &c.model, sizeof(c.model));
+        }
+        return h;
+    }
+
+    static bool any_dynamic(span<const shadow_caster> casters, vec3 center, float range) {
+        return std::ranges::any_of(casters, [&] (const shadow_caster &c) {
+            return c.dynamic && in_range(c, center, range);
+        });
+    }
+
+    void plan_point_light(int light, vec3 position, span<const shadow_caster> casters) {
+        static constexpr array<vec3, faces> directions = {
+            vec3(1, 0, 0), vec3(-1, 0, 0), vec3(0, 1, 0), vec3(0, -1, 0), vec3(0, 0, 1), vec3(0, 0, -1)
+        };
+        static constexpr array<vec3, faces> ups = {
+            vec3(0, -1, 0), vec3(0, -1, 0), vec3(0, 0, 1), vec3(0, 0, -1), vec3(0, -1, 0), vec3(0, -1, 0)
+        };
+        mat4 projection = perspective(radians(90.f), 1.f, point_near, point_far);
+        uint64_t seed = hash_bytes(0, &position, sizeof(position));
+        uint64_t key = static_key(casters, position, point_far, seed);
+        bool dynamic = any_dynamic(casters, position, point_far);
+        for (int f = 0; f < faces; ++f) {
+            map_state &s = face_states[light * faces + f];
+            s.view_projection = projection * lookAt(position, position + directions[f], ups[f]);
+            if (s.static_key != key) {
+                s.static_key = key;
+                s.static_dirty = true;
+            }
+            s.has_dynamic = dynamic;
+        }
+    }
+
+    void plan_cascades(
+        int count,
+        vec3 sun_direction,
+        const mat4 &camera_view,
+        float fov_y,
+        float aspect,
+        float camera_near,
+        span<const shadow_caster> casters
+    ) {
+        vec3 up = abs(sun_direction.y) > 0.99f ? vec3(1, 0, 0) : vec3(0, 1, 0);
+        mat4 light_view = lookAt(vec3(0), -sun_direction, up);
+        mat4 inverse_view = inverse(camera_view);
+        float t = tan(fov_y / 2);
+        float previous = camera_near;
+        float far = shadow_distance;
+
+        for (int c = 0; c < count; ++c) {
+            /* practical split scheme: half uniform, half logarithmic */
+            float p = float(c + 1) / count;
+            float split = mix(camera_near + (far - camera_near) * p, camera_near * pow(far / camera_near, p), 0.5f);
+            uniforms->cascade_splits[c] = split;
+
+            vec3 center = vec3(0);
+            array<vec3, 8> corners;
+            int k = 0;
+            for (float z : {previous, split})
+                for (float sx : {-1.f, 1.f})
+                    for (float sy : {-1.f, 1.f})
+                        corners[k++] = vec3(inverse_view * vec4(sx * z * t * aspect, sy * z * t, -z, 1));
+            for (vec3 corner : corners)
+                center += corner / 8.f;
+            float radius = 0;
+            for (vec3 corner : corners)
+                radius = max(radius, distance(center, corner));
+            radius = ceil(radius * 16.f) / 16.f;
+            previous = split;
+
+            /* move in steps of whole texels, about a quarter of the radius */
+            float extent = radius * 1.25f;
+            float texel = 2 * extent / cascade_size;
+            float step = max(texel, round(radius / 4 / texel) * texel);
+            vec3 light_center = vec3(light_view * vec4(center, 1));
+            light_center = round(light_center / step) * step;
+            mat4 projection = ortho(
+                light_center.x - extent, light_center.x + extent,
+                light_center.y - extent, light_center.y + extent,
+                /* casters behind the slice still throw shadows into it */
+                -light_center.z - extent - shadow_distance, -light_center.z + extent
+            );
+
+            map_state &s = cascade_states[c];
+            s.view_projection = projection * light_view;
+            vec3 world_center = vec3(inverse(light_view) * vec4(light_center, 1));
+            uint64_t seed = hash_bytes(0, &s.view_projection, sizeof(s.view_projection));
+            uint64_t key = static_key(casters, world_center, extent * 2 + shadow_distance, seed);
+            if (s.static_key != key) {
+                s.static_key = key;
+                s.static_dirty = true;
+            }
+            s.has_dynamic = any_dynamic(casters, world_center, extent * 2 + shadow_distance);
+        }
+    }
+
+    void draw(span<const draw_group> groups, gl::program &program, span<gl::mesh> meshes, const mat4 &view_projection) {
+        program.uniform(0, view_projection);
+        for (const draw_group &g : groups)
+            meshes[g.mesh].draw(gl::DrawMode::Triangles, g.count, g.first);
+    }
+
+    void refresh(map_state &s, gl::texture &target, int layer, int size, gl::program &program, span<gl::mesh> meshes, int &budget) {
+        if (!s.static_dirty || budget <= 0)
+            return;
+        --budget;
+        gl::viewport(ivec2(size));
+        framebuffer.attach_depth_layer(target, layer);
+        framebuffer.clear_depth();
+        draw(static_groups, program, meshes, s.view_projection);
+        s.static_dirty = false;
+        s.final_stale = true;
+        stats.static_renders++;
+    }
+
+    void compose(map_state &s, gl::texture &cached, gl::texture &target, GLenum texture_target, int layer, int size, gl::program &program, span<gl::mesh> meshes) {
+        if (!s.final_stale && !s.has_dynamic)
+            return;
+        gl::copy_texture_layer(cached, target, texture_target, size, layer);
+        s.final_stale = false;
+        if (!s.has_dynamic || dynamic_groups.empty())
+            return;
+        framebuffer.attach_depth_layer(target, layer);
+        draw(dynamic_groups, program, meshes, s.view_projection);
+        /* the copy of the next frame overwrites the dynamic casters again */
+        s.final_stale = true;
+        stats.dynamic_renders++;
+    }
+};
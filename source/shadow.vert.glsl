@@ -0,0 +1,15 @@
+#version 460 core
+
+/* depth only pass into a shadow map, no fragment shader */
+
+layout (std430, binding = 1) readonly buffer _1 {
+    mat4 models[];
+};
+
+layout (location = 0) uniform mat4 light_view_projection;
+
+layout (location = 0) in vec3 position;
+
+void main() {
+    gl_Position = light_view_projection * models[gl_BaseInstance + gl_InstanceID] * vec4(position, 1.0);
+}
@@ -0,0 +1,178 @@
+export module simulation;
+
+import std;
+import glm;
+import camera;
+
+using std::array;
+using std::atomic;
+using std::bitset;
+using std::jthread;
+using std::lock_guard;
+using std::mutex;
+using std::stop_token;
+using std::uint64_t;
+using std::memory_order_acq_rel;
+using std::memory_order_relaxed;
+using std::chrono::steady_clock;
+using std::chrono::duration;
+using std::chrono::duration_cast;
+using std::this_thread::sleep_until;
+using namespace glm;
+
+/*
+ * single producer / single consumer snapshot exchange.
+ * the writer fills write_slot() and publishes it, the reader picks up
+ * the newest published slot with acquire(); neither side ever waits for
+ * the other, so a stalled renderer does not slow the simulation down
+ * and vice versa (three slots, one of them always in flight between the two).
+ */
+export template<typename T>
+struct snapshot_buffer {
+    static constexpr int fresh_bit = 4;
+
+    array<T, 3> slots;
+    int back = 0;
+    int front = 1;
+    atomic<int> middle = 2;
+
+    T &write_slot() {
+        return slots[back];
+    }
+
+    void publish() {
+        back = middle.exchange(back | fresh_bit, memory_order_acq_rel) & 3;
+    }
+
+    /* returns false if nothing new was published since the last call */
+    bool acquire() {
+        if ((middle.load(memory_order_relaxed) & fresh_bit) == 0)
+            return false;
+        front = middle.exchange(front, memory_order_acq_rel) & 3;
+        return true;
+    }
+
+    const T &read_slot() const {
+        return slots[front];
+    }
+};
+
+export struct camera_snapshot {
+    vec3 position;
+    vec3 front;
+};
+
+/* state of two consecutive ticks, the renderer interpolates between them */
+export struct world_snapshot {
+    uint64_t tick = 0;
+    double time = 0; /* when the tick was scheduled, seconds since simulation start */
+    camera_snapshot previous_camera = {};
+    camera_snapshot camera = {};
+};
+
+/* runs fixed timestep updates on its own thread, for now only the camera:
+ * no entity moves after it was created.
+ * mouse look stays on the render thread (it is a pure delta and must not lag),
+ * the camera orientation and movement keys are handed over with set_input and
+ * only the position is integrated here, so movement no longer depends on the
+ * frame rate */
+export struct simulation {
+    struct input {
+        bitset<6> movement_bits;
+        vec3 front = {0, 0, -1};
+    };
+
+    const double step;
+    /* seconds of simulation the thread may fall behind before it skips ticks */
+    const double max_lag;
+
+    lerp_camera camera;
+
+    snapshot_buffer<world_snapshot> snapshots;
+
+    mutex input_mutex;
+    input pending;
+
+    steady_clock::time_point start_time;
+    jthread thread;
+
+    simulation(double step = 1.0 / 120, double max_lag = 0.25)
+        : step(step), max_lag(max_lag) {}
+
+    ~simulation() {
+        stop();
+    }
+
+    void start() {
+        for (world_snapshot &s : snapshots.slots) {
+            s.previous_camera = {camera.position, camera.front};
+            s.camera = s.previous_camera;
+        }
+        start_time = steady_clock::now();
+        thread = jthread([this] (stop_token token) { run(token); });
+    }
+
+    void stop() {
+        if (thread.joinable()) {
+            thread.request_stop();
+            thread.join();
+        }
+    }
+
+    /* seconds since start, same time base as world_snapshot::time */
+    double now() const {
+        return duration<double>(steady_clock::now() - start_time).count();
+    }
+
+    void set_input(bitset<6> movement_bits, vec3 front) {
+        lock_guard lock(input_mutex);
+        pending.movement_bits = movement_bits;
+        pending.front = front;
+    }
+
+    /* camera of the newest snapshot at render time t */
+    camera_snapshot interpolate_camera(double t) {
+        snapshots.acquire();
+        const world_snapshot &s = snapshots.read_slot();
+        float alpha = clamp(float((t - s.time) / step), 0.f, 1.f);
+        return {
+            .position = mix(s.previous_camera.position, s.camera.position, alpha),
+            .front = normalize(mix(s.previous_camera.front, s.camera.front, alpha))
+        };
+    }
+
+    void run(stop_token token) {
+        world_snapshot state;
+        state.camera = {camera.position, camera.front};
+        auto tick_duration = duration_cast<steady_clock::duration>(duration<double>(step));
+        auto next = start_time;
+        while (!token.stop_requested()) {
+            input in;
+            {
+                lock_guard lock(input_mutex);
+                in = pending;
+            }
+            camera.movement_bits = in.movement_bits;
+            camera.front = in.front;
+            camera.update(float(step));
+
+            state.previous_camera = state.camera;
+            state.camera = {camera.position, camera.front};
+            state.tick++;
+            state.time = duration<double>(next - start_time).count();
+
+            world_snapshot &out = snapshots.write_slot();
+            out.tick = state.tick;
+            out.time = state.time;
+            out.previous_camera = state.previous_camera;
+            out.camera = state.camera;
+            snapshots.publish();
+
+            next += tick_duration;
+            auto current = steady_clock::now();
+            if (current - next > duration<double>(max_lag))
+                next = current;
+            sleep_until(next);
+        }
+    }
+};
@@ -0,0 +1,13 @@
+#version 460 core
+
+/* unlit, one cubemap fetch per pixel that no geometry covers */
+
+layout (binding = 0) uniform samplerCube sky;
+
+layout (location = 0) in vec3 direction;
+
+layout (location = 0) out vec4 color;
+
+void main() {
+    color = vec4(texture(sky, direction).rgb, 1.0);
+}
@@ -0,0 +1,27 @@
+#version 460 core
+
+/* one triangle covering the screen on the far plane, no vertex buffer */
+
+layout (std140, binding = 0) uniform _0 {
+    mat4 projection_matrix;
+    mat4 view_matrix;
+    vec3 camera_position;
+    int   enable_light;
+    float ambient;
+    float diffuse;
+    float specular;
+    int   specular_power;
+    float tess_edge_pixels;
+    float viewport_height;
+};
+
+layout (location = 0) out vec3 direction;
+
+void main() {
+    vec2 uv = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    vec4 clip = vec4(uv * 2.0 - 1.0, 1.0, 1.0);
+    vec4 view = inverse(projection_matrix) * clip;
+    /* rotation only, the sky is infinitely far */
+    direction = transpose(mat3(view_matrix)) * (view.xyz / view.w);
+    gl_Position = clip;
+}
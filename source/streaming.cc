@@ -0,0 +1,456 @@
+export module streaming;
+
+import std;
+import glm;
+import logger;
+import asset_io;
+import memory;
+
+using std::byte;
+using std::condition_variable_any;
+using std::function;
+using std::jthread;
+using std::lock_guard;
+using std::map;
+using std::mutex;
+using std::numeric_limits;
+using std::optional;
+using std::runtime_error;
+using std::size_t;
+using std::stop_token;
+using std::string;
+using std::string_view;
+using std::unique_lock;
+using std::unique_ptr;
+using std::vector;
+using std::chrono::steady_clock;
+using std::filesystem::path;
+using namespace glm;
+
+/*
+ * world streaming: the world is cut into square cells on the xz plane,
+ * every cell is one file of the world directory (cell_<x>_<z>.gscn)
+ * - two rings around the camera: cells within active_radius are drawn
+ *   (activated on the gl thread), cells within prefetch_radius are read into
+ *   memory ahead of time. both rings are also put around where the camera
+ *   will be after prefetch_seconds at its current velocity, so loading runs
+ *   ahead of the movement
+ * - reading and decoding run on the streamer's i/o thread, nearest cell
+ *   first. the request list is rebuilt every frame, cells that left the
+ *   rings before their turn are never read
+ * - memory is capped: ram_budget for cells in memory, vram_budget for
+ *   active ones. over budget the farthest cells are evicted, a cell is never
+ *   loaded or activated at the expense of a nearer one
+ * - activations per frame are capped at upload_budget bytes, entering a
+ *   dense area spreads its uploads over frames instead of hitching
+ * - cells leave a ring only half a cell past its radius, moving along a
+ *   border does not load and evict the same cells over and over
+ * - what a cell holds is up to the caller: load runs on the i/o thread and
+ *   produces a payload, activate / deactivate run on the gl thread
+ */
+
+export namespace streaming {
+    struct error: runtime_error {
+        error(string_view message)
+            : runtime_error(string(message)) {}
+    };
+
+    struct cell_coord {
+        int x;
+        int z;
+
+        auto operator<=>(const cell_coord &) const = default;
+    };
+
+    path cell_file(cell_coord c) {
+        return std::format("cell_{}_{}.gscn", c.x, c.z);
+    }
+
+    optional<cell_coord> parse_cell_file(const path &file) {
+        cell_coord c;
+        int end = 0;
+        string name = file.filename().string();
+        if (std::sscanf(name.c_str(), "cell_%d_%d.gscn%n", &c.x, &c.z, &end) != 2 || size_t(end) != name.size())
+            return std::nullopt;
+        return c;
+    }
+
+    struct config {
+        float cell_size = 32;
+        float active_radius = 64;
+        float prefetch_radius = 128;
+        float prefetch_seconds = 2;
+        size_t ram_budget = size_t(256) << 20;
+        size_t vram_budget = size_t(128) << 20;
+        size_t upload_budget = size_t(8) << 20;
+        /* time in update() above this counts as a hitch */
+        double hitch_ms = 2;
+    };
+
+    enum class cell_state {
+        unloaded,
+        /* in the request list, or being read (loading) */
+        queued,
+        loading,
+        loaded,
+        active
+    };
+
+    struct metrics {
+        /* residency, this frame */
+        size_t ram_used = 0;
+        size_t vram_used = 0;
+        int queued = 0;
+        int loading = 0;
+        int loaded = 0;
+        int active = 0;
+        /* cells in the active ring that are not drawn, they pop in late */
+        int missing = 0;
+        /* wanted, but the budget is taken by nearer cells */
+        int over_ram_budget = 0;
+        int over_vram_budget = 0;
+
+        /* since start */
+        size_t loads = 0;
+        size_t failed = 0;
+        size_t activations = 0;
+        size_t evictions = 0;
+        /* read, but out of the rings by the time they arrived */
+        size_t wasted = 0;
+
+        /* i/o thread */
+        size_t bytes_read = 0;
+        size_t files_read = 0;
+        double read_seconds = 0;
+
+        /* gl thread */
+        double update_ms = 0;
+        double worst_update_ms = 0;
+        size_t hitches = 0;
+
+        /* bytes per second while reading */
+        double read_throughput() const {
+            return read_seconds > 0 ? bytes_read / read_seconds : 0;
+        }
+    };
+
+    /* what load produced, owned by the streamer until the cell is evicted */
+    template<typename Payload>
+    struct loaded_cell {
+        unique_ptr<Payload> payload;
+        /* while in memory */
+        size_t ram_bytes;
+        /* while active */
+        size_t vram_bytes;
+    };
+
+    template<typename Payload>
+    struct streamer {
+        /* i/o thread, throws on failure */
+        using load_function = function<loaded_cell<Payload>(cell_coord, const path &, asset_io::reader &)>;
+        /* gl thread */
+        using activate_function = function<void(cell_coord, Payload &)>;
+        using deactivate_function = function<void(cell_coord, Payload &)>;
+
+        struct cell {
+            path file;
+            /* the file size until the cell was loaded once */
+            size_t ram_bytes;
+            size_t vram_bytes = 0;
+            cell_state state = cell_state::unloaded;
+            /* xz distance to the nearer of the camera and its predicted position */
+            float distance = numeric_limits<float>::infinity();
+            unique_ptr<Payload> payload;
+        };
+
+        using cell_iterator = typename map<cell_coord, cell>::iterator;
+
+        /* file points into cells, whose nodes never move */
+        struct request {
+            cell_coord coord;
+            const path *file;
+        };
+
+        struct completion {
+            cell_coord coord;
+            optional<loaded_cell<Payload>> result;
+        };
+
+        config settings;
+        load_function load;
+        activate_function activate;
+        deactivate_function deactivate;
+        map<cell_coord, cell> cells;
+        metrics stats;
+        /* used by the i/o thread only */
+        asset_io::reader io;
+
+        mutex queue_mutex;
+        condition_variable_any queue_changed;
+        /* nearest last, the i/o thread takes from the back */
+        vector<request> requests;
+        vector<completion> completions;
+        jthread thread;
+
+        /* throws streaming::error if directory can not be listed */
+        streamer(
+            const path &directory,
+            config settings,
+            load_function load,
+            activate_function activate,
+            deactivate_function deactivate
+        ) : settings(settings)
+          , load(std::move(load))
+          , activate(std::move(activate))
+          , deactivate(std::move(deactivate)) {
+            std::error_code ec;
+            for (const auto &entry : std::filesystem::directory_iterator(directory, ec)) {
+                optional<cell_coord> c = parse_cell_file(entry.path());
+                if (c && entry.is_regular_file())
+                    cells.emplace(*c, cell{entry.path(), size_t(entry.file_size())});
+            }
+            if (ec)
+                throw streaming::error(std::format("could not list {}: {}", directory.string(), ec.message()));
+            logger::info("world {}: {} cells", directory.c_str(), cells.size());
+            thread = jthread([this] (stop_token token) { run(token); });
+        }
+
+        /* active cells are not deactivated, the gl objects go with the context */
+        ~streamer() {
+            thread.request_stop();
+            if (thread.joinable())
+                thread.join();
+        }
+
+        streamer(const streamer &) = delete;
+        streamer & operator=(const streamer &) = delete;
+
+        /* once per frame on the gl thread, velocity in units per second */
+        void update(vec3 position, vec3 velocity) {
+            auto start = steady_clock::now();
+            vec3 ahead = position + velocity * settings.prefetch_seconds;
+            for (auto &[coord, c] : cells)
+                c.distance = min(distance(coord, position), distance(coord, ahead));
+
+            take_completions();
+            release_far_cells();
+            schedule_loads();
+            activate_near_cells();
+            count();
+
+            stats.update_ms = std::chrono::duration<double, std::milli>(steady_clock::now() - start).count();
+            stats.worst_update_ms = std::max(stats.worst_update_ms, stats.update_ms);
+            if (stats.update_ms > settings.hitch_ms)
+                stats.hitches++;
+        }
+
+    private:
+        /* to the nearest point of the cell */
+        float distance(cell_coord c, vec3 p) const {
+            vec2 low = vec2(c.x, c.z) * settings.cell_size;
+            vec2 nearest = clamp(vec2(p.x, p.z), low, low + settings.cell_size);
+            return length(vec2(p.x, p.z) - nearest);
+        }
+
+        float hysteresis() const {
+            return settings.cell_size * 0.5f;
+        }
+
+        void run(stop_token token) {
+            while (true) {
+                request r;
+                {
+                    unique_lock lock(queue_mutex);
+                    if (!queue_changed.wait(lock, token, [&] { return !requests.empty(); }))
+                        return;
+                    r = std::move(requests.back());
+                    requests.pop_back();
+                }
+                completion done = {r.coord, std::nullopt};
+                try {
+                    done.result = load(r.coord, *r.file, io);
+                } catch (const std::exception &e) {
+                    logger::warn("could not load {}: {}", r.file->c_str(), e.what());
+                }
+                lock_guard lock(queue_mutex);
+                completions.push_back(std::move(done));
+            }
+        }
+
+        void take_completions() {
+            vector<completion> done;
+            {
+                lock_guard lock(queue_mutex);
+                done = std::exchange(completions, {});
+            }
+            for (completion &d : done) {
+                cell &c = cells.at(d.coord);
+                if (!d.result) {
+                    stats.failed++;
+                    c.state = cell_state::unloaded;
+                    continue;
+                }
+                stats.loads++;
+                c.ram_bytes = d.result->ram_bytes;
+                c.vram_bytes = d.result->vram_bytes;
+                if (c.distance > settings.prefetch_radius + hysteresis()) {
+                    stats.wasted++;
+                    c.state = cell_state::unloaded;
+                    continue;
+                }
+                c.payload = std::move(d.result->payload);
+                c.state = cell_state::loaded;
+            }
+        }
+
+        void deactivate_cell(cell_coord coord, cell &c) {
+            deactivate(coord, *c.payload);
+            c.state = cell_state::loaded;
+        }
+
+        void evict(cell_coord coord, cell &c) {
+            if (c.state == cell_state::active)
+                deactivate_cell(coord, c);
+            c.payload.reset();
+            c.state = cell_state::unloaded;
+            stats.evictions++;
+        }
+
+        void release_far_cells() {
+            for (auto &[coord, c] : cells) {
+                if (c.state == cell_state::active && c.distance > settings.active_radius + hysteresis())
+                    deactivate_cell(coord, c);
+                if (c.state == cell_state::loaded && c.distance > settings.prefetch_radius + hysteresis())
+                    evict(coord, c);
+            }
+        }
+
+        size_t ram_used() const {
+            size_t used = 0;
+            for (const auto &[coord, c] : cells)
+                if (c.state != cell_state::unloaded)
+                    used += c.ram_bytes;
+            return used;
+        }
+
+        size_t vram_used() const {
+            size_t used = 0;
+            for (const auto &[coord, c] : cells)
+                if (c.state == cell_state::active)
+                    used += c.vram_bytes;
+            return used;
+        }
+
+        /* frees bytes by evicting (active_only: deactivating) cells farther
+         * than limit, farthest first. false if the budget can not be met */
+        bool make_room(size_t &used, size_t needed, size_t budget, float limit, bool active_only) {
+            if (used + needed <= budget)
+                return true;
+            std::pmr::vector<cell_iterator> victims(&memory::frame());
+            for (auto it = cells.begin(); it != cells.end(); ++it) {
+                cell_state s = it->second.state;
+                bool evictable = active_only ? s == cell_state::active : s == cell_state::loaded || s == cell_state::active;
+                if (evictable && it->second.distance > limit)
+                    victims.push_back(it);
+            }
+            std::ranges::sort(victims, std::greater<>(), [] (auto it) { return it->second.distance; });
+            for (auto it : victims) {
+                if (used + needed <= budget)
+                    break;
+                cell &c = it->second;
+                if (active_only) {
+                    used -= c.vram_bytes;
+                    deactivate_cell(it->first, c);
+                } else {
+                    used -= c.ram_bytes;
+                    evict(it->first, c);
+                }
+            }
+            return used + needed <= budget;
+        }
+
+        /* requests are rebuilt from scratch: what the i/o thread took is loading,
+         * queued cells that are not wanted anymore go back to unloaded */
+        void schedule_loads() {
+            lock_guard lock(queue_mutex);
+            for (auto &[coord, c] : cells) {
+                if (c.state != cell_state::queued)
+                    continue;
+                bool waiting = std::ranges::any_of(requests, [&] (const request &r) { return r.coord == coord; });
+                c.state = waiting ? cell_state::unloaded : cell_state::loading;
+            }
+
+            std::pmr::vector<cell_iterator> wanted(&memory::frame());
+            for (auto it = cells.begin(); it != cells.end(); ++it)
+                if (it->second.state == cell_state::unloaded && it->second.distance <= settings.prefetch_radius)
+                    wanted.push_back(it);
+            std::ranges::sort(wanted, {}, [] (auto it) { return it->second.distance; });
+
+            size_t used = ram_used();
+            requests.clear();
+            stats.over_ram_budget = 0;
+            for (size_t i = 0; i < wanted.size(); ++i) {
+                auto it = wanted[i];
+                cell &c = it->second;
+                if (!make_room(used, c.ram_bytes, settings.ram_budget, c.distance, false)) {
+                    stats.over_ram_budget = wanted.size() - i;
+                    break;
+                }
+                used += c.ram_bytes;
+                c.state = cell_state::queued;
+                requests.push_back({it->first, &c.file});
+            }
+            std::ranges::reverse(requests);
+            if (!requests.empty())
+                queue_changed.notify_one();
+        }
+
+        void activate_near_cells() {
+            std::pmr::vector<cell_iterator> near(&memory::frame());
+            for (auto it = cells.begin(); it != cells.end(); ++it)
+                if (it->second.state == cell_state::loaded && it->second.distance <= settings.active_radius)
+                    near.push_back(it);
+            std::ranges::sort(near, {}, [] (auto it) { return it->second.distance; });
+
+            size_t used = vram_used();
+            size_t uploaded = 0;
+            stats.over_vram_budget = 0;
+            for (size_t i = 0; i < near.size(); ++i) {
+                auto it = near[i];
+                cell &c = it->second;
+                /* at least one per frame, whatever its size */
+                if (uploaded > 0 && uploaded + c.vram_bytes > settings.upload_budget)
+                    break;
+                if (!make_room(used, c.vram_bytes, settings.vram_budget, c.distance, true)) {
+                    stats.over_vram_budget = near.size() - i;
+                    break;
+                }
+                activate(it->first, *c.payload);
+                c.state = cell_state::active;
+                used += c.vram_bytes;
+                uploaded += c.vram_bytes;
+                stats.activations++;
+            }
+        }
+
+        void count() {
+            stats.queued = stats.loading = stats.loaded = stats.active = stats.missing = 0;
+            for (const auto &[coord, c] : cells) {
+                switch (c.state) {
+                    case cell_state::unloaded: break;
+                    case cell_state::queued:   stats.queued++; break;
+                    case cell_state::loading:  stats.loading++; break;
+                    case cell_state::loaded:   stats.loaded++; break;
+                    case cell_state::active:   stats.active++; break;
+                }
+                if (c.state != cell_state::active && c.distance <= settings.active_radius)
+                    stats.missing++;
+            }
+            stats.ram_used = ram_used();
+            stats.vram_used = vram_used();
+            stats.bytes_read = io.bytes.load();
+            stats.files_read = io.files.load();
+            stats.read_seconds = io.nanoseconds.load() / 1e9;
+        }
+    };
+}
@@ -0,0 +1,86 @@
+#version 460 core
+
+struct instance_data {
+    mat4 normal_matrix;
+    mat4 model;
+    vec4 color;
+    int  texture_index;
+    int  _[27];
+};
+
+layout (std140, binding = 0) uniform _0 {
+    mat4 projection_matrix;
+    mat4 view_matrix;
+    vec3 camera_position;
+    int   enable_light;
+    float ambient;
+    float diffuse;
+    float specular;
+    int   specular_power;
+    float tess_edge_pixels;
+    float viewport_height;
+};
+
+layout (std430, binding = 1) buffer _1 {
+    instance_data instances[];
+};
+
+/* 0 = sphere, 1 = torus, 2 = helicoid (same functions as geometry.cc) */
+layout (constant_id = 1) const int surface_kind = 0;
+
+layout (vertices = 4) out;
+
+layout (location = 0) in vec2 control_uv[];
+layout (location = 1) in flat int control_instance[];
+
+layout (location = 0) out vec2 patch_uv[];
+layout (location = 1) patch out int patch_instance;
+
+const float pi = 3.14159265358979;
+
+vec3 surface(vec2 uv) {
+    if (surface_kind == 0) {
+        float theta = uv.x * 2.0 * pi;
+        float phi = uv.y * pi;
+        return vec3(cos(theta) * sin(phi), cos(phi), sin(theta) * sin(phi));
+    } else if (surface_kind == 1) {
+        float theta = uv.x * 2.0 * pi;
+        float phi = uv.y * 2.0 * pi;
+        float R = 1.0;
+        float r = 0.5;
+        return vec3((R + r * cos(phi)) * cos(theta), (R + r * cos(phi)) * sin(theta), r * sin(phi));
+    } else {
+        float u = uv.x * 2.0 * pi;
+        float v = uv.y * 2.0 * pi;
+        return vec3(u * cos(v), u * sin(v), v);
+    }
+}
+
+/* the level of an edge depends only on its two end points, so patches sharing
+ * an edge always agree on it and there are no cracks */
+float edge_level(vec3 a, vec3 b) {
+    float pixels_per_unit = projection_matrix[1][1] * viewport_height / 2.0;
+    float d = max(distance(camera_position, (a + b) / 2.0), 1e-3);
+    float pixels = distance(a, b) * pixels_per_unit / d;
+    return clamp(pixels / tess_edge_pixels, 1.0, 64.0);
+}
+
+void main() {
+    patch_uv[gl_InvocationID] = control_uv[gl_InvocationID];
+    if (gl_InvocationID != 0)
+        return;
+
+    patch_instance = control_instance[0];
+    mat4 model = instances[control_instance[0]].model;
+    vec3 p0 = (model * vec4(surface(control_uv[0]), 1.0)).xyz;
+    vec3 p1 = (model * vec4(surface(control_uv[1]), 1.0)).xyz;
+    vec3 p2 = (model * vec4(surface(control_uv[2]), 1.0)).xyz;
+    vec3 p3 = (model * vec4(surface(control_uv[3]), 1.0)).xyz;
+
+    gl_TessLevelOuter[0] = edge_level(p0, p3); /* u = 0 */
+    gl_TessLevelOuter[1] = edge_level(p0, p1); /* v = 0 */
+    gl_TessLevelOuter[2] = edge_level(p1, p2); /* u = 1 */
+    gl_TessLevelOuter[3] = edge_level(p3, p2); /* v = 1 */
+    gl_TessLevelInner[0] = max(gl_TessLevelOuter[1], gl_TessLevelOuter[3]);
+    gl_TessLevelInner[1] = max(gl_TessLevelOuter[0], gl_TessLevelOuter[2]);
+}
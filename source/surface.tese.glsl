@@ -0,0 +1,88 @@
+#version 460 core
+
+struct instance_data {
+    mat4 normal_matrix;
+    mat4 model;
+    vec4 color;
+    int  texture_index;
+    int  _[27];
+};
+
+layout (std140, binding = 0) uniform _0 {
+    mat4 projection_matrix;
+    mat4 view_matrix;
+    vec3 camera_position;
+    int   enable_light;
+    float ambient;
+    float diffuse;
+    float specular;
+    int   specular_power;
+    float tess_edge_pixels;
+    float viewport_height;
+};
+
+layout (std430, binding = 1) buffer _1 {
+    instance_data instances[];
+};
+
+/* 0 = sphere, 1 = torus, 2 = helicoid (same functions as geometry.cc) */
+layout (constant_id = 1) const int surface_kind = 0;
+
+/* (u, v) counter clockwise is the outside of every surface,
+ * same winding as generate_grid_indices */
+layout (quads, fractional_even_spacing, ccw) in;
+
+layout (location = 0) in vec2 patch_uv[];
+layout (location = 1) patch in int patch_instance;
+
+layout (location = 0) out vec3 fragment_position;
+layout (location = 1) out vec3 fragment_normal;
+layout (location = 2) out vec2 fragment_texcoords;
+layout (location = 3) out flat vec4 instance_color;
+layout (location = 4) out flat  int instance_texture_index;
+
+const float pi = 3.14159265358979;
+
+vec3 surface(vec2 uv, out vec3 normal) {
+    if (surface_kind == 0) {
+        float theta = uv.x * 2.0 * pi;
+        float phi = uv.y * pi;
+        vec3 p = vec3(cos(theta) * sin(phi), cos(phi), sin(theta) * sin(phi));
+        normal = p;
+        return p;
+    } else if (surface_kind == 1) {
+        float theta = uv.x * 2.0 * pi;
+        float phi = uv.y * 2.0 * pi;
+        float R = 1.0;
+        float r = 0.5;
+        normal = vec3(cos(phi) * cos(theta), cos(phi) * sin(theta), sin(phi));
+        return vec3((R + r * cos(phi)) * cos(theta), (R + r * cos(phi)) * sin(theta), r * sin(phi));
+    } else {
+        float u = uv.x * 2.0 * pi;
+        float v = uv.y * 2.0 * pi;
+        /* cross(dF/du, dF/dv) */
+        normal = normalize(vec3(sin(v), -cos(v), u));
+        return vec3(u * cos(v), u * sin(v), v);
+    }
+}
+
+void main() {
+    vec2 uv = mix(
+        mix(patch_uv[0], patch_uv[1], gl_TessCoord.x),
+        mix(patch_uv[3], patch_uv[2], gl_TessCoord.x),
+        gl_TessCoord.y);
+
+    instance_data data = instances[patch_instance];
+    vec3 normal;
+    vec4 world_position = data.model * vec4(surface(uv, normal), 1.0);
+
+    fragment_position = world_position.xyz;
+    fragment_normal = mat3(data.normal_matrix) * normal;
+    /* generate_texcoords runs u backwards */
+    fragment_texcoords = vec2(1.0 - uv.x, uv.y);
+
+    instance_color = data.color;
+    instance_texture_index = data.texture_index;
+
+    gl_Position = projection_matrix * view_matrix * world_position;
+}
@@ -0,0 +1,12 @@
+#version 460 core
+
+/* control points of the coarse patch grid, position.xy = (u, v) */
+layout (location = 0) in vec3 position;
+
+layout (location = 0) out vec2 control_uv;
+layout (location = 1) out flat int control_instance;
+
+void main() {
+    control_uv = position.xy;
+    control_instance = gl_InstanceID;
+}
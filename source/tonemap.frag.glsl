@@ -0,0 +1,26 @@
+#version 460 core
+
+/* hdr scene + bloom -> display. aces filmic fit (narkowicz), the
+ * framebuffer is not srgb so the output stays in the same space the
+ * textures were authored in */
+
+layout (binding = 0) uniform sampler2D bloom;
+/* an image: sampler units above 0 hold the shadow maps and textures */
+layout (binding = 1, rgba16f) uniform readonly image2D scene;
+
+layout (location = 0) uniform float exposure;
+layout (location = 1) uniform float bloom_strength;
+
+layout (location = 0) in vec2 uv;
+
+layout (location = 0) out vec4 fragment_color;
+
+vec3 aces(vec3 x) {
+    return clamp((x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14), 0.0, 1.0);
+}
+
+void main() {
+    vec3 color = imageLoad(scene, ivec2(gl_FragCoord.xy)).rgb;
+    color += textureLod(bloom, uv, 0).rgb * bloom_strength;
+    fragment_color = vec4(aces(color * exposure), 1.0);
+}
@@ -0,0 +1,10 @@
+#version 460 core
+
+/* one triangle covering the screen, no vertex buffer */
+
+layout (location = 0) out vec2 uv;
+
+void main() {
+    uv = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(uv * 2.0 - 1.0, 0.0, 1.0);
+}
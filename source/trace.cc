@@ -0,0 +1,456 @@
+module;
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+export module trace;
+
+import std;
+
+using std::array;
+using std::atomic;
+using std::atomic_ref;
+using std::bit_width;
+using std::byte;
+using std::format_string;
+using std::format_to_n;
+using std::is_convertible_v;
+using std::is_floating_point_v;
+using std::is_integral_v;
+using std::is_null_pointer_v;
+using std::is_pointer_v;
+using std::is_same_v;
+using std::is_signed_v;
+using std::memcpy;
+using std::memory_order_acquire;
+using std::memory_order_relaxed;
+using std::memory_order_release;
+using std::min;
+using std::remove_cvref_t;
+using std::runtime_error;
+using std::size_t;
+using std::span;
+using std::string;
+using std::string_view;
+using std::type_identity_t;
+using std::uint8_t;
+using std::uint16_t;
+using std::uint32_t;
+using std::uint64_t;
+using std::uintptr_t;
+using std::int64_t;
+using std::filesystem::path;
+using std::chrono::steady_clock;
+using std::chrono::system_clock;
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::milliseconds;
+
+/*
+ * binary trace file:
+ *
+ * file_header | definitions ... | ring ...
+ *
+ * - a definition maps a format id to its format string and argument tags,
+ *   it is written once per id and never overwritten
+ * - the ring holds records: record_header followed by the encoded arguments,
+ *   records are 8 byte aligned and wrap around, the oldest are overwritten
+ * - ring_head is the total number of bytes ever written to the ring,
+ *   a decoder starts from max(ring_head - ring_capacity, 0) and resyncs on
+ *   record_marker
+ */
+
+export namespace trace {
+    constexpr uint32_t file_magic = 0x63727467; /* "gtrc" */
+    constexpr uint32_t file_version = 1;
+    constexpr uint16_t record_marker = 0x7e7e;
+    constexpr size_t max_record_size = 1024;
+
+    enum class arg : uint8_t {
+        i8, i16, i32, i64,
+        u8, u16, u32, u64,
+        f32, f64,
+        boolean, character, pointer,
+        /* uint32_t length + characters */
+        string
+    };
+
+    struct file_header {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t tsc_frequency;
+        uint64_t tsc_origin;
+        int64_t  utc_origin; /* nanoseconds since epoch at tsc_origin */
+        uint64_t definitions_offset;
+        uint64_t definitions_capacity;
+        uint64_t definitions_size;
+        uint64_t ring_offset;
+        uint64_t ring_capacity;
+        uint64_t ring_head;
+    };
+
+    struct definition_header {
+        uint64_t id;
+        uint32_t size; /* including header, 8 byte aligned */
+        uint16_t format_size;
+        uint8_t  arg_count;
+        uint8_t  _;
+        /* arg[arg_count], char[format_size] */
+    };
+
+    struct record_header {
+        uint16_t marker;
+        uint8_t  level;
+        uint8_t  _;
+        uint32_t size; /* including header, 8 byte aligned */
+        uint64_t id;
+        uint64_t tsc;
+        uint32_t thread;
+        uint32_t __;
+        /* encoded arguments */
+    };
+
+    static_assert(sizeof(record_header) == 32);
+    static_assert(sizeof(definition_header) == 16);
+
+    constexpr size_t align8(size_t n) {
+        return (n + 7) & ~size_t(7);
+    }
+
+    template<typename T>
+    consteval arg tag_of() {
+        using D = remove_cvref_t<T>;
+        if constexpr (is_same_v<D, bool>) {
+            return arg::boolean;
+        } else if constexpr (is_same_v<D, char>) {
+            return arg::character;
+        } else if constexpr (is_integral_v<D>) {
+            constexpr arg s[] = {arg::i8, arg::i16, arg::i32, arg::i64};
+            constexpr arg u[] = {arg::u8, arg::u16, arg::u32, arg::u64};
+            constexpr int k = bit_width(sizeof(D)) - 1;
+            return is_signed_v<D> ? s[k] : u[k];
+        } else if constexpr (is_floating_point_v<D>) {
+            return sizeof(D) == sizeof(float) ? arg::f32 : arg::f64;
+        } else if constexpr (is_convertible_v<const D &, string_view>) {
+            return arg::string;
+        } else if constexpr (is_pointer_v<D> || is_null_pointer_v<D>) {
+            return arg::pointer;
+        } else {
+            /* anything else is formatted with "{}" and stored as a string */
+            return arg::string;
+        }
+    }
+
+    constexpr uint64_t fnv1a(span<const char> data, uint64_t hash = 0xcbf29ce484222325) {
+        for (char c : data) {
+            hash ^= static_cast<uint8_t>(c);
+            hash *= 0x100000001b3;
+        }
+        return hash;
+    }
+
+    /* id of a format string together with the argument tags,
+     * the same string logged with different argument types gets different ids */
+    template<typename... Args>
+    constexpr uint64_t make_id(string_view fmt) {
+        constexpr char tags[] = {static_cast<char>(tag_of<Args>())..., 0};
+        uint64_t id = fnv1a(span(tags, sizeof...(Args)), fnv1a(fmt));
+        return id == 0 ? 1 : id;
+    }
+
+    /* format_string that also carries its compile time id */
+    template<typename... Args>
+    struct basic_format {
+        format_string<Args...> fmt;
+        uint64_t id;
+
+        template<typename S> requires is_convertible_v<const S &, string_view>
+        consteval basic_format(const S &s)
+            : fmt(s), id(make_id<Args...>(string_view(s))) {}
+
+        constexpr string_view get() const {
+            return fmt.get();
+        }
+    };
+
+    template<typename... Args>
+    using format = basic_format<type_identity_t<Args>...>;
+
+    struct error: runtime_error {
+        error(string_view message)
+            : runtime_error(string(message)) {}
+    };
+
+    uint64_t timestamp() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+}
+
+namespace trace::detail {
+    /* arguments are encoded into a thread local record before
+     * a single copy into the ring */
+    struct encoder {
+        array<byte, max_record_size> data;
+        size_t size;
+
+        void put(const void *p, size_t n) {
+            n = min(n, data.size() - size);
+            memcpy(data.data() + size, p, n);
+            size += n;
+        }
+
+        void text(string_view s) {
+            size_t room = data.size() - min(data.size(), size + sizeof(uint32_t));
+            uint32_t n = min(s.size(), room);
+            put(&n, sizeof(n));
+            put(s.data(), n);
+        }
+
+        template<typename T>
+        void formatted(const T &value) {
+            if (size + 4 > data.size()) {
+                size = data.size();
+                return;
+            }
+            char *out = reinterpret_cast<char *>(data.data() + size + 4);
+            size_t limit = data.size() - size - 4;
+            uint32_t n = min<size_t>(format_to_n(out, limit, "{}", value).size, limit);
+            memcpy(data.data() + size, &n, sizeof(n));
+            size += 4 + n;
+        }
+
+        template<typename T>
+        void value(const T &value) {
+            using D = remove_cvref_t<T>;
+            constexpr arg tag = tag_of<T>();
+            if constexpr (tag == arg::pointer) {
+                uint64_t p = 0;
+                if constexpr (is_pointer_v<D>)
+                    p = reinterpret_cast<uintptr_t>(value);
+                put(&p, sizeof(p));
+            } else if constexpr (tag == arg::string) {
+                if constexpr (is_pointer_v<D>)
+                    text(value != nullptr ? string_view(value) : string_view("(null)"));
+                else if constexpr (is_convertible_v<const D &, string_view>)
+                    text(string_view(value));
+                else
+                    formatted(value);
+            } else if constexpr (tag == arg::f64) {
+                double d = value;
+                put(&d, sizeof(d));
+            } else {
+                put(&value, sizeof(D));
+            }
+        }
+    };
+
+    thread_local encoder record;
+    thread_local const uint32_t thread_id = ::gettid();
+
+    /* taken by a writer before it touches its file, active is only set once
+     * the file is ready */
+    atomic<bool> writer_claimed = false;
+
+    /* write calls between their load of active and their last access to the
+     * writer, ~writer waits for them after clearing active */
+    atomic<unsigned> writes_in_flight = 0;
+
+    struct in_flight {
+        in_flight() { writes_in_flight.fetch_add(1); }
+        ~in_flight() { writes_in_flight.fetch_sub(1, memory_order_release); }
+    };
+}
+
+export namespace trace {
+    /* memory-mapped trace file, while it exists logger writes records here
+     * instead of text; destroying it waits for the writes still running */
+    struct writer {
+        static constexpr size_t seen_capacity = 4096;
+
+        int fd = -1;
+        byte *base = nullptr;
+        size_t mapped_size = 0;
+        file_header *header = nullptr;
+        byte *definitions = nullptr;
+        byte *ring = nullptr;
+        array<atomic<uint64_t>, seen_capacity> seen = {};
+        /* the definition of seen[i] is in the file (or did not fit) */
+        array<atomic<bool>, seen_capacity> defined = {};
+
+        writer(
+            const path &filename,
+            size_t ring_capacity = 64 << 20,
+            size_t definitions_capacity = 1 << 20
+        );
+        ~writer();
+
+        writer(const writer &) = delete;
+        writer & operator=(const writer &) = delete;
+
+        void define(uint64_t id, span<const arg> tags, string_view fmt);
+        void commit(const byte *data, size_t size);
+    };
+
+    atomic<writer *> active = nullptr;
+
+    bool enabled() {
+        return active.load(memory_order_relaxed) != nullptr;
+    }
+
+    template<typename... Args>
+    void write(unsigned level, uint64_t id, string_view fmt, const Args &... args) {
+        /* counted before active is loaded, both sequentially consistent */
+        detail::in_flight guard;
+        writer *w = active.load();
+        if (w == nullptr)
+            return;
+
+        static constexpr array<arg, sizeof...(Args)> tags = {tag_of<Args>()...};
+        w->define(id, tags, fmt);
+
+        auto &e = detail::record;
+        e.size = sizeof(record_header);
+        (e.value(args), ...);
+        size_t size = min(align8(e.size), e.data.size());
+        std::fill(e.data.begin() + e.size, e.data.begin() + size, byte{0});
+
+        record_header h = {
+            .marker = record_marker,
+            .level = static_cast<uint8_t>(level),
+            .size = static_cast<uint32_t>(size),
+            .id = id,
+            .tsc = timestamp(),
+            .thread = detail::thread_id
+        };
+        memcpy(e.data.data(), &h, sizeof(h));
+        w->commit(e.data.data(), size);
+    }
+
+    uint64_t measure_tsc_frequency() {
+#if defined(__x86_64__) || defined(__i386__)
+        auto t0 = steady_clock::now();
+        uint64_t c0 = timestamp();
+        std::this_thread::sleep_for(milliseconds(10));
+        auto t1 = steady_clock::now();
+        uint64_t c1 = timestamp();
+        double seconds = std::chrono::duration<double>(t1 - t0).count();
+        return static_cast<uint64_t>((c1 - c0) / seconds);
+#else
+        return 1'000'000'000;
+#endif
+    }
+
+    writer::writer(const path &filename, size_t ring_capacity, size_t definitions_capacity) {
+        ring_capacity = align8(ring_capacity);
+        definitions_capacity = align8(definitions_capacity);
+        size_t definitions_offset = align8(sizeof(file_header));
+        size_t ring_offset = definitions_offset + definitions_capacity;
+        mapped_size = ring_offset + ring_capacity;
+
+        /* before the file: it may be the active writer's */
+        bool expected = false;
+        if (!writer_claimed.compare_exchange_strong(expected, true, memory_order_acquire))
+            throw trace::error("another trace writer is already active");
+        auto fail = [&] (string_view what) {
+            if (fd >= 0)
+                ::close(fd);
+            writer_claimed.store(false, memory_order_release);
+            throw trace::error(std::format("could not {} {}", what, filename.string()));
+        };
+        fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            fail("open");
+        if (::ftruncate(fd, mapped_size) != 0)
+            fail("resize");
+        void *p = ::mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED)
+            fail("map");
+
+        base = static_cast<byte *>(p);
+        header = reinterpret_cast<file_header *>(base);
+        definitions = base + definitions_offset;
+        ring = base + ring_offset;
+        *header = {
+            .magic = file_magic,
+            .version = file_version,
+            .tsc_frequency = measure_tsc_frequency(),
+            .tsc_origin = timestamp(),
+            .utc_origin = duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count(),
+            .definitions_offset = definitions_offset,
+            .definitions_capacity = definitions_capacity,
+            .definitions_size = 0,
+            .ring_offset = ring_offset,
+            .ring_capacity = ring_capacity,
+            .ring_head = 0
+        };
+        active.store(this, memory_order_release);
+    }
+
+    writer::~writer() {
+        active.store(nullptr);
+        /* a write that still saw this writer counted itself before */
+        while (detail::writes_in_flight.load(memory_order_acquire) != 0)
+            std::this_thread::yield();
+        ::munmap(base, mapped_size);
+        ::close(fd);
+        writer_claimed.store(false, memory_order_release);
+    }
+
+    void writer::define(uint64_t id, span<const arg> tags, string_view fmt) {
+        /* open addressing set of ids that have or are getting a definition,
+         * the thread that claimed an id appends it while the others wait for
+         * it, so no record of the id comes before its definition */
+        size_t i = id % seen_capacity;
+        atomic<bool> *claimed = nullptr;
+        for (size_t probe = 0; probe < seen_capacity; ++probe, i = (i + 1) % seen_capacity) {
+            uint64_t current = seen[i].load(memory_order_relaxed);
+            if (current == 0 && seen[i].compare_exchange_strong(current, id, memory_order_relaxed)) {
+                claimed = &defined[i];
+                break;
+            }
+            if (current == id) {
+                while (!defined[i].load(memory_order_acquire))
+                    std::this_thread::yield();
+                return;
+            }
+        }
+
+        fmt = fmt.substr(0, std::numeric_limits<uint16_t>::max());
+        size_t size = align8(sizeof(definition_header) + tags.size() + fmt.size());
+        uint64_t offset = atomic_ref(header->definitions_size).fetch_add(size, memory_order_relaxed);
+        if (offset + size > header->definitions_capacity) {
+            if (claimed != nullptr)
+                claimed->store(true, memory_order_release);
+            return;
+        }
+
+        definition_header h = {
+            .id = id,
+            .size = static_cast<uint32_t>(size),
+            .format_size = static_cast<uint16_t>(fmt.size()),
+            .arg_count = static_cast<uint8_t>(tags.size())
+        };
+        byte *out = definitions + offset;
+        memcpy(out, &h, sizeof(h));
+        memcpy(out + sizeof(h), tags.data(), tags.size());
+        memcpy(out + sizeof(h) + tags.size(), fmt.data(), fmt.size());
+        if (claimed != nullptr)
+            claimed->store(true, memory_order_release);
+    }
+
+    void writer::commit(const byte *data, size_t size) {
+        uint64_t head = atomic_ref(header->ring_head).fetch_add(size, memory_order_relaxed);
+        size_t capacity = header->ring_capacity;
+        size_t offset = head % capacity;
+        size_t first = min(size, capacity - offset);
+        memcpy(ring + offset, data, first);
+        memcpy(ring, data + first, size - first);
+    }
+}
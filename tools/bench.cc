@@ -0,0 +1,1083 @@
+#include <entt/entity/registry.hpp>
+#include <GL/glcorearb.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+import std;
+import glm;
+
+import asset_io;
+import bvh;
+import camera;
+import commands;
+import ecs;
+import geometry;
+import jobs;
+import logger;
+import memory;
+import planet;
+import render_graph;
+import trace;
+
+using std::array;
+using std::function;
+using std::optional;
+using std::print;
+using std::println;
+using std::size_t;
+using std::span;
+using std::string;
+using std::string_view;
+using std::uint32_t;
+using std::uint64_t;
+using std::vector;
+using std::chrono::steady_clock;
+using std::filesystem::path;
+using namespace glm;
+
+/*
+ * headless benchmarks of the core modules:
+ *   bench [--filter <substring>] [--repetitions <n>] [--min-time <ms>] [--baseline <file.json>] [--threads <n>]
+ * - a benchmark is an operation run n times per batch: the batch size is
+ *   doubled until a batch takes --min-time (which also warms caches and the
+ *   branch predictors), a few more batches are thrown away, then
+ *   --repetitions batches are timed
+ * - reported per iteration: median, mean, standard deviation, median
+ *   absolute deviation and a 95% bootstrap confidence interval of the median
+ *   (fixed seed, so reruns on the same samples agree)
+ * - the /jobs variants run with a scheduler of --threads workers (default
+ *   one per hardware thread), e.g. to see how they scale against a
+ *   --threads 1 baseline. /threads_<n> variants set their own count
+ * - hardware counters of the timed batches through perf_event_open, only of
+ *   the calling thread (workers of the /jobs variants are not counted), left
+ *   out when the kernel refuses them (perf_event_paranoid, containers)
+ * - json on stdout, one benchmark per line. --baseline takes an earlier
+ *   output and prints every benchmark's speedup to stderr, e.g. to compare
+ *   release, pgo-use and -march builds
+ * - before anything is timed, self-checks run and a failure exits with 1:
+ *   logger::info must not allocate in text and trace mode, render_graph's
+ *   compile() must cull, alias and place barriers as expected, and a
+ *   recorded command list replayed through state_cache<mock_api> must issue
+ *   and elide the expected calls
+ */
+
+/* keeps the compiler from dropping a result it can see is unused */
+template<typename T>
+void keep(const T &value) {
+    asm volatile("" : : "r"(&value) : "memory");
+}
+
+/* cycles, instructions, cache misses, branch misses as one group */
+struct perf_counters {
+    static constexpr array<string_view, 4> names = {
+        "cycles", "instructions", "cache_misses", "branch_misses"
+    };
+    static constexpr array<uint64_t, 4> events = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES
+    };
+
+    array<int, 4> fds;
+
+    perf_counters() {
+        fds.fill(-1);
+        for (size_t i = 0; i < events.size(); ++i) {
+            perf_event_attr attr = {};
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.size = sizeof(attr);
+            attr.config = events[i];
+            attr.disabled = i == 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            fds[i] = ::syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds[0], 0);
+            if (fds[i] < 0) {
+                close_all();
+                return;
+            }
+        }
+    }
+
+    ~perf_counters() {
+        close_all();
+    }
+
+    perf_counters(const perf_counters &) = delete;
+    perf_counters & operator=(const perf_counters &) = delete;
+
+    bool available() const {
+        return fds[0] >= 0;
+    }
+
+    void start() {
+        if (!available())
+            return;
+        ::ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ::ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+
+    /* scaled up when the group was multiplexed with other users */
+    array<double, 4> stop() {
+        array<double, 4> result = {};
+        if (!available())
+            return result;
+        ::ioctl(fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        struct {
+            uint64_t count;
+            uint64_t time_enabled;
+            uint64_t time_running;
+            array<uint64_t, 4> values;
+        } data = {};
+        if (::read(fds[0], &data, sizeof(data)) != ssize_t(sizeof(data)) || data.time_running == 0)
+            return result;
+        double scale = double(data.time_enabled) / data.time_running;
+        for (size_t i = 0; i < result.size(); ++i)
+            result[i] = data.values[i] * scale;
+        return result;
+    }
+
+private:
+    void close_all() {
+        for (int &fd : fds) {
+            if (fd >= 0)
+                ::close(fd);
+            fd = -1;
+        }
+    }
+};
+
+/* the measured operation, runs its work n times */
+using operation = function<void(size_t n)>;
+
+struct benchmark {
+    string name;
+    /* items per iteration (vertices, entities, files, messages) for the throughput */
+    double items;
+    /* a job scheduler is active while it runs */
+    bool parallel;
+    /* builds the inputs outside the measurement, they live as long as the operation */
+    function<operation()> setup;
+    /* workers of the scheduler, 0 = --threads */
+    unsigned threads = 0;
+};
+
+struct summary {
+    double median;
+    double mean;
+    double stddev;
+    double mad;
+    double ci_low;
+    double ci_high;
+};
+
+struct result {
+    string name;
+    double items;
+    size_t batch;
+    vector<double> samples; /* ns per iteration, one per repetition */
+    summary stats;
+    optional<array<double, 4>> counters; /* per iteration */
+};
+
+struct options {
+    string filter;
+    int repetitions = 30;
+    double min_time_ms = 10;
+    int warmup_batches = 3;
+    optional<path> baseline;
+    unsigned threads = std::thread::hardware_concurrency();
+};
+
+double median(vector<double> v) {
+    std::ranges::sort(v);
+    size_t n = v.size();
+    return n % 2 == 1 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+summary summarize(span<const double> samples) {
+    summary s = {};
+    size_t n = samples.size();
+    s.median = median(vector<double>(samples.begin(), samples.end()));
+    s.mean = std::ranges::fold_left(samples, 0.0, std::plus<>()) / n;
+    double squares = 0;
+    for (double x : samples)
+        squares += (x - s.mean) * (x - s.mean);
+    s.stddev = n > 1 ? std::sqrt(squares / (n - 1)) : 0;
+    vector<double> deviations;
+    for (double x : samples)
+        deviations.push_back(std::abs(x - s.median));
+    s.mad = median(std::move(deviations));
+
+    /* percentile bootstrap: medians of resamples with replacement */
+    constexpr size_t resamples = 2000;
+    std::mt19937_64 rng(0x5eed);
+    std::uniform_int_distribution<size_t> pick(0, n - 1);
+    vector<double> medians(resamples);
+    vector<double> resample(n);
+    for (double &m : medians) {
+        for (double &x : resample)
+            x = samples[pick(rng)];
+        m = median(resample);
+    }
+    std::ranges::sort(medians);
+    s.ci_low = medians[size_t(resamples * 0.025)];
+    s.ci_high = medians[size_t(resamples * 0.975)];
+    return s;
+}
+
+double time_batch(const operation &op, size_t n) {
+    auto start = steady_clock::now();
+    op(n);
+    return std::chrono::duration<double, std::nano>(steady_clock::now() - start).count();
+}
+
+result measure(const benchmark &b, const options &opt, perf_counters &counters) {
+    optional<jobs::scheduler> scheduler;
+    if (b.parallel)
+        scheduler.emplace(b.threads > 0 ? b.threads : opt.threads);
+    operation op = b.setup();
+
+    const double min_time = opt.min_time_ms * 1e6;
+    size_t n = 1;
+    for (double t = time_batch(op, n); t < min_time; t = time_batch(op, n))
+        n = std::clamp(size_t(n * min_time / std::max(t, 1.0) * 1.2), n * 2, n * 100);
+    for (int i = 0; i < opt.warmup_batches; ++i)
+        time_batch(op, n);
+
+    result r = {.name = b.name, .items = b.items, .batch = n};
+    array<double, 4> totals = {};
+    for (int i = 0; i < opt.repetitions; ++i) {
+        counters.start();
+        double t = time_batch(op, n);
+        array<double, 4> c = counters.stop();
+        r.samples.push_back(t / n);
+        for (size_t k = 0; k < totals.size(); ++k)
+            totals[k] += c[k];
+    }
+    r.stats = summarize(r.samples);
+    if (counters.available()) {
+        for (double &total : totals)
+            total /= double(n) * opt.repetitions;
+        r.counters = totals;
+    }
+    return r;
+}
+
+/* ----- benchmarks ----- */
+
+vector<benchmark> geometry_benchmarks() {
+    vector<benchmark> list;
+    for (int size : {64, 512}) {
+        double vertices = double(size) * size;
+        string grid = std::format("{}x{}", size, size);
+        for (bool parallel : {false, true}) {
+            string suffix = parallel ? "/jobs" : "";
+            list.push_back({"geometry/generate_surface/sphere/" + grid + suffix, vertices, parallel, [=] {
+                return [=] (size_t n) {
+                    for (size_t i = 0; i < n; ++i)
+                        keep(generate_surface(size, size, sphere));
+                };
+            }});
+            list.push_back({"geometry/generate_normals/sphere/" + grid + suffix, vertices, parallel, [=] {
+                return [=] (size_t n) {
+                    for (size_t i = 0; i < n; ++i)
+                        keep(generate_normals(size, size, sphere));
+                };
+            }});
+            list.push_back({"geometry/generate_grid_indices/" + grid + suffix, vertices, parallel, [=] {
+                return [=] (size_t n) {
+                    for (size_t i = 0; i < n; ++i)
+                        keep(generate_grid_indices(size, size));
+                };
+            }});
+        }
+    }
+    list.push_back({"geometry/create_cube_cw", 24, false, [] {
+        return [] (size_t n) {
+            for (size_t i = 0; i < n; ++i)
+                keep(create_cube_cw());
+        };
+    }});
+    return list;
+}
+
+/* fork-join and spawn overhead: empty bodies, one job per index or per
+ * task_group::run. scaling: the same fixed work (a few microseconds per
+ * index) with 1, 2, 4, ... workers up to one per hardware thread, whatever
+ * --threads says */
+vector<benchmark> jobs_benchmarks() {
+    vector<benchmark> list;
+    list.push_back({"jobs/parallel_for/empty/1024", 1024, true, [] {
+        return [] (size_t n) {
+            for (size_t i = 0; i < n; ++i)
+                jobs::parallel_for(0, 1024, [] (size_t j) { keep(j); }, 1);
+        };
+    }});
+    list.push_back({"jobs/task_group/empty/1024", 1024, true, [] {
+        return [] (size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                jobs::task_group group;
+                for (size_t j = 0; j < 1024; ++j)
+                    group.run([j] { keep(j); });
+                group.wait();
+            }
+        };
+    }});
+    constexpr size_t work_items = 4096;
+    auto work = [] (size_t j) {
+        float x = float(j);
+        for (int k = 0; k < 512; ++k)
+            x = x * 0.999f + std::sin(x);
+        keep(x);
+    };
+    unsigned hardware = std::max(std::thread::hardware_concurrency(), 1u);
+    vector<unsigned> thread_counts;
+    for (unsigned t = 1; t < hardware; t *= 2)
+        thread_counts.push_back(t);
+    thread_counts.push_back(hardware);
+    for (unsigned t : thread_counts) {
+        list.push_back({std::format("jobs/parallel_for/work/{}/threads_{}", work_items, t), double(work_items), true, [=] {
+            return [=] (size_t n) {
+                for (size_t i = 0; i < n; ++i)
+                    jobs::parallel_for(0, work_items, work);
+            };
+        }, t});
+    }
+    return list;
+}
+
+/* a frame's extraction: lod moves 1% of the entities to another mesh first,
+ * as in the viewer. /jobs is the same extraction split across the workers.
+ * view_get is the extraction the snapshot replaced: a view over the
+ * registry, all_of / get per entity into slots of the leading storage, then
+ * instances regrouped by mesh */
+struct ecs_scene {
+    static constexpr size_t mesh_count = 16;
+    static constexpr int texture_count = 8;
+
+    entt::registry registry;
+    vector<entt::entity> entities;
+    size_t next = 0;
+
+    explicit ecs_scene(size_t count) {
+        std::mt19937 rng(count);
+        std::uniform_real_distribution<float> position(-100, 100);
+        for (size_t i = 0; i < count; ++i) {
+            auto e = registry.create();
+            mat4 M = translate(mat4(1), vec3(position(rng), position(rng), position(rng)));
+            registry.emplace<model_component>(e, M, transpose(inverse(M)));
+            registry.emplace<mesh_component>(e, uint32_t(rng() % mesh_count));
+            registry.emplace<material_component>(e, vec4(1), int(rng() % texture_count) - 1);
+            entities.push_back(e);
+        }
+    }
+
+    void change_lods() {
+        for (size_t k = 0; k < entities.size() / 100; ++k) {
+            entt::entity e = entities[next++ % entities.size()];
+            auto &mesh = registry.get<mesh_component>(e);
+            mesh.index = (mesh.index + 1) % mesh_count;
+        }
+    }
+};
+
+vector<benchmark> ecs_benchmarks() {
+    vector<benchmark> list;
+    for (size_t count : {10'000, 100'000, 1'000'000}) {
+        for (bool parallel : {false, true}) {
+            string suffix = parallel ? "/jobs" : "";
+            list.push_back({std::format("ecs/extract_render_snapshot/{}{}", count, suffix), double(count), parallel, [=] {
+                struct state {
+                    ecs_scene scene;
+                    render_snapshot snapshot;
+
+                    explicit state(size_t count) : scene(count) {}
+                };
+                auto s = std::make_shared<state>(count);
+                extract_render_snapshot(s->scene.registry, s->snapshot, ecs_scene::mesh_count);
+                return [s] (size_t n) {
+                    for (size_t i = 0; i < n; ++i) {
+                        s->scene.change_lods();
+                        extract_render_snapshot(s->scene.registry, s->snapshot, ecs_scene::mesh_count);
+                        keep(s->snapshot.instances.data());
+                    }
+                };
+            }});
+            list.push_back({std::format("ecs/view_get/{}{}", count, suffix), double(count), parallel, [=] {
+                struct state {
+                    ecs_scene scene;
+                    vector<std::pair<entt::entity, instance_data>> extracted;
+                    vector<vector<instance_data>> groups = vector<vector<instance_data>>(ecs_scene::mesh_count);
+                    vector<instance_data> instances;
+                    vector<size_t> offsets;
+
+                    explicit state(size_t count) : scene(count) {}
+                };
+                auto s = std::make_shared<state>(count);
+                return [s, parallel] (size_t n) {
+                    for (size_t i = 0; i < n; ++i) {
+                        s->scene.change_lods();
+                        const entt::registry &reader = s->scene.registry;
+                        auto view = reader.view<model_component, mesh_component>();
+                        s->extracted.assign(view.handle()->size(), {entt::null, {}});
+                        auto extract = [&] (entt::entity entity) {
+                            auto &model = reader.get<model_component>(entity);
+                            instance_data data = {
+                                .normal_matrix = model.normal_matrix,
+                                .model_matrix = model.model_matrix
+                            };
+                            if (reader.all_of<material_component>(entity)) {
+                                auto &material = reader.get<material_component>(entity);
+                                data.color = material.color;
+                                data.texture_index = material.texture_index;
+                            }
+                            s->extracted[view.handle()->index(entity)] = {entity, data};
+                        };
+                        if (parallel)
+                            jobs::parallel_for_each(view, extract);
+                        else
+                            for (entt::entity entity : view)
+                                extract(entity);
+                        std::erase_if(s->extracted, [] (auto &e) { return e.first == entt::null; });
+
+                        for (auto &group : s->groups)
+                            group.clear();
+                        for (auto &[entity, data] : s->extracted)
+                            s->groups[reader.get<mesh_component>(entity).index].push_back(data);
+                        s->instances.clear();
+                        s->offsets.clear();
+                        for (auto &group : s->groups) {
+                            s->offsets.push_back(s->instances.size() * sizeof(instance_data));
+                            s->instances.insert(s->instances.end(), group.begin(), group.end());
+                        }
+                        keep(s->instances.data());
+                    }
+                };
+            }});
+        }
+    }
+    return list;
+}
+
+vector<benchmark> camera_benchmarks() {
+    return {{"camera/rotate_update_view", 1, false, [] {
+        auto camera = std::make_shared<lerp_camera>();
+        return [camera] (size_t n) {
+            for (size_t i = 0; i < n; ++i) {
+                camera->rotate(0.1f, i % 2 == 0 ? 0.05f : -0.05f);
+                camera->set_movement(lerp_camera::Front, i % 64 < 32);
+                camera->update(1.0f / 60);
+                keep(camera->compute_view_matrix());
+            }
+        };
+    }}};
+}
+
+/* a random scene of small boxes, the camera looking into it: the bvh
+ * against testing every box, which is what the viewer did before */
+vector<benchmark> spatial_benchmarks() {
+    struct scene {
+        vector<aabb> boxes;
+        vector<aabb> moved;
+        bvh tree;
+        frustum view;
+        vec3 center;
+        float radius;
+        ray r;
+        vector<uint32_t> found;
+        vector<std::pair<uint32_t, float>> hits;
+    };
+    auto make_scene = [] (size_t count) {
+        auto s = std::make_shared<scene>();
+        std::mt19937 rng(count);
+        float extent = 10 * std::cbrt(float(count));
+        std::uniform_real_distribution<float> position(-extent, extent);
+        std::uniform_real_distribution<float> size(0.5f, 2);
+        for (size_t i = 0; i < count; ++i) {
+            vec3 p(position(rng), position(rng), position(rng));
+            s->boxes.push_back({p, p + vec3(size(rng), size(rng), size(rng))});
+        }
+        s->moved = s->boxes;
+        for (aabb &box : s->moved) {
+            vec3 offset(size(rng) - 1, size(rng) - 1, size(rng) - 1);
+            box = {box.min + offset, box.max + offset};
+        }
+        s->tree.build(s->boxes);
+        mat4 view = lookAt(vec3(0, 0, -extent), vec3(0), vec3(0, 1, 0));
+        s->view = make_frustum(perspective(radians(60.f), 16.f / 9, 0.1f, extent) * view);
+        s->center = vec3(extent / 4);
+        s->radius = extent / 8;
+        s->r = {vec3(-extent, 0.3f, 0.7f), normalize(vec3(1, 0.01f, 0.02f))};
+        return s;
+    };
+
+    vector<benchmark> list;
+    for (size_t count : {1'000, 10'000, 100'000, 1'000'000}) {
+        list.push_back({std::format("spatial/bvh/build/{}", count), double(count), false, [=] {
+            auto s = make_scene(count);
+            return [s] (size_t n) {
+                for (size_t i = 0; i < n; ++i) {
+                    s->tree.build(s->boxes);
+                    keep(s->tree.nodes.data());
+                }
+            };
+        }});
+        list.push_back({std::format("spatial/bvh/refit/{}", count), double(count), false, [=] {
+            auto s = make_scene(count);
+            return [s] (size_t n) {
+                for (size_t i = 0; i < n; ++i) {
+                    s->tree.refit(i % 2 == 0 ? s->moved : s->boxes);
+                    keep(s->tree.nodes.data());
+                }
+            };
+        }});
+        list.push_back({std::format("spatial/bvh/frustum/{}", count), double(count), false, [=] {
+            auto s = make_scene(count);
+            return [s] (size_t n) {
+                for (size_t i = 0; i < n; ++i) {
+                    s->found.clear();
+                    s->tree.query(s->view, s->found);
+                    keep(s->found.data());
+                }
+            };
+        }});
+        list.push_back({std::format("spatial/brute_force/frustum/{}", count), double(count), false, [=] {
+            auto s = make_scene(count);
+            return [s] (size_t n) {
+                for (size_t i = 0; i < n; ++i) {
+                    s->found.clear();
+                    for (uint32_t k = 0; k < s->boxes.size(); ++k)
+                        if (intersects(s->view, s->boxes[k]))
+                            s->found.push_back(k);
+                    keep(s->found.data());
+                }
+            };
+        }});
+        list.push_back({std::format("spatial/bvh/sphere/{}", count), double(count), false, [=] {
+            auto s = make_scene(count);
+            return [s] (size_t n) {
+                for (size_t i = 0; i < n; ++i) {
+                    s->found.clear();
+                    s->tree.query(s->center, s->radius, s->found);
+                    keep(s->found.data());
+                }
+            };
+        }});
+        list.push_back({std::format("spatial/brute_force/sphere/{}", count), double(count), false, [=] {
+            auto s = make_scene(count);
+            return [s] (size_t n) {
+                for (size_t i = 0; i < n; ++i) {
+                    s->found.clear();
+                    for (uint32_t k = 0; k < s->boxes.size(); ++k)
+                        if (intersects(s->center, s->radius, s->boxes[k]))
+                            s->found.push_back(k);
+                    keep(s->found.data());
+                }
+            };
+        }});
+        list.push_back({std::format("spatial/bvh/ray/{}", count), double(count), false, [=] {
+            auto s = make_scene(count);
+            return [s] (size_t n) {
+                for (size_t i = 0; i < n; ++i) {
+                    s->hits.clear();
+                    s->tree.query(s->r, s->hits);
+                    keep(s->hits.data());
+                }
+            };
+        }});
+        list.push_back({std::format("spatial/brute_force/ray/{}", count), double(count), false, [=] {
+            auto s = make_scene(count);
+            return [s] (size_t n) {
+                for (size_t i = 0; i < n; ++i) {
+                    s->hits.clear();
+                    for (uint32_t k = 0; k < s->boxes.size(); ++k)
+                        if (optional<float> t = intersect(s->r, s->boxes[k]))
+                            s->hits.push_back({k, *t});
+                    std::ranges::sort(s->hits, {}, &std::pair<uint32_t, float>::second);
+                    keep(s->hits.data());
+                }
+            };
+        }});
+    }
+    return list;
+}
+
+/* a frame's temporary list and a map whose entries come and go, from the
+ * heap and from the frame arena / a thread's pool */
+vector<benchmark> memory_benchmarks() {
+    constexpr size_t count = 1024;
+    return {
+        {std::format("memory/heap/vector/{}", count), double(count), false, [] {
+            return [] (size_t n) {
+                for (size_t i = 0; i < n; ++i) {
+                    vector<uint32_t> list;
+                    for (uint32_t k = 0; k < count; ++k)
+                        list.push_back(k);
+                    keep(list.data());
+                }
+            };
+        }},
+        {std::format("memory/arena/vector/{}", count), double(count), false, [] {
+            auto frame = std::make_shared<memory::arena>();
+            return [frame] (size_t n) {
+                for (size_t i = 0; i < n; ++i) {
+                    {
+                        std::pmr::vector<uint32_t> list(frame.get());
+                        for (uint32_t k = 0; k < count; ++k)
+                            list.push_back(k);
+                        keep(list.data());
+                    }
+                    frame->reset();
+                }
+            };
+        }},
+        {std::format("memory/heap/unordered_map/{}", count), double(count), false, [] {
+            auto map = std::make_shared<std::unordered_map<uint32_t, uint32_t>>();
+            return [map] (size_t n) {
+                for (size_t i = 0; i < n; ++i) {
+                    for (uint32_t k = 0; k < count; ++k)
+                        map->emplace(k, k);
+                    for (uint32_t k = 0; k < count; ++k)
+                        map->erase(k);
+                }
+            };
+        }},
+        {std::format("memory/pool/unordered_map/{}", count), double(count), false, [] {
+            auto map = std::make_shared<std::pmr::unordered_map<uint32_t, uint32_t>>(&memory::local_pool<32>());
+            return [map] (size_t n) {
+                for (size_t i = 0; i < n; ++i) {
+                    for (uint32_t k = 0; k < count; ++k)
+                        map->emplace(k, k);
+                    for (uint32_t k = 0; k < count; ++k)
+                        map->erase(k);
+                }
+            };
+        }}
+    };
+}
+
+/* one patch of the default config, a root and a deep one. the noise
+ * dominates, generate_surface spreads the rows over the workers in /jobs */
+vector<benchmark> planet_benchmarks() {
+    vector<benchmark> list;
+    const int side = planet::config{}.patch_resolution + 2;
+    for (int level : {0, 8}) {
+        for (bool parallel : {false, true}) {
+            string suffix = parallel ? "/jobs" : "";
+            list.push_back({std::format("planet/build_patch/level_{}", level) + suffix, double(side) * side, parallel, [=] {
+                auto terrain = std::make_shared<planet::terrain>(planet::config{},
+                    [] (uint32_t, const planet::patch &) {}, [] (uint32_t) {}, [] (uint32_t) {}, [] (uint32_t) {});
+                planet::node patch = {.face = 2, .level = level, .x = (1 << level) / 2, .y = (1 << level) / 2};
+                return [=] (size_t n) {
+                    for (size_t i = 0; i < n; ++i)
+                        keep(terrain->build(patch));
+                };
+            }});
+        }
+    }
+    return list;
+}
+
+/* a level load's worth of small files, read as one batch per iteration.
+ * they stay in the page cache, so this is the per file cost of each path
+ * (syscalls, threads), not the disk */
+vector<benchmark> asset_io_benchmarks() {
+    constexpr size_t file_count = 64;
+    constexpr size_t file_size = 256 << 10;
+    struct temporary_files {
+        path directory = std::filesystem::temp_directory_path() / std::format("bench-assets-{}", ::getpid());
+        vector<path> files;
+
+        temporary_files() {
+            std::filesystem::create_directories(directory);
+            string contents(file_size, 'x');
+            for (size_t i = 0; i < file_count; ++i) {
+                path &p = files.emplace_back(directory / std::format("{}.bin", i));
+                std::ofstream(p, std::ios::binary) << contents;
+            }
+        }
+
+        ~temporary_files() {
+            std::filesystem::remove_all(directory);
+        }
+    };
+    auto batch = [] (bool uring) {
+        return [uring] {
+            auto files = std::make_shared<temporary_files>();
+            auto reader = std::make_shared<asset_io::reader>();
+            if (!uring)
+                reader->uring.reset();
+            return [files, reader] (size_t n) {
+                for (size_t i = 0; i < n; ++i)
+                    reader->read_all(files->files, [] (size_t, optional<asset_io::buffer> data) { keep(data); });
+            };
+        };
+    };
+    string shape = std::format("{}x{}k", file_count, file_size >> 10);
+    return {
+        {"asset_io/read_all/uring/" + shape, file_count, false, batch(true)},
+        {"asset_io/read_all/pread_threads/" + shape, file_count, false, batch(false)},
+        {"asset_io/read_file/serial/" + shape, file_count, false, [] {
+            auto files = std::make_shared<temporary_files>();
+            return [files] (size_t n) {
+                for (size_t i = 0; i < n; ++i)
+                    for (const path &p : files->files)
+                        keep(asset_io::read_file(p));
+            };
+        }}
+    };
+}
+
+/* text lines go to a stream buffer that drops them, so the terminal is not measured */
+struct null_buffer : std::streambuf {
+    int overflow(int c) override {
+        return c;
+    }
+
+    std::streamsize xsputn(const char *, std::streamsize n) override {
+        return n;
+    }
+};
+
+/* cout into null_buffer for as long as it lives */
+struct redirect_cout {
+    null_buffer null;
+    std::streambuf *saved = std::cout.rdbuf(&null);
+    ~redirect_cout() { std::cout.rdbuf(saved); }
+};
+
+/* the process' trace::writer on a file removed again with it */
+struct temporary_trace {
+    path filename = std::filesystem::temp_directory_path() / std::format("bench-{}.trace", ::getpid());
+    trace::writer writer{filename};
+    ~temporary_trace() { std::filesystem::remove(filename); }
+};
+
+void log_message(size_t i) {
+    logger::info("frame {} took {:.3f} ms, {} draws", i, 16.6, 42);
+}
+
+vector<benchmark> logger_benchmarks() {
+    auto messages = [] (size_t n) {
+        for (size_t i = 0; i < n; ++i)
+            log_message(i);
+    };
+    return {
+        {"logger/text", 1, false, [=] {
+            return [r = std::make_shared<redirect_cout>(), messages] (size_t n) {
+                messages(n);
+            };
+        }},
+        {"logger/trace", 1, false, [=] {
+            return [t = std::make_shared<temporary_trace>(), messages] (size_t n) {
+                messages(n);
+            };
+        }}
+    };
+}
+
+/* heap allocations of one logger::info after a first call created the
+ * thread's buffers, has to be none in either mode */
+bool logger_allocation_free() {
+    auto allocations = [] {
+        log_message(0);
+        uint64_t before = memory::heap.allocations.load(std::memory_order_relaxed);
+        log_message(1);
+        return memory::heap.allocations.load(std::memory_order_relaxed) - before;
+    };
+    uint64_t text, traced;
+    {
+        redirect_cout r;
+        text = allocations();
+    }
+    {
+        temporary_trace t;
+        traced = allocations();
+    }
+    if (text != 0)
+        println(std::cerr, "logger::info allocated {} times in text mode", text);
+    if (traced != 0)
+        println(std::cerr, "logger::info allocated {} times in trace mode", traced);
+    return text == 0 && traced == 0;
+}
+
+/* ----- render graph ----- */
+
+/* compile() of a small graph, it makes no gl calls:
+ *   a -> b -> (unused) -> c -> out
+ * nothing reads unused so its pass is culled, a and c have the same
+ * description and disjoint lifetimes so they share a texture, and c's image
+ * write reuses a's memory after it was sampled */
+bool render_graph_compiles() {
+    render_graph g;
+    using resource = render_graph::resource;
+    resource out = g.import_external("out");
+    g.mark_output(out);
+    resource a = g.create_texture("a", {GL_RGBA16F});
+    resource b = g.create_texture("b", {GL_RGBA16F});
+    resource c = g.create_texture("c", {GL_RGBA16F});
+    resource unused = g.create_texture("unused", {GL_RGBA16F});
+    auto nothing = [] (render_graph &) {};
+    g.add_pass("a", {}, {{a, usage::image}}, nothing);
+    g.add_pass("b", {{a, usage::sampled}}, {{b, usage::image}}, nothing);
+    g.add_pass("unused", {{b, usage::sampled}}, {{unused, usage::image}}, nothing);
+    g.add_pass("c", {{b, usage::sampled}}, {{c, usage::image}}, nothing);
+    g.add_pass("out", {{c, usage::sampled}}, {{out, usage::attachment}}, nothing);
+
+    bool passed = true;
+    auto expect = [&] (bool condition, string_view what) {
+        if (!condition)
+            println(std::cerr, "render graph: {}", what);
+        passed = passed && condition;
+    };
+    auto culled = [&] {
+        vector<bool> flags;
+        for (const render_graph::pass &p : g.passes)
+            flags.push_back(p.culled);
+        return flags;
+    };
+
+    g.compile();
+    expect(culled() == vector<bool>{false, false, true, false, false}, "only the pass writing unused is culled");
+    expect(g.resources[unused].physical < 0, "a texture only culled passes use gets no memory");
+    expect(g.physical_descs.size() == 2, "a, b and c fit in two textures");
+    expect(g.resources[a].physical == g.resources[c].physical, "a and c share a texture");
+    expect(g.resources[a].physical != g.resources[b].physical, "a and b are alive together and do not share");
+    constexpr GLbitfield fetch = GL_TEXTURE_FETCH_BARRIER_BIT, image = GL_SHADER_IMAGE_ACCESS_BARRIER_BIT;
+    array<GLbitfield, 5> barriers;
+    std::ranges::transform(g.passes, barriers.begin(), &render_graph::pass::barriers);
+    expect(barriers == array<GLbitfield, 5>{0, fetch, 0, fetch | image, fetch},
+        "fetch barriers before sampling an image write, an image barrier before c overwrites a");
+
+    /* without c nothing reaches out but the last pass */
+    g.passes[3].enabled = false;
+    g.compile();
+    expect(culled() == vector<bool>{true, true, true, true, false}, "switching c off culls everything feeding it");
+    return passed;
+}
+
+/* ----- command lists ----- */
+
+/* a recorded list sorted and replayed through the state cache into
+ * mock_api, which needs no gl context: program 2 sorts last, equal state
+ * between neighbours is elided, and clear() starts the ids over */
+bool command_list_replays() {
+    using commands::call;
+    using recorded = commands::mock_api::recorded_call;
+    constexpr GLuint storage_buffer = 200, indirect_buffer = 300, parameter_buffer = 301;
+    auto packet = [] (GLuint program, GLuint vertex_array, GLuint texture, GLintptr offset) {
+        return commands::draw_packet{
+            .program = program,
+            .vertex_array = vertex_array,
+            .texture = texture,
+            .storage_binding = 1,
+            .storage_buffer = storage_buffer,
+            .storage_offset = offset,
+            .storage_size = 256,
+            .mode = GL_TRIANGLES,
+            .element_type = GL_UNSIGNED_INT,
+            .count = 3,
+            .instance_count = 1
+        };
+    };
+    commands::draw_packet indirect = {
+        .program = 2,
+        .vertex_array = 10,
+        .mode = GL_TRIANGLES,
+        .element_type = GL_UNSIGNED_INT,
+        .count = 36,
+        .instance_count = 0,
+        .indirect_buffer = indirect_buffer,
+        .parameter_buffer = parameter_buffer,
+        .max_draw_count = 8
+    };
+
+    commands::command_list list;
+    list.add(packet(1, 10, 100, 0));
+    list.add(packet(2, 10, 100, 256));
+    list.add(packet(1, 11, 100, 512));
+    list.add(packet(1, 10, 101, 768));
+    list.add(indirect);
+    list.sort();
+    commands::state_cache<commands::mock_api> cache;
+    commands::submit(span<const commands::draw_packet>(list.packets), cache);
+
+    auto draw = [] (uint64_t vertex_array, uint64_t count, uint64_t instances, uint64_t indirect) {
+        return recorded{call::draw, {vertex_array, count, instances, indirect}};
+    };
+    vector<recorded> expected = {
+        {call::use_program, {1}},
+        {call::bind_vertex_array, {10}},
+        {call::bind_texture_unit, {0, 100}},
+        {call::bind_storage_range, {1, storage_buffer, 0, 256}},
+        draw(10, 3, 1, 0),
+        {call::bind_texture_unit, {0, 101}},
+        {call::bind_storage_range, {1, storage_buffer, 768, 256}},
+        draw(10, 3, 1, 0),
+        {call::bind_vertex_array, {11}},
+        {call::bind_texture_unit, {0, 100}},
+        {call::bind_storage_range, {1, storage_buffer, 512, 256}},
+        draw(11, 3, 1, 0),
+        {call::use_program, {2}},
+        {call::bind_vertex_array, {10}},
+        {call::bind_storage_range, {1, storage_buffer, 256, 256}},
+        draw(10, 3, 1, 0),
+        {call::bind_indirect_buffer, {indirect_buffer}},
+        {call::bind_parameter_buffer, {parameter_buffer}},
+        draw(10, 36, 0, indirect_buffer)
+    };
+    /* in call order: program, vertex array, texture, storage, indirect, parameter, draw */
+    constexpr array<size_t, 7> issued = {2, 3, 3, 4, 1, 1, 5};
+    constexpr array<size_t, 7> elided = {3, 2, 1, 0, 0, 0, 0};
+
+    bool passed = true;
+    auto expect = [&] (bool condition, string_view what) {
+        if (!condition)
+            println(std::cerr, "command list: {}", what);
+        passed = passed && condition;
+    };
+    expect(cache.api.calls == expected, "replayed calls differ from the expected sequence");
+    expect(cache.stats.issued == issued, "issued call counts");
+    expect(cache.stats.elided == elided, "elided call counts");
+
+    list.clear();
+    list.add(packet(2, 12, 102, 0));
+    expect(list.programs.size() == 1 && list.packets[0].key >> 52 == 0, "clear() resets the ids");
+    return passed;
+}
+
+/* ----- output ----- */
+
+constexpr string_view isa() {
+#if defined(__AVX512F__)
+    return "avx512";
+#elif defined(__AVX2__)
+    return "avx2";
+#else
+    return "baseline";
+#endif
+}
+
+constexpr bool multiversion() {
+#ifdef GEOMETRY_MULTIVERSION
+    return true;
+#else
+    return false;
+#endif
+}
+
+#ifndef GEOMETRY_BUILD_MODE
+#define GEOMETRY_BUILD_MODE "unknown"
+#endif
+
+string to_json(const result &r) {
+    const summary &s = r.stats;
+    string line = std::format(
+        R"({{"name": "{}", "batch": {}, "repetitions": {}, "median_ns": {:.3f}, "mean_ns": {:.3f}, )"
+        R"("stddev_ns": {:.3f}, "mad_ns": {:.3f}, "ci95_ns": [{:.3f}, {:.3f}], "items_per_second": {:.1f})",
+        r.name, r.batch, r.samples.size(), s.median, s.mean,
+        s.stddev, s.mad, s.ci_low, s.ci_high, r.items / s.median * 1e9);
+    if (r.counters) {
+        line += ", \"counters\": {";
+        for (size_t i = 0; i < perf_counters::names.size(); ++i)
+            line += std::format("{}\"{}\": {:.2f}", i > 0 ? ", " : "", perf_counters::names[i], (*r.counters)[i]);
+        line += "}";
+    }
+    return line + "}";
+}
+
+/* what an earlier run wrote per benchmark, found by pattern (our own output) */
+struct baseline_entry {
+    double median;
+    double ci_low;
+    double ci_high;
+};
+
+std::map<string, baseline_entry> read_baseline(const path &filename) {
+    std::ifstream in(filename);
+    if (!in)
+        throw std::runtime_error(std::format("cannot open {}", filename.string()));
+    static const std::regex pattern(
+        R"re("name": "([^"]+)".*"median_ns": ([-0-9.e+]+).*"ci95_ns": \[([-0-9.e+]+), ([-0-9.e+]+)\])re");
+    std::map<string, baseline_entry> entries;
+    string line;
+    std::smatch m;
+    while (std::getline(in, line))
+        if (std::regex_search(line, m, pattern))
+            entries[m[1]] = {std::stod(m[2]), std::stod(m[3]), std::stod(m[4])};
+    return entries;
+}
+
+/* speedup > 1: faster than the baseline; "~" when the intervals overlap */
+void compare(span<const result> results, const std::map<string, baseline_entry> &baseline) {
+    for (const result &r : results) {
+        auto b = baseline.find(r.name);
+        if (b == baseline.end())
+            continue;
+        bool overlap = r.stats.ci_low <= b->second.ci_high && b->second.ci_low <= r.stats.ci_high;
+        println(std::cerr, "{:<48} {:>7.3f}x {} ({:.1f} -> {:.1f} ns)",
+            r.name, b->second.median / r.stats.median, overlap ? "~" : " ",
+            b->second.median, r.stats.median);
+    }
+}
+
+int main(int argc, char *argv[]) try {
+    options opt;
+    for (int i = 1; i < argc; ++i) {
+        string_view arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--filter" && has_value)
+            opt.filter = argv[++i];
+        else if (arg == "--repetitions" && has_value)
+            opt.repetitions = std::max(std::stoi(argv[++i]), 2);
+        else if (arg == "--min-time" && has_value)
+            opt.min_time_ms = std::stod(argv[++i]);
+        else if (arg == "--baseline" && has_value)
+            opt.baseline = argv[++i];
+        else if (arg == "--threads" && has_value)
+            opt.threads = std::max(std::stoi(argv[++i]), 1);
+        else {
+            println(std::cerr, "usage: {} [--filter <substring>] [--repetitions <n>] [--min-time <ms>] [--baseline <file.json>] [--threads <n>]", argv[0]);
+            return 1;
+        }
+    }
+    auto baseline = opt.baseline ? read_baseline(*opt.baseline) : std::map<string, baseline_entry>{};
+    /* self-checks, all of them report before a failure exits */
+    bool checks_passed = logger_allocation_free();
+    checks_passed = render_graph_compiles() && checks_passed;
+    checks_passed = command_list_replays() && checks_passed;
+    if (!checks_passed)
+        return 1;
+
+    vector<benchmark> benchmarks;
+    for (auto group : {geometry_benchmarks, jobs_benchmarks, ecs_benchmarks, camera_benchmarks, spatial_benchmarks, memory_benchmarks, planet_benchmarks, asset_io_benchmarks, logger_benchmarks})
+        std::ranges::move(group(), std::back_inserter(benchmarks));
+
+    perf_counters counters;
+    if (!counters.available())
+        println(std::cerr, "hardware counters unavailable, see /proc/sys/kernel/perf_event_paranoid");
+
+    println("{{\"build\": {{\"mode\": \"{}\", \"compiler\": \"{}\", \"isa\": \"{}\", \"multiversion\": {}, \"threads\": {}}},",
+        GEOMETRY_BUILD_MODE, __VERSION__, isa(), multiversion(), opt.threads);
+    println("\"benchmarks\": [");
+    vector<result> results;
+    for (const benchmark &b : benchmarks) {
+        if (!b.name.contains(opt.filter))
+            continue;
+        println(std::cerr, "{}", b.name);
+        results.push_back(measure(b, opt, counters));
+        print("{}{}", results.size() > 1 ? ",\n" : "", to_json(results.back()));
+        std::cout.flush();
+    }
+    println("\n]}}");
+
+    compare(results, baseline);
+    return 0;
+} catch (const std::exception &e) {
+    println(std::cerr, "{}", e.what());
+    return 1;
+}
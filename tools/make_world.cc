@@ -0,0 +1,167 @@
+import std;
+import glm;
+
+import bvh;
+import ecs;
+import geometry;
+import scene_file;
+import streaming;
+
+using std::print;
+using std::println;
+using std::size_t;
+using std::span;
+using std::string;
+using std::string_view;
+using std::uint32_t;
+using std::uint8_t;
+using std::vector;
+using std::filesystem::path;
+using namespace glm;
+
+/* writes a procedural world for the viewer's streamer (GEOMETRY_WORLD):
+ *   make-world [--cells <n>] <directory>
+ * n x n cells around the origin (default 64, about 1.2 GB), each a scene
+ * file with a terrain patch, its texture and a few spheres. cells use
+ * streaming::config's cell size, mesh and texture indices are local to the
+ * cell, spheres use the viewer's lod chain 0 */
+
+constexpr int terrain_resolution = 65;
+constexpr int texture_size = 128;
+constexpr int spheres_per_cell = 8;
+
+/* continuous across cell borders */
+float height(float x, float z) {
+    return 4.f * sin(x * 0.02f) * cos(z * 0.017f) + 1.5f * sin(x * 0.09f + z * 0.05f) - 6.f;
+}
+
+vec3 terrain_normal(float x, float z) {
+    constexpr float e = 0.05f;
+    float dx = (height(x + e, z) - height(x - e, z)) / (2 * e);
+    float dz = (height(x, z + e) - height(x, z - e)) / (2 * e);
+    return normalize(vec3(-dx, 1, -dz));
+}
+
+/* binary ppm, stb_image reads it */
+void write_texture(const path &filename, streaming::cell_coord c) {
+    vec3 base = vec3(0.25f, 0.45f, 0.2f) + 0.1f * vec3(sin(c.x * 1.7f), sin(c.z * 2.3f), cos(c.x * 0.9f + c.z));
+    vector<uint8_t> pixels;
+    pixels.reserve(texture_size * texture_size * 3);
+    for (int y = 0; y < texture_size; ++y) {
+        for (int x = 0; x < texture_size; ++x) {
+            bool line = x % 32 == 0 || y % 32 == 0;
+            vec3 color = line ? base * 0.6f : base;
+            for (int k = 0; k < 3; ++k)
+                pixels.push_back(uint8_t(clamp(color[k], 0.f, 1.f) * 255));
+        }
+    }
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    print(out, "P6\n{} {}\n255\n", texture_size, texture_size);
+    out.write(reinterpret_cast<const char *>(pixels.data()), pixels.size());
+    if (!out)
+        throw scene_file::error(std::format("could not write {}", filename.string()));
+}
+
+template<typename T>
+void add_table(scene_file::writer &w, const vector<uint32_t> &entities, const vector<T> &values) {
+    w.add_table(span<const uint32_t>(entities), span<const T>(values));
+}
+
+void write_cell(const path &directory, streaming::cell_coord c, float cell_size) {
+    const float x0 = c.x * cell_size;
+    const float z0 = c.z * cell_size;
+    /* u along z, v along x: generate_grid_indices' winding faces up */
+    auto terrain = [=] (float u, float v) {
+        float x = x0 + v * cell_size;
+        float z = z0 + u * cell_size;
+        return vec3(x, height(x, z), z);
+    };
+    const int R = terrain_resolution;
+    vector<vec3> positions = generate_surface(R, R, terrain);
+    vector<vec3> normals;
+    normals.reserve(positions.size());
+    for (const vec3 &p : positions)
+        normals.push_back(terrain_normal(p.x, p.z));
+    vector<unsigned int> indices = generate_grid_indices(R, R);
+    vector<vec2> texcoords = generate_texcoords(R, R);
+
+    scene_file::writer w;
+    w.add_mesh(span<const uint32_t>(indices), span<const vec3>(positions), span<const vec3>(normals), span<const vec2>(texcoords));
+    path texture = path("textures") / std::format("cell_{}_{}.ppm", c.x, c.z);
+    write_texture(directory / texture, c);
+    w.add_texture(texture.native());
+
+    vector<uint32_t> entities;
+    vector<model_component> models;
+    vector<mesh_component> meshes;
+    vector<material_component> materials;
+    vector<bounds_component> bounds;
+    vector<uint32_t> lod_entities;
+    vector<lod_component> lods;
+
+    aabb terrain_box;
+    for (const vec3 &p : positions)
+        terrain_box.grow(p);
+    entities.push_back(0);
+    models.push_back({mat4(1), mat4(1)});
+    meshes.push_back({0});
+    materials.push_back({vec4(1), 0});
+    bounds.push_back({terrain_box});
+
+    std::mt19937 rng(std::hash<int>()(c.x * 73856093 ^ c.z * 19349663));
+    std::uniform_real_distribution<float> unit(0, 1);
+    for (uint32_t i = 1; i <= spheres_per_cell; ++i) {
+        float x = x0 + unit(rng) * cell_size;
+        float z = z0 + unit(rng) * cell_size;
+        float r = 0.5f + 1.5f * unit(rng);
+        mat4 M = scale(translate(mat4(1), vec3(x, height(x, z) + r, z)), vec3(r));
+        entities.push_back(i);
+        models.push_back({M, transpose(inverse(M))});
+        /* picked from the lod chain every frame */
+        meshes.push_back({0});
+        materials.push_back({vec4(unit(rng), unit(rng), unit(rng), 1), -1});
+        bounds.push_back({aabb{vec3(-1), vec3(1)}});
+        lod_entities.push_back(i);
+        lods.push_back({0, 0});
+    }
+
+    add_table(w, entities, models);
+    add_table(w, entities, meshes);
+    add_table(w, entities, materials);
+    add_table(w, entities, bounds);
+    add_table(w, lod_entities, lods);
+    w.entity_count = entities.size();
+    w.save(directory / streaming::cell_file(c));
+}
+
+int main(int argc, char *argv[]) try {
+    int cells = 64;
+    path directory;
+    bool usage = false;
+    for (int i = 1; i < argc; ++i) {
+        string_view arg = argv[i];
+        if (arg == "--cells" && i + 1 < argc)
+            cells = std::max(std::stoi(argv[++i]), 1);
+        else if (directory.empty() && !arg.starts_with("--"))
+            directory = arg;
+        else
+            usage = true;
+    }
+    if (usage || directory.empty()) {
+        println(std::cerr, "usage: {} [--cells <n>] <directory>", argv[0]);
+        return 1;
+    }
+
+    const float cell_size = streaming::config{}.cell_size;
+    std::filesystem::create_directories(directory / "textures");
+    for (int x = -cells / 2; x < cells - cells / 2; ++x) {
+        for (int z = -cells / 2; z < cells - cells / 2; ++z)
+            write_cell(directory, {x, z}, cell_size);
+        print(std::cerr, "\r{} / {} columns", x + cells / 2 + 1, cells);
+    }
+    println(std::cerr, "");
+    return 0;
+} catch (const std::exception &e) {
+    println(std::cerr, "{}", e.what());
+    return 1;
+}
@@ -0,0 +1,293 @@
+import std;
+import trace;
+
+using std::array;
+using std::byte;
+using std::format;
+using std::ifstream;
+using std::make_format_args;
+using std::memcpy;
+using std::print;
+using std::println;
+using std::size_t;
+using std::span;
+using std::string;
+using std::string_view;
+using std::unordered_map;
+using std::variant;
+using std::vector;
+using std::vformat;
+using std::filesystem::path;
+
+/* renders a binary trace file written by trace::writer as text or json lines:
+ *   trace-decode [--json] <file> */
+
+using value = variant<std::int64_t, std::uint64_t, double, bool, char, const void *, string_view>;
+
+struct definition {
+    string_view fmt;
+    span<const trace::arg> tags;
+};
+
+constexpr array<string_view, 5> level_names = {
+    "error", "warn", "notice", "info", "debug"
+};
+
+struct trace_file {
+    vector<byte> data;
+    trace::file_header header;
+    unordered_map<std::uint64_t, definition> definitions;
+
+    trace_file(const path &filename) {
+        ifstream in(filename, std::ios::binary);
+        if (!in)
+            throw trace::error(format("could not open {}", filename.string()));
+        data.resize(std::filesystem::file_size(filename));
+        in.read(reinterpret_cast<char *>(data.data()), data.size());
+
+        if (data.size() < sizeof(header))
+            throw trace::error("file is too small");
+        memcpy(&header, data.data(), sizeof(header));
+        if (header.magic != trace::file_magic || header.version != trace::file_version)
+            throw trace::error("not a trace file");
+        if (header.ring_offset + header.ring_capacity > data.size())
+            throw trace::error("ring is out of file bounds");
+
+        size_t end = std::min(header.definitions_size, header.definitions_capacity);
+        for (size_t offset = 0; offset + sizeof(trace::definition_header) <= end;) {
+            trace::definition_header h;
+            const byte *p = data.data() + header.definitions_offset + offset;
+            memcpy(&h, p, sizeof(h));
+            if (h.size < sizeof(h) || offset + h.size > end)
+                break;
+            definitions[h.id] = {
+                .fmt = string_view(
+                    reinterpret_cast<const char *>(p + sizeof(h) + h.arg_count), h.format_size),
+                .tags = span(reinterpret_cast<const trace::arg *>(p + sizeof(h)), h.arg_count)
+            };
+            offset += h.size;
+        }
+    }
+
+    /* copies n bytes starting at ring position pos, wrapping around */
+    void read_ring(std::uint64_t pos, void *out, size_t n) const {
+        const byte *ring = data.data() + header.ring_offset;
+        size_t offset = pos % header.ring_capacity;
+        size_t first = std::min(n, header.ring_capacity - offset);
+        memcpy(out, ring + offset, first);
+        memcpy(static_cast<byte *>(out) + first, ring, n - first);
+    }
+};
+
+/* decodes the arguments of one record, returns false if they do not fit */
+bool decode_args(span<const byte> payload, span<const trace::arg> tags, vector<value> &values) {
+    using trace::arg;
+    size_t offset = 0;
+    auto take = [&] <typename T> (T &out) {
+        if (offset + sizeof(T) > payload.size())
+            return false;
+        memcpy(&out, payload.data() + offset, sizeof(T));
+        offset += sizeof(T);
+        return true;
+    };
+    auto take_as = [&] <typename T, typename V> (std::type_identity<T>, std::type_identity<V>) {
+        T v;
+        if (!take(v))
+            return false;
+        values.push_back(static_cast<V>(v));
+        return true;
+    };
+    using std::type_identity;
+    using i64 = std::int64_t;
+    using u64 = std::uint64_t;
+
+    values.clear();
+    for (arg tag : tags) {
+        bool ok = true;
+        switch (tag) {
+            case arg::i8:  ok = take_as(type_identity<std::int8_t>(),  type_identity<i64>()); break;
+            case arg::i16: ok = take_as(type_identity<std::int16_t>(), type_identity<i64>()); break;
+            case arg::i32: ok = take_as(type_identity<std::int32_t>(), type_identity<i64>()); break;
+            case arg::i64: ok = take_as(type_identity<i64>(),          type_identity<i64>()); break;
+            case arg::u8:  ok = take_as(type_identity<std::uint8_t>(), type_identity<u64>()); break;
+            case arg::u16: ok = take_as(type_identity<std::uint16_t>(),type_identity<u64>()); break;
+            case arg::u32: ok = take_as(type_identity<std::uint32_t>(),type_identity<u64>()); break;
+            case arg::u64: ok = take_as(type_identity<u64>(),          type_identity<u64>()); break;
+            case arg::f32: ok = take_as(type_identity<float>(),        type_identity<double>()); break;
+            case arg::f64: ok = take_as(type_identity<double>(),       type_identity<double>()); break;
+            case arg::boolean:   ok = take_as(type_identity<bool>(), type_identity<bool>()); break;
+            case arg::character: ok = take_as(type_identity<char>(), type_identity<char>()); break;
+            case arg::pointer: {
+                u64 p;
+                ok = take(p);
+                values.push_back(reinterpret_cast<const void *>(p));
+                break;
+            }
+            case arg::string: {
+                std::uint32_t n;
+                ok = take(n) && offset + n <= payload.size();
+                if (ok) {
+                    values.push_back(string_view(
+                        reinterpret_cast<const char *>(payload.data() + offset), n));
+                    offset += n;
+                }
+                break;
+            }
+            default:
+                ok = false;
+        }
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+
+/* std::format with arguments only known at runtime: every replacement field
+ * is formatted on its own */
+string render(string_view fmt, span<const value> values) {
+    string out;
+    size_t next_index = 0;
+    for (size_t i = 0; i < fmt.size(); ++i) {
+        char c = fmt[i];
+        if ((c == '{' || c == '}') && i + 1 < fmt.size() && fmt[i + 1] == c) {
+            out += c;
+            ++i;
+            continue;
+        }
+        if (c != '{') {
+            out += c;
+            continue;
+        }
+
+        size_t close = fmt.find('}', i);
+        if (close == string_view::npos)
+            break;
+        string_view field = fmt.substr(i + 1, close - i - 1);
+        size_t colon = field.find(':');
+        string_view index = field.substr(0, colon);
+        string spec = "{";
+        if (colon != string_view::npos)
+            spec += field.substr(colon);
+        spec += '}';
+
+        size_t n = next_index++;
+        if (!index.empty())
+            std::from_chars(index.data(), index.data() + index.size(), n);
+        if (n < values.size()) {
+            try {
+                out += values[n].visit([&] (const auto &v) {
+                    return vformat(spec, make_format_args(v));
+                });
+            } catch (const std::format_error &) {
+                out += "<?>";
+            }
+        }
+        i = close;
+    }
+    return out;
+}
+
+string json_escape(string_view s) {
+    string out;
+    for (char c : s) {
+        switch (c) {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20)
+                    out += format("\\u{:04x}", c);
+                else
+                    out += c;
+        }
+    }
+    return out;
+}
+
+string json_value(const value &v) {
+    return v.visit([] <typename T> (const T &x) -> string {
+        if constexpr (std::is_same_v<T, string_view>)
+            return format("\"{}\"", json_escape(x));
+        else if constexpr (std::is_same_v<T, char>)
+            return format("\"{}\"", json_escape(string_view(&x, 1)));
+        else if constexpr (std::is_same_v<T, const void *>)
+            return format("\"{}\"", x);
+        else
+            return format("{}", x);
+    });
+}
+
+int main(int argc, char *argv[]) {
+    bool json = false;
+    path filename;
+    for (int i = 1; i < argc; ++i) {
+        if (string_view(argv[i]) == "--json")
+            json = true;
+        else
+            filename = argv[i];
+    }
+    if (filename.empty()) {
+        println(std::cerr, "usage: {} [--json] <file>", argv[0]);
+        return 1;
+    }
+
+    try {
+        trace_file file(filename);
+        const auto &h = file.header;
+        double ns_per_tick = 1e9 / static_cast<double>(h.tsc_frequency);
+
+        std::uint64_t end = h.ring_head;
+        std::uint64_t pos = end > h.ring_capacity ? end - h.ring_capacity : 0;
+        array<byte, trace::max_record_size> record;
+        vector<value> values;
+        while (pos + sizeof(trace::record_header) <= end) {
+            trace::record_header r;
+            file.read_ring(pos, &r, sizeof(r));
+            auto it = file.definitions.find(r.id);
+            bool valid = r.marker == trace::record_marker
+                && r.size >= sizeof(r) && r.size <= record.size() && r.size % 8 == 0
+                && pos + r.size <= end
+                && it != file.definitions.end();
+            if (!valid) {
+                /* torn or overwritten record, resync on the next aligned word */
+                pos += 8;
+                continue;
+            }
+
+            file.read_ring(pos, record.data(), r.size);
+            auto payload = span(record).subspan(sizeof(r), r.size - sizeof(r));
+            const definition &d = it->second;
+            if (!decode_args(payload, d.tags, values)) {
+                pos += 8;
+                continue;
+            }
+            pos += r.size;
+
+            auto ns = h.utc_origin + static_cast<std::int64_t>(
+                (static_cast<std::int64_t>(r.tsc - h.tsc_origin)) * ns_per_tick);
+            auto time = std::chrono::sys_time<std::chrono::nanoseconds>(std::chrono::nanoseconds(ns));
+            string_view level = r.level < level_names.size() ? level_names[r.level] : "unknown";
+            string message = render(d.fmt, values);
+
+            if (json) {
+                string args;
+                for (size_t i = 0; i < values.size(); ++i) {
+                    if (i > 0)
+                        args += ',';
+                    args += json_value(values[i]);
+                }
+                println(
+                    "{{\"time\":\"{:%FT%T}\",\"thread\":{},\"level\":\"{}\",\"id\":\"{:016x}\","
+                    "\"format\":\"{}\",\"args\":[{}],\"message\":\"{}\"}}",
+                    time, r.thread, level, r.id, json_escape(d.fmt), args, json_escape(message));
+            } else {
+                println("{:%x %T} [{}] {}: {}", time, r.thread, level, message);
+            }
+        }
+    } catch (const std::exception &e) {
+        println(std::cerr, "{}", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -8,12 +8,50 @@ local fastgltf = 'third_party/fastgltf/'
 local simdjson = 'third_party/simdjson/'
 
 local use_x11 = false
+-- the gl loader is generated from this header
+local gl_registry_header = '/usr/include/GL/glcorearb.h'
 
 set_toolchains('gcc')
---add_cxflags('--ffast-math', '-fno-finite-math-only', '-g', '-march=native')
-add_cxflags('-g')
+--add_cxflags('--ffast-math', '-fno-finite-math-only')
 -- add_ldflags("-static-libstdc++", "-static-libgcc")
--- set_policy('build.optimization.lto', true)
+
+-- modes (xmake f -m <mode>):
+-- debug:        -O0, symbols, gl debug context
+-- release:      -O3, lto, stripped (default)
+-- profile:      -O3, symbols, frame pointers, gprof instrumentation
+-- pgo-generate: release instrumented to write a profile to $(builddir)/pgo
+-- pgo-use:      release optimized with that profile
+-- the pgo task below runs the whole workflow
+add_rules('mode.debug', 'mode.release', 'mode.profile')
+set_allowedmodes('debug', 'release', 'profile', 'pgo-generate', 'pgo-use')
+set_defaultmode('release')
+
+if is_mode('release', 'pgo-generate', 'pgo-use') then
+    set_policy('build.optimization.lto', true)
+end
+if is_mode('profile') then
+    set_symbols('debug')
+    set_optimize('fastest')
+    add_cxflags('-fno-omit-frame-pointer')
+end
+if is_mode('pgo-generate', 'pgo-use') then
+    set_symbols('hidden')
+    set_optimize('fastest')
+    set_strip('all')
+end
+if is_mode('pgo-generate') then
+    -- the job scheduler runs instrumented code on every core
+    add_cxflags('-fprofile-generate=$(builddir)/pgo', '-fprofile-update=atomic')
+    add_ldflags('-fprofile-generate')
+elseif is_mode('pgo-use') then
+    -- code the training run never reached keeps its normal optimization
+    add_cxflags('-fprofile-use=$(builddir)/pgo', '-fprofile-partial-training', '-Wno-missing-profile')
+end
+
+local march = get_config('march')
+if march and march ~= '' then
+    add_cxflags('-march='..march)
+end
 
 rule('wayland-protocols')
     set_extensions('.xml')
@@ -34,6 +72,87 @@ rule('wayland-protocols')
         end, {files = sourcefile})
     end)
 
+-- FOR_EACH_GL_FUNCTION(X) with every entry point of glcorearb.h and a
+-- '#define glName gl_fn_glName' per entry point, see source/gl_api.h
+rule('gl-loader')
+    set_extensions('.h')
+    on_build_file(function (target, sourcefile, opt)
+        import("core.project.depend")
+        import("core.project.config")
+        local targetdir = path.join(config.builddir(), 'gl-loader')
+        local header = path.join(targetdir, 'gl_functions.h')
+        depend.on_changed(function ()
+            print('gl-loader '..sourcefile..' '..header)
+            local names = {}
+            for line in io.lines(sourcefile) do
+                local name = line:match('^GLAPI .-APIENTRY (gl[%w_]+) %(')
+                if name then
+                    table.insert(names, name)
+                end
+            end
+            local list = {'#define FOR_EACH_GL_FUNCTION(X) \\'}
+            local defines = {}
+            for _, name in ipairs(names) do
+                table.insert(list, '    X(PFN'..name:upper()..'PROC, '..name..') \\')
+                table.insert(defines, '#define '..name..' gl_fn_'..name)
+            end
+            table.insert(list, '')
+            os.mkdir(targetdir)
+            io.writefile(header,
+                '/* generated from '..sourcefile..', '..#names..' entry points */\n'..
+                '#pragma once\n'..
+                table.concat(list, '\n')..'\n'..
+                table.concat(defines, '\n')..'\n')
+        end, {files = sourcefile})
+    end)
+
+-- debug mode only. on (default): gl debug context, synchronous debug output
+-- and object logging. off: none of it is compiled in and the context has no
+-- error checking
+option('gl-debug')
+    set_default(true)
+    set_showmenu(true)
+    set_description('Build with the gl debug context and debug output')
+    add_defines('GEOMETRY_GL_DEBUG')
+
+option('march')
+    set_default('')
+    set_showmenu(true)
+    set_description('Target cpu of the whole build (-march=), e.g. native or x86-64-v3')
+
+-- hot functions marked MULTIVERSION (source/multiversion.h) get clones for
+-- newer cpus, picked at load time. for binaries that must run everywhere
+option('multiversion')
+    set_default(false)
+    set_showmenu(true)
+    set_description('Runtime dispatched x86-64-v3 / v4 clones of the hot geometry and ecs code')
+    add_defines('GEOMETRY_MULTIVERSION')
+
+-- build main with profile guided optimization: an instrumented build of the
+-- training target runs once, main is rebuilt with the profile it wrote.
+-- the training target shares main's objects through the core library
+task('pgo')
+    set_category('plugin')
+    on_run(function ()
+        import('core.base.option')
+        import('core.project.config')
+        local train = option.get('train')
+        os.exec('xmake f -m pgo-generate')
+        config.load()
+        os.tryrm(path.join(config.builddir(), 'pgo'))
+        os.exec('xmake build %s', train)
+        os.exec('xmake run %s', train)
+        os.exec('xmake f -m pgo-use')
+        os.exec('xmake build main')
+    end)
+    set_menu {
+        usage = 'xmake pgo [options]',
+        description = 'Build main with profile guided optimization',
+        options = {
+            {nil, 'train', 'kv', 'bench', 'Target whose run writes the profile'}
+        }
+    }
+
 target('glm')
     set_kind('static')
     set_languages('c++20')
@@ -117,6 +236,11 @@ target('glfw')
         end
     end
 
+target('gl-loader')
+    set_kind('static')
+    add_files(gl_registry_header, {rule = 'gl-loader'})
+    add_includedirs("$(builddir)/gl-loader", {public = true})
+
 target('imgui')
     set_kind('static')
     set_languages('c++20')
@@ -156,15 +280,67 @@ target('fastgltf')
     add_files(
         fastgltf..'src/*.cpp')
 
+-- gpu independent modules, shared by main and the benchmarks so that a pgo
+-- profile trained on one applies to the objects of the other
+target('core')
+    set_kind('static')
+    set_languages('c++26')
+    add_deps('glm', 'entt')
+    add_options('multiversion')
+    add_files(
+        'source/asset_io.cc',
+        'source/bvh.cc',
+        'source/camera.cc',
+        'source/ecs.cc',
+        'source/geometry.cc',
+        'source/jobs.cc',
+        'source/logger.cc',
+        'source/memory.cc',
+        'source/planet.cc',
+        'source/scene_file.cc',
+        'source/streaming.cc',
+        'source/trace.cc',
+        {public = true})
+
 target('main')
     set_kind('binary')
     set_languages('c++26')
     --add_cxflags('-fvisibility=hidden', '-fvisibility-inlines-hidden')
     --add_ldflags('-s')
-    add_syslinks('GL')
     add_includedirs('third_party')
-    add_deps('glfw', 'imgui', 'glm', 'entt')
+    add_deps('core', 'glfw', 'imgui', 'glm', 'entt', 'gl-loader')
+    add_options('multiversion')
+    if is_mode('debug') then
+        add_options('gl-debug')
+    end
 
     add_rules('utils.glsl2spv', {targetenv = 'opengl', client = "opengl100", bin2obj = true})
     add_files('source/*.glsl')
-    add_files('source/*.cc')
+    add_files('source/*.cc|asset_io.cc|bvh.cc|camera.cc|ecs.cc|geometry.cc|jobs.cc|logger.cc|memory.cc|planet.cc|scene_file.cc|streaming.cc|trace.cc')
+
+-- headless benchmarks of the core modules, json on stdout:
+--   xmake run bench [--filter <substring>] [--repetitions <n>] [--min-time <ms>] [--baseline <file.json>]
+target('bench')
+    set_kind('binary')
+    set_languages('c++26')
+    add_deps('core', 'glm', 'entt', 'gl-loader')
+    add_options('multiversion')
+    add_defines('GEOMETRY_BUILD_MODE="$(mode)"')
+    add_files('tools/bench.cc', 'source/heap_counting.cc')
+    -- render_graph's compile() and command replay into mock_api are
+    -- checked, neither needs a gl context
+    add_files('source/gl.cc', 'source/render_graph.cc', 'source/commands.cc')
+
+-- procedural world for the streamer, the viewer loads it with GEOMETRY_WORLD=<directory>:
+--   xmake run make-world [--cells <n>] <directory>
+target('make-world')
+    set_kind('binary')
+    set_languages('c++26')
+    add_deps('core', 'glm', 'entt')
+    add_files('tools/make_world.cc')
+
+target('trace-decode')
+    set_kind('binary')
+    set_languages('c++26')
+    add_files('source/trace.cc')
+    add_files('tools/trace_decode.cc')